@@ -15,6 +15,8 @@
 #define RIGHT_ARROW_SCANCODE 0x4D
 #define UP_ARROW_SCANCODE 0x48
 #define DOWN_ARROW_SCANCODE 0x50
+#define PAGE_UP_SCANCODE 0x49
+#define PAGE_DOWN_SCANCODE 0x51
 
 #define UPPERCASE_OFFSET 32
 
@@ -0,0 +1,71 @@
+#ifndef AGAVE_SERIAL_H
+#define AGAVE_SERIAL_H
+
+#include <agave/kdriver.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SERIAL_COM1 0x3F8
+#define SERIAL_IRQ 4
+#define SERIAL_BAUD 115200
+#define SERIAL_CLOCK 115200 // divisor latch input, baud = clock / divisor
+
+// register offsets from the base port
+#define SERIAL_DATA 0
+#define SERIAL_IER 1 // divisor high byte while DLAB is set
+#define SERIAL_IIR 2 // FCR on writes
+#define SERIAL_LCR 3
+#define SERIAL_MCR 4
+#define SERIAL_LSR 5
+#define SERIAL_MSR 6
+
+#define SERIAL_IER_RX 0x01
+#define SERIAL_IER_TX 0x02
+#define SERIAL_IER_LINE 0x04
+
+#define SERIAL_IIR_NONE 0x01
+#define SERIAL_IIR_ID_MASK 0x0E
+#define SERIAL_IIR_MODEM 0x00
+#define SERIAL_IIR_TX_EMPTY 0x02
+#define SERIAL_IIR_RX_DATA 0x04
+#define SERIAL_IIR_LINE 0x06
+#define SERIAL_IIR_RX_TIMEOUT 0x0C
+#define SERIAL_IIR_FIFO 0xC0
+
+#define SERIAL_FCR_ENABLE 0x01
+#define SERIAL_FCR_CLEAR_RX 0x02
+#define SERIAL_FCR_CLEAR_TX 0x04
+#define SERIAL_FCR_TRIGGER_14 0xC0
+
+#define SERIAL_LCR_8N1 0x03
+#define SERIAL_LCR_DLAB 0x80
+
+#define SERIAL_MCR_DTR 0x01
+#define SERIAL_MCR_RTS 0x02
+#define SERIAL_MCR_OUT2 0x08 // gates the interrupt line on PC UARTs
+#define SERIAL_MCR_LOOPBACK 0x10
+
+#define SERIAL_LSR_DATA_READY 0x01
+#define SERIAL_LSR_TX_EMPTY 0x20
+
+#define SERIAL_FIFO_SIZE 16
+#define SERIAL_TX_RING_SIZE 16384 // power of two, also holds the boot log until the driver is up
+
+/*
+ * COM1 as a second console. Output is queued in a ring and moved into the
+ * transmit FIFO from the transmit-empty interrupt, received bytes are
+ * decoded into key events for the input ring, VT100 escape sequences
+ * included. Writes before the driver is initialized are queued and go out
+ * once the UART is found.
+ */
+
+// queues raw bytes and never waits, bytes that do not fit in the ring are dropped until a panic
+void serial_write(const char *buf, size_t len);
+// sends everything queued by polling, for when interrupts will not come again
+void serial_flush(void);
+// for kpanic, the code that panicked may be holding the serial lock, later writes poll for room
+void serial_break_lock(void);
+// bytes serial_write dropped because the ring was full
+uint32_t serial_dropped_count(void);
+
+#endif // AGAVE_SERIAL_H
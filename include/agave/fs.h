@@ -39,7 +39,8 @@ typedef struct fs_backend {
 
     // file operations
     fs_status_t (*add_file)(void *fs, const char *path, const void *data, size_t size, uint8_t metadata);
-    fs_status_t (*read_file)(void *fs, const char *path, const void **out_data, size_t *size);
+    // copies up to capacity bytes into buf, size gets the size of the whole file
+    fs_status_t (*read_file)(void *fs, const char *path, void *buf, size_t capacity, size_t *size);
     fs_status_t (*remove_file)(void *fs, const char *path);
     fs_status_t (*write_file)(void *fs, const char *path, const void *data, size_t size);
     fs_status_t (*file_exists)(void *fs, const char *path, bool *out_exists);
@@ -79,7 +80,7 @@ void fs_switch_primary(const char *name);
 void fs_shutdown_all(void);
 
 fs_status_t fs_add_file(fs_t *fs, const char *path, const void *data, size_t size, uint8_t metadata);
-fs_status_t fs_read_file(fs_t *fs, const char *path, const void **out_data, size_t *out_size);
+fs_status_t fs_read_file(fs_t *fs, const char *path, void *buf, size_t capacity, size_t *out_size);
 fs_status_t fs_remove_file(fs_t *fs, const char *path);
 fs_status_t fs_write_file(fs_t *fs, const char *path, const void *data, size_t size);
 fs_status_t fs_file_exists(fs_t *fs, const char *path, bool *out_exists);
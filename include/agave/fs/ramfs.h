@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <agave/klock.h>
 
 typedef struct fs_backend fs_backend_t;
 
@@ -43,6 +44,7 @@ struct ramfs {
     ramfs_file_t *root;
     ramfs_file_t *buckets[RAMFS_HASH_BUCKETS];
     size_t total_size;
+    krwlock_t lock; // lookups and listings share it, changes to the tree take it exclusively
 };
 
 // helpers
@@ -30,16 +30,6 @@
 #define IRQ15 0x2F
 
 
-#define CREATE_ISR(num, irq_handler) \
-NAKED void irq##num##_handler(void) { \
-    __asm__ volatile( \
-        "pusha\n\t" \
-        "call " #irq_handler "\n\t" \
-        "popa\n\t" \
-        "iret" \
-    ); \
-}
-
 typedef struct {
     uint16_t isr_low;
     uint16_t kernel_cs;
@@ -53,16 +43,12 @@ typedef struct {
     uint32_t base;
 } PACKED idtr_t;
 
-typedef void (*irq_handler_t)(void);
-
 ALIGNED(16)
 extern idt_entry_t idt[IDT_MAX_DESCRIPTORS];
 extern idtr_t idtr;
 
 void idt_set_descriptor(uint8_t vector, void* isr, uint8_t flags);
+// points every vector at its entry stub, handlers are added with kirq_register
 void idt_init(void);
 
-void register_irq(uint8_t irq, irq_handler_t handler);
-void irq_dispatch(uint32_t irq);
-
 #endif // AGAVE_IDT_H
\ No newline at end of file
@@ -6,6 +6,7 @@
 #include <agave/drivers/keyboard.h>
 
 #define MAX_INPUT_HOOKS 16
+#define INPUT_RING_SIZE 256 // power of two
 
 /**
  * input_hook_t
@@ -22,6 +23,15 @@ extern input_hook_t input_hooks[MAX_INPUT_HOOKS];
 void on_key_press(uint8_t c);
 void on_key_release(uint8_t c);
 
+// producer side, called from interrupt handlers, returns false when the ring is full
+bool input_post_key(uint8_t c, bool released);
+// consumer side, runs the hooks for every queued event outside interrupt context
+void input_dispatch(void);
+bool input_has_pending(void);
+// blocks the calling thread until an event is queued
+void input_wait(void);
+uint32_t input_dropped_count(void);
+
 void register_input_hook(input_hook_t hook);
 void unregister_input_hook(input_hook_t hook);
 
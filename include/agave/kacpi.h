@@ -0,0 +1,61 @@
+#ifndef AGAVE_KACPI_H
+#define AGAVE_KACPI_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define KACPI_MAX_CPUS      16
+#define KACPI_MAX_IOAPICS   4
+#define KACPI_MAX_OVERRIDES 16
+
+// MADT interrupt source override flags
+#define KACPI_IRQ_POLARITY_MASK 0x03
+#define KACPI_IRQ_ACTIVE_LOW    0x03
+#define KACPI_IRQ_TRIGGER_MASK  0x0C
+#define KACPI_IRQ_LEVEL         0x0C
+
+/**
+ * kacpi_ioapic_t
+ * address: physical base of the register window.
+ * gsi_base: first global system interrupt routed through it.
+ */
+typedef struct {
+    uint8_t id;
+    uint32_t address;
+    uint32_t gsi_base;
+} kacpi_ioapic_t;
+
+/**
+ * kacpi_override_t
+ * source: ISA IRQ that is wired to a different GSI or polarity than the default.
+ * flags: polarity and trigger mode, 0 means bus default.
+ */
+typedef struct {
+    uint8_t source;
+    uint32_t gsi;
+    uint16_t flags;
+} kacpi_override_t;
+
+/**
+ * kacpi_madt_t
+ * lapic_address: physical base of the local APIC, the same on every CPU.
+ * cpu_apic_ids: local APIC IDs of the usable processors in table order.
+ * has_8259: the legacy PICs are present and have to be masked before using the IOAPIC.
+ */
+typedef struct {
+    uint32_t lapic_address;
+    uint32_t cpu_count;
+    uint8_t cpu_apic_ids[KACPI_MAX_CPUS];
+    uint32_t ioapic_count;
+    kacpi_ioapic_t ioapics[KACPI_MAX_IOAPICS];
+    uint32_t override_count;
+    kacpi_override_t overrides[KACPI_MAX_OVERRIDES];
+    bool has_8259;
+} kacpi_madt_t;
+
+// finds the RSDP and parses the MADT, false if either is missing, needs paging
+bool kacpi_init(void);
+// NULL when kacpi_init failed
+const kacpi_madt_t *kacpi_madt(void);
+
+#endif // AGAVE_KACPI_H
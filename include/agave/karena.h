@@ -0,0 +1,52 @@
+#ifndef AGAVE_KARENA_H
+#define AGAVE_KARENA_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <agave/kmem.h>
+
+// default chunk order, requests that do not fit get a chunk of their own
+#define KARENA_CHUNK_ORDER 0
+#define KARENA_ALIGN       8
+
+typedef struct karena_chunk karena_chunk_t;
+
+/**
+ * karena_t
+ * current: chunk allocations are carved from, earlier chunks hang off it.
+ * spare: one released chunk kept back so a pop followed by an alloc does not hit the page allocator.
+ * tag: allocation tag the chunks are charged to.
+ */
+typedef struct {
+    karena_chunk_t *current;
+    karena_chunk_t *spare;
+    kmem_tag_t tag;
+} karena_t;
+
+/**
+ * karena_mark_t
+ * chunk, used: position of the arena when the mark was taken.
+ */
+typedef struct {
+    karena_chunk_t *chunk;
+    size_t used;
+} karena_mark_t;
+
+#define KARENA_INIT(t) { .current = NULL, .spare = NULL, .tag = (t) }
+
+void karena_init(karena_t *arena, kmem_tag_t tag);
+void karena_destroy(karena_t *arena);
+
+// bump allocation, the memory is only released by karena_pop/karena_reset
+void *karena_alloc(karena_t *arena, size_t size);
+char *karena_strndup(karena_t *arena, const char *str, size_t len);
+
+karena_mark_t karena_mark(karena_t *arena);
+// frees everything allocated since the mark was taken
+void karena_pop(karena_t *arena, karena_mark_t mark);
+void karena_reset(karena_t *arena);
+
+// per-thread arena for allocations that do not outlive the current operation, callers mark and pop around use
+karena_t *kscratch(void);
+
+#endif // AGAVE_KARENA_H
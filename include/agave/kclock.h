@@ -0,0 +1,46 @@
+#ifndef AGAVE_KCLOCK_H
+#define AGAVE_KCLOCK_H
+
+#include <stdint.h>
+#include <agave/kutils.h>
+
+/**
+ * kclock_conv_t
+ * mult, shift: fixed-point factor, a value converts as (value * mult) >> shift.
+ */
+typedef struct {
+    uint32_t mult;
+    uint32_t shift;
+} kclock_conv_t;
+
+/**
+ * kclocksource_t
+ * read: free-running counter, must not wrap.
+ * frequency_khz: rate of the counter.
+ * to_ns: conversion from counter units to nanoseconds.
+ */
+typedef struct {
+    const char *name;
+    uint64_t (*read)(void);
+    uint32_t frequency_khz;
+    kclock_conv_t to_ns;
+} kclocksource_t;
+
+// factor for converting a value counted at `from` Hz into `to` Hz, both below 2^31
+void kclock_conv_init(kclock_conv_t *conv, uint32_t to, uint32_t from);
+
+static inline uint64_t kclock_convert(const kclock_conv_t *conv, uint64_t value) {
+    return kmul_u64_u32_shr(value, conv->mult, conv->shift);
+}
+
+// calibrates the TSC against PIT channel 2 and switches to it, the PIT clock is used until then
+void kclock_init(void);
+
+// monotonic nanoseconds since the PIT was started, safe from any context without a lock
+uint64_t kclock_ns(void);
+const kclocksource_t *kclock_source(void);
+
+// spins for at least the given time, resolution is that of the current clock source
+void kclock_delay_ns(uint64_t nanoseconds);
+
+#endif // AGAVE_KCLOCK_H
@@ -2,7 +2,104 @@
 #define AGAVE_KCPU_H
 
 #include <stdint.h>
+#include <stdbool.h>
+#include <agave/utils.h>
 
+#define KCPU_FEATURE_PSE  (1u << 0)
+#define KCPU_FEATURE_PGE  (1u << 1)
+#define KCPU_FEATURE_FXSR (1u << 2)
+#define KCPU_FEATURE_SSE  (1u << 3)
+#define KCPU_FEATURE_SSE2 (1u << 4)
+#define KCPU_FEATURE_ERMS (1u << 5)
+#define KCPU_FEATURE_TSC  (1u << 6)
+#define KCPU_FEATURE_INVARIANT_TSC (1u << 7) // constant rate across P-states and sleep
+#define KCPU_FEATURE_APIC (1u << 8)
+
+#define KCPU_MAX 16
+// application processors start in real mode here, the page must stay free below 1 MB
+#define KCPU_TRAMPOLINE_BASE 0x8000
+#define KCPU_WAKE_VECTOR     0xF0
+
+// per-CPU GDT, the first three entries match the boot GDT
+#define KCPU_GDT_ENTRIES 5
+#define KCPU_SEL_CODE    0x08
+#define KCPU_SEL_DATA    0x10
+#define KCPU_SEL_LOCAL   0x18 // %gs, based at the CPU's kcpu_local_t
+#define KCPU_SEL_TSS     0x20
+
+typedef struct kthread kthread_t;
+
+typedef struct {
+    uint32_t link;
+    uint32_t esp0, ss0, esp1, ss1, esp2, ss2;
+    uint32_t cr3, eip, eflags;
+    uint32_t eax, ecx, edx, ebx, esp, ebp, esi, edi;
+    uint32_t es, cs, ss, ds, fs, gs, ldt;
+    uint16_t trap;
+    uint16_t iomap_base;
+} PACKED kcpu_tss_t;
+
+/**
+ * kcpu_local_t
+ * self: points at the structure itself, read through %gs:0 by kcpu_this.
+ * id: index in boot order, the boot CPU is 0.
+ * online: set by the CPU once it runs on its own GDT and stack.
+ * sleeping: the CPU halts waiting for jobs, kcpu_wake sends it an IPI.
+ * current, preempt_count, need_resched: scheduler state, threads only run on the boot CPU.
+ * jobs_run, jobs_stolen: jobs executed here and how many of them came from another CPU's deque.
+ * irqoff_start, irqoff_site, irqoff_open: interrupts-off section being timed by kirqlat.
+ */
+typedef struct kcpu_local {
+    struct kcpu_local *self;
+    uint32_t id;
+    uint32_t apic_id;
+    volatile bool online;
+    volatile bool sleeping;
+    kthread_t *current;
+    volatile uint32_t preempt_count;
+    volatile bool need_resched;
+    uint64_t jobs_run;
+    uint64_t jobs_stolen;
+    uint64_t irqoff_start;
+    uint32_t irqoff_site;
+    bool irqoff_open;
+    void *stack;
+    uint64_t gdt[KCPU_GDT_ENTRIES] ALIGNED(8);
+    kcpu_tss_t tss;
+} kcpu_local_t;
+
+// detects features, enables SSE when the CPU supports it and loads the boot CPU's GDT, run before anything else
+void kcpu_init(void);
+bool kcpu_has(uint32_t feature);
+
+// finds the other processors in the MADT and starts them, after paging, the heap and the clock
+void kcpu_smp_init(void);
+// CPUs that are online, 1 until kcpu_smp_init
 uint32_t kcpu_get_cpu_count(void);
+kcpu_local_t *kcpu_get(uint32_t id);
+// sends a wakeup IPI if the CPU is halted waiting for jobs
+void kcpu_wake(kcpu_local_t *cpu);
+
+static inline kcpu_local_t *kcpu_this(void) {
+    kcpu_local_t *cpu;
+    __asm__("mov %%gs:0, %0" : "=r"(cpu));
+    return cpu;
+}
+
+static inline void kcpu_cpuid(uint32_t leaf, uint32_t *eax, uint32_t *ebx,
+                              uint32_t *ecx, uint32_t *edx) {
+    __asm__ volatile("cpuid" : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+                             : "a"(leaf), "c"(0));
+}
+
+static inline void kcpu_pause(void) {
+    __asm__ volatile("pause" : : : "memory");
+}
+
+static inline uint64_t kcpu_rdtsc(void) {
+    uint32_t lo, hi;
+    __asm__ volatile("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
 
-#endif // AGAVE_KCPU_H
\ No newline at end of file
+#endif // AGAVE_KCPU_H
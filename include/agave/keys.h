@@ -84,5 +84,9 @@
 #define KEY_DOWN       0x81
 #define KEY_LEFT       0x82
 #define KEY_RIGHT      0x83
+#define KEY_PAGE_UP    0x84
+#define KEY_PAGE_DOWN  0x85
+#define KEY_SCROLL_UP   0x86 // shift + page up
+#define KEY_SCROLL_DOWN 0x87 // shift + page down
 
 #endif // AGAVE_KEYS_H
\ No newline at end of file
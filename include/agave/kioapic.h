@@ -0,0 +1,18 @@
+#ifndef AGAVE_KIOAPIC_H
+#define AGAVE_KIOAPIC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <agave/kacpi.h>
+
+// maps every IOAPIC of the MADT and masks all of their inputs, false if there is none
+bool kioapic_init(const kacpi_madt_t *madt);
+// number of global system interrupts covered by the mapped IOAPICs
+uint32_t kioapic_get_gsi_count(void);
+
+// fixed delivery of the GSI to one CPU, flags are MADT override flags, the entry stays masked
+bool kioapic_route(uint32_t gsi, uint8_t vector, uint8_t apic_id, uint16_t flags);
+void kioapic_mask(uint32_t gsi);
+void kioapic_unmask(uint32_t gsi);
+
+#endif // AGAVE_KIOAPIC_H
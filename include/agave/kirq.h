@@ -0,0 +1,84 @@
+#ifndef AGAVE_KIRQ_H
+#define AGAVE_KIRQ_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <agave/utils.h>
+
+// handler slots shared by all vectors, registration happens at init and never frees one
+#define KIRQ_MAX_HANDLERS 32
+// vectors from here up are raised by the local APIC and acknowledged there
+#define KIRQ_LOCAL_VECTOR_BASE 0xE0
+
+/**
+ * kirq_frame_t
+ * Registers as the common entry stub leaves them on the stack: pusha, the
+ * vector, the error code (0 when the CPU pushes none) and the iret frame.
+ */
+typedef struct {
+    uint32_t edi, esi, ebp, esp, ebx, edx, ecx, eax;
+    uint32_t vector;
+    uint32_t error_code;
+    uint32_t eip, cs, eflags;
+} PACKED kirq_frame_t;
+
+typedef void (*kirq_handler_fn)(kirq_frame_t *frame, void *data);
+
+/**
+ * kirq_handler_t
+ * fn, data: called with interrupts disabled, before the interrupt is acknowledged.
+ * name: shown by irqstat.
+ * next: further handlers sharing the vector, in registration order.
+ */
+typedef struct kirq_handler {
+    kirq_handler_fn fn;
+    void *data;
+    const char *name;
+    struct kirq_handler *next;
+} kirq_handler_t;
+
+/**
+ * kirq_stats_t
+ * count: interrupts taken on the vector, all CPUs together.
+ * cycles: TSC cycles spent in its handlers and the acknowledgement.
+ */
+typedef struct {
+    uint64_t count;
+    uint64_t cycles;
+} kirq_stats_t;
+
+/*
+ * ISA IRQs keep their vectors, IRQ_BASE + irq, whichever controller delivers
+ * them. They go through the 8259 until kirq_init moves them to the IOAPIC,
+ * machines without one stay on the 8259.
+ */
+
+/*
+ * Switches to the IOAPIC when the MADT has one, needs kcpu_smp_init and
+ * interrupts off. Drivers have to be initialized afterwards: ISA interrupts
+ * are edge triggered, and an edge raised while the 8259 is being retired is
+ * never seen by the IOAPIC, which leaves a device like the 8042 waiting for
+ * its buffer to be read.
+ */
+void kirq_init(void);
+bool kirq_uses_apic(void);
+const char *kirq_controller_name(void);
+
+// adds a handler for the vector, exceptions without one panic
+bool kirq_register_vector(uint8_t vector, const char *name, kirq_handler_fn fn, void *data);
+// adds a handler for the ISA IRQ and unmasks it
+bool kirq_register(uint8_t irq, const char *name, kirq_handler_fn fn, void *data);
+
+void kirq_unmask(uint8_t irq);
+void kirq_mask(uint8_t irq);
+// acknowledges the IRQ at the controller that delivered it, a single MMIO write with the APIC
+void kirq_eoi(uint8_t irq);
+
+// called by every entry stub in idt.s
+void kirq_dispatch(kirq_frame_t *frame);
+
+// NULL when nothing is registered on the vector
+const kirq_handler_t *kirq_get_handlers(uint8_t vector);
+const kirq_stats_t *kirq_get_stats(uint8_t vector);
+
+#endif // AGAVE_KIRQ_H
@@ -0,0 +1,64 @@
+#ifndef AGAVE_KIRQLAT_H
+#define AGAVE_KIRQLAT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <agave/kirq.h>
+
+#define KIRQLAT_BUCKETS 32 // bucket n counts durations of 2^n to 2^(n+1) - 1 cycles
+#define KIRQLAT_WORST   8
+
+/**
+ * kirqlat_hist_t
+ * count, total_cycles, max_cycles: every recorded duration, in TSC cycles.
+ * buckets: log2 histogram of the durations.
+ */
+typedef struct {
+    uint64_t count;
+    uint64_t total_cycles;
+    uint64_t max_cycles;
+    uint32_t buckets[KIRQLAT_BUCKETS];
+} kirqlat_hist_t;
+
+/**
+ * kirqlat_offender_t
+ * site: code address of the cli or ksave_interrupts that started the section,
+ * or the vector when the section was an interrupt handler.
+ * cpu: where the longest section ran.
+ * cycles: longest section seen from the site.
+ */
+typedef struct {
+    uint32_t site;
+    uint32_t cpu;
+    uint64_t cycles;
+} kirqlat_offender_t;
+
+// sites below this are vectors, code is linked far above
+#define KIRQLAT_SITE_VECTORS 0x100
+
+/*
+ * Built with KIRQ_TRACE, every transition of the interrupt flag through the
+ * kutils.h helpers and every interrupt is timestamped with the TSC. Without
+ * it the hooks compile to nothing and the statistics stay empty.
+ */
+
+// starts recording, %gs has to point at the CPU's kcpu_local_t
+void kirqlat_init(void);
+bool kirqlat_enabled(void);
+void kirqlat_reset(void);
+
+#ifdef KIRQ_TRACE
+// kirq_dispatch brackets each interrupt with these, handler_cycles excludes softirqs and switches
+void kirqlat_irq_enter(const kirq_frame_t *frame);
+void kirqlat_irq_exit(const kirq_frame_t *frame, uint64_t handler_cycles);
+#else
+#define kirqlat_irq_enter(frame) ((void)(frame))
+#define kirqlat_irq_exit(frame, handler_cycles) ((void)(frame), (void)(handler_cycles))
+#endif
+
+const kirqlat_hist_t *kirqlat_irqs_off_hist(void);
+const kirqlat_hist_t *kirqlat_handler_hist(uint8_t vector);
+// longest sections first, unused entries have cycles 0
+const kirqlat_offender_t *kirqlat_worst(void);
+
+#endif // AGAVE_KIRQLAT_H
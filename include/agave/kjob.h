@@ -0,0 +1,51 @@
+#ifndef AGAVE_KJOB_H
+#define AGAVE_KJOB_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <agave/utils.h>
+
+// per-CPU deque capacity, a full deque runs new jobs inline
+#define KJOB_DEQUE_SIZE 256 // power of two
+
+typedef void (*kjob_fn)(void *data);
+typedef void (*kjob_range_fn)(size_t begin, size_t end, void *ctx);
+
+/**
+ * kjob_group_t
+ * pending: jobs spawned into the group that have not finished yet.
+ */
+typedef struct {
+    volatile uint32_t pending;
+} kjob_group_t;
+
+#define KJOB_GROUP_INIT { .pending = 0 }
+
+/**
+ * kjob_t
+ * fn, data: work to run, on any CPU.
+ * group: counted down once fn returns.
+ * The caller owns the storage, it has to stay valid until kjob_wait on the group returns.
+ */
+typedef struct {
+    kjob_fn fn;
+    void *data;
+    kjob_group_t *group;
+} kjob_t;
+
+/*
+ * Jobs run on whichever CPU gets to them first, application processors have
+ * no threads, so a job must not block or use kscratch.
+ */
+
+// pushes the job on the calling CPU's deque and wakes a halted CPU to steal it
+void kjob_spawn(kjob_group_t *group, kjob_t *job, kjob_fn fn, void *data);
+// runs queued jobs until every job of the group has finished
+void kjob_wait(kjob_group_t *group);
+// splits [0, count) in halves down to grain items and runs fn on the pieces in parallel
+void kjob_parallel_for(size_t count, size_t grain, kjob_range_fn fn, void *ctx);
+
+// idle loop of the application processors
+NORETURN void kjob_worker_loop(void);
+
+#endif // AGAVE_KJOB_H
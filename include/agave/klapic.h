@@ -0,0 +1,33 @@
+#ifndef AGAVE_KLAPIC_H
+#define AGAVE_KLAPIC_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define KLAPIC_TIMER_VECTOR    0xEF
+#define KLAPIC_SPURIOUS_VECTOR 0xFF
+
+// maps the register window at the physical base from the MADT and enables the boot CPU's APIC
+bool klapic_init(uint32_t base);
+bool klapic_available(void);
+// enables the APIC of the calling CPU, application processors call it once they run
+void klapic_enable(void);
+
+uint32_t klapic_id(void);
+void klapic_eoi(void);
+
+void klapic_send_ipi(uint32_t apic_id, uint8_t vector);
+void klapic_send_init(uint32_t apic_id);
+// the target starts in real mode at page << 12
+void klapic_send_startup(uint32_t apic_id, uint8_t page);
+
+// measures the timer rate against kclock and installs its handler, which calls ktimer_interrupt
+bool klapic_timer_init(void);
+// timer input clock after the divider
+uint32_t klapic_timer_khz(void);
+void klapic_timer_periodic(uint32_t frequency_hz);
+// a single interrupt after the given time, replaces a pending one
+void klapic_timer_oneshot(uint64_t nanoseconds);
+void klapic_timer_stop(void);
+
+#endif // AGAVE_KLAPIC_H
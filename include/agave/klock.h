@@ -0,0 +1,79 @@
+#ifndef AGAVE_KLOCK_H
+#define AGAVE_KLOCK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/**
+ * klock_stats_t
+ * acquisitions: successful lock operations, both sides of a reader-writer lock.
+ * contended: acquisitions that found the lock taken.
+ * spins: pause iterations spent waiting, all acquisitions together.
+ * max_hold_ns: longest exclusive hold, readers are not timed.
+ * Counters are only updated when built with KLOCK_STATS, a lock shows up in
+ * klock_stats_first once it has been taken.
+ */
+typedef struct klock_stats {
+    const char *name;
+    uint64_t acquisitions;
+    uint64_t contended;
+    uint64_t spins;
+    uint64_t max_hold_ns;
+    uint64_t acquired_ns;
+    bool registered;
+    struct klock_stats *next;
+} klock_stats_t;
+
+/**
+ * kspinlock_t
+ * next, owner: ticket counters, the lock is free when they are equal and is
+ * handed out in the order the tickets were drawn.
+ */
+typedef struct {
+    volatile uint16_t next;
+    volatile uint16_t owner;
+    klock_stats_t stats;
+} kspinlock_t;
+
+/**
+ * krwlock_t
+ * state: number of readers inside, -1 while a writer holds the lock.
+ * writers_waiting: new readers back off while this is non-zero so writers are not starved.
+ */
+typedef struct {
+    volatile int32_t state;
+    volatile uint32_t writers_waiting;
+    klock_stats_t stats;
+} krwlock_t;
+
+#define KSPINLOCK_INIT(lock_name) { .next = 0, .owner = 0, .stats = { .name = lock_name } }
+#define KRWLOCK_INIT(lock_name) { .state = 0, .writers_waiting = 0, .stats = { .name = lock_name } }
+
+/*
+ * Every lock disables preemption while it is held, the irqsave variants also
+ * disable interrupts and have to be used for data that interrupt handlers
+ * touch. None of them may be held across anything that blocks.
+ */
+
+void kspin_init(kspinlock_t *lock, const char *name);
+void kspin_lock(kspinlock_t *lock);
+bool kspin_trylock(kspinlock_t *lock);
+void kspin_unlock(kspinlock_t *lock);
+uint32_t kspin_lock_irqsave(kspinlock_t *lock);
+void kspin_unlock_irqrestore(kspinlock_t *lock, uint32_t flags);
+
+void krw_init(krwlock_t *lock, const char *name);
+// readers share the lock, taking it again while holding it can deadlock against a waiting writer
+void krw_read_lock(krwlock_t *lock);
+void krw_read_unlock(krwlock_t *lock);
+void krw_write_lock(krwlock_t *lock);
+void krw_write_unlock(krwlock_t *lock);
+uint32_t krw_read_lock_irqsave(krwlock_t *lock);
+void krw_read_unlock_irqrestore(krwlock_t *lock, uint32_t flags);
+uint32_t krw_write_lock_irqsave(krwlock_t *lock);
+void krw_write_unlock_irqrestore(krwlock_t *lock, uint32_t flags);
+
+// every lock taken so far, linked through klock_stats_t.next, NULL without KLOCK_STATS
+const klock_stats_t *klock_stats_first(void);
+
+#endif // AGAVE_KLOCK_H
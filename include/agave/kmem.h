@@ -2,20 +2,80 @@
 #define AGAVE_KMEM_H
 
 #include <stddef.h>
+#include <stdint.h>
 #include <stdbool.h>
 
-typedef struct block_header {
-    size_t size;
-    bool free;
-    struct block_header *next;
-} block_header_t;
+// subsystem an allocation is charged to, keep below 256 since tags are stored in a byte
+typedef enum kmem_tag {
+    KMEM_TAG_MISC,
+    KMEM_TAG_SLAB,
+    KMEM_TAG_VMM,
+    KMEM_TAG_FS,
+    KMEM_TAG_RAMFS,
+    KMEM_TAG_COMMAND,
+    KMEM_TAG_SCRATCH,
+    KMEM_TAG_THREAD,
+    KMEM_TAG_COUNT
+} kmem_tag_t;
+
+/**
+ * kmem_tag_stats_t
+ * live_bytes, live_allocs: memory currently held, in allocator block sizes.
+ * peak_bytes: high-water mark of live_bytes.
+ * total_allocs: allocations made since boot.
+ */
+typedef struct {
+    const char *name;
+    size_t live_bytes;
+    size_t live_allocs;
+    size_t peak_bytes;
+    size_t total_allocs;
+} kmem_tag_stats_t;
+
+// free heap blocks by size, bucket i holds sizes in [16 << i, 32 << i)
+#define KMEM_HISTOGRAM_BUCKETS 16
+
+typedef struct {
+    size_t region_count;
+    size_t total_bytes;
+    size_t free_bytes;
+    size_t free_blocks;
+    size_t largest_free;
+    size_t histogram[KMEM_HISTOGRAM_BUCKETS];
+} kmem_heap_info_t;
 
 void kheap_init(void);
+bool kheap_grow(size_t size);
+
+// heap backend, first-fit by default or TLSF when built with KMEM_TLSF
+void kheap_add_region(void *start, size_t size);
+void *kheap_alloc(size_t size);
+void *kheap_alloc_aligned(size_t size, size_t align);
+void kheap_free(void *ptr);
+// grows or shrinks a block in place, false if the following block cannot be absorbed
+bool kheap_resize(void *ptr, size_t size);
+size_t kheap_block_size(void *ptr);
+void kheap_set_tag(void *ptr, kmem_tag_t tag);
+kmem_tag_t kheap_get_tag(void *ptr);
+void kheap_walk_free(void (*fn)(size_t size, void *ctx), void *ctx);
+// the backend calls above are only safe between these, kmalloc and kfree take the lock themselves
+uint32_t kheap_lock(void);
+void kheap_unlock(uint32_t flags);
+
 void *kmalloc(size_t size);
+void *kmalloc_tagged(size_t size, kmem_tag_t tag);
 void kfree(void *ptr);
 void *krealloc(void *ptr, size_t new_size);
 void *kcalloc(size_t num, size_t size);
+
+void kmem_stats_alloc(kmem_tag_t tag, size_t bytes);
+void kmem_stats_free(kmem_tag_t tag, size_t bytes);
+const kmem_tag_stats_t *kmem_get_tag_stats(kmem_tag_t tag);
+void kmem_get_heap_info(kmem_heap_info_t *info);
+
+// dispatched to the best variant for the CPU, see kmemops.h
 void kmemcpy(void* dest, const void* src, size_t n);
+void kmemmove(void* dest, const void* src, size_t n);
 void kmemset(void* dest, int value, size_t n);
 
 #endif // AGAVE_KMEM_H
\ No newline at end of file
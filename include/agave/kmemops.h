@@ -0,0 +1,29 @@
+#ifndef AGAVE_KMEMOPS_H
+#define AGAVE_KMEMOPS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef void (*kmemcpy_fn)(void *dest, const void *src, size_t n);
+typedef void (*kmemset_fn)(void *dest, int value, size_t n);
+
+/**
+ * kmemops_variant_t
+ * name: short name shown by membench.
+ * features: KCPU_FEATURE_* bits the variant needs.
+ * copy, set: the implementations.
+ */
+typedef struct {
+    const char *name;
+    uint32_t features;
+    kmemcpy_fn copy;
+    kmemset_fn set;
+} kmemops_variant_t;
+
+// picks the fastest supported variant for kmemcpy/kmemset, needs kcpu_init
+void kmemops_init(void);
+
+const kmemops_variant_t *kmemops_variants(size_t *count);
+const kmemops_variant_t *kmemops_selected(void);
+
+#endif // AGAVE_KMEMOPS_H
@@ -0,0 +1,43 @@
+#ifndef AGAVE_KPAGE_H
+#define AGAVE_KPAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <agave/multiboot.h>
+
+#define KPAGE_SHIFT     12
+#define KPAGE_SIZE      (1u << KPAGE_SHIFT)
+#define KPAGE_MAX_ORDER 14 // 64 MB blocks
+
+// frames must stay identity mapped, so memory above the vmalloc area is ignored
+#define KPAGE_MEMORY_LIMIT 0xC0000000
+
+#define KPAGE_FLAG_RESERVED 0x01
+#define KPAGE_FLAG_FREE     0x02
+#define KPAGE_FLAG_SLAB     0x04
+
+/**
+ * kpage_t
+ * Per-frame descriptor. next/prev and order are only meaningful for the first
+ * frame of a free buddy block; flags are kept for every frame.
+ */
+typedef struct kpage {
+    struct kpage *next;
+    struct kpage *prev;
+    uint8_t order;
+    uint8_t flags;
+} kpage_t;
+
+void kpage_init(uint32_t magic, multiboot_info_t *mbi);
+
+void *kpage_alloc(uint32_t order);
+void kpage_free(void *addr, uint32_t order);
+uint32_t kpage_order_for(size_t size);
+
+kpage_t *kpage_of(const void *addr);
+
+uintptr_t kpage_memory_end(void);
+size_t kpage_total_count(void);
+size_t kpage_free_count(void);
+
+#endif // AGAVE_KPAGE_H
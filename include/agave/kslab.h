@@ -0,0 +1,50 @@
+#ifndef AGAVE_KSLAB_H
+#define AGAVE_KSLAB_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <agave/kpage.h>
+#include <agave/kmem.h>
+#include <agave/klock.h>
+
+#define KSLAB_ORDER       2
+#define KSLAB_SIZE        (KPAGE_SIZE << KSLAB_ORDER) // 16 KB, slabs are aligned to their size
+#define KSLAB_MIN_SIZE    16
+#define KSLAB_MAX_SIZE    2048
+#define KSLAB_CLASS_COUNT 8
+
+typedef struct kslab kslab_t;
+
+typedef struct kmem_cache {
+    const char *name;
+    size_t object_size;
+    size_t objects_per_slab;
+    kmem_tag_t tag;
+    kspinlock_t lock; // the slab lists and counters below
+
+    kslab_t *partial;
+    kslab_t *full;
+    kslab_t *empty;
+
+    size_t slab_count;
+    size_t active_objects;
+
+    struct kmem_cache *next;
+} kmem_cache_t;
+
+kmem_cache_t *kmem_cache_create(const char *name, size_t object_size, kmem_tag_t tag);
+void kmem_cache_destroy(kmem_cache_t *cache);
+void *kmem_cache_alloc(kmem_cache_t *cache);
+void kmem_cache_free(kmem_cache_t *cache, void *ptr);
+
+// size-class front end used by kmalloc/kfree for requests up to KSLAB_MAX_SIZE
+void *kslab_alloc(size_t size, kmem_tag_t tag);
+void kslab_free(void *ptr);
+bool kslab_owns(const void *ptr);
+size_t kslab_object_size(const void *ptr);
+kmem_tag_t kslab_object_tag(const void *ptr);
+
+// all caches, size classes included, linked through kmem_cache_t.next
+kmem_cache_t *kslab_first_cache(void);
+
+#endif // AGAVE_KSLAB_H
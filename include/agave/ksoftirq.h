@@ -0,0 +1,43 @@
+#ifndef AGAVE_KSOFTIRQ_H
+#define AGAVE_KSOFTIRQ_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// lower types run first
+typedef enum ksoftirq_type {
+    KSOFTIRQ_TIMER,
+    KSOFTIRQ_COUNT
+} ksoftirq_type_t;
+
+typedef void (*ksoftirq_fn)(void);
+
+/**
+ * ksoftirq_stats_t
+ * runs: times the handler was called.
+ * total_ns, max_ns: time spent in the handler, with interrupts enabled.
+ */
+typedef struct {
+    const char *name;
+    uint64_t runs;
+    uint64_t total_ns;
+    uint64_t max_ns;
+} ksoftirq_stats_t;
+
+void ksoftirq_open(ksoftirq_type_t type, ksoftirq_fn fn);
+// marks the type pending, safe from interrupt handlers
+void ksoftirq_raise(ksoftirq_type_t type);
+bool ksoftirq_pending(void);
+// runs pending handlers with interrupts enabled unless softirqs are already running or disabled,
+// or preemption is disabled
+void ksoftirq_run(void);
+// called by kirq_dispatch after the handlers, with interrupts disabled
+void ksoftirq_irq_exit(void);
+
+// sections that must not be interrupted by softirq handlers, may nest
+void ksoftirq_disable(void);
+void ksoftirq_enable(void);
+
+const ksoftirq_stats_t *ksoftirq_get_stats(ksoftirq_type_t type);
+
+#endif // AGAVE_KSOFTIRQ_H
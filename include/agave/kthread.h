@@ -0,0 +1,96 @@
+#ifndef AGAVE_KTHREAD_H
+#define AGAVE_KTHREAD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <agave/karena.h>
+#include <agave/utils.h>
+
+// 16 KB per thread, the kthread_t sits at the low end below the stack
+#define KTHREAD_STACK_ORDER 2
+#define KTHREAD_SLICE_MS    10
+#define KTHREAD_NAME_LEN    16
+
+typedef void (*kthread_fn)(void *arg);
+
+typedef enum kthread_state {
+    KTHREAD_RUNNING,
+    KTHREAD_RUNNABLE,
+    KTHREAD_BLOCKED,
+    KTHREAD_ZOMBIE
+} kthread_state_t;
+
+typedef struct kthread kthread_t;
+
+/**
+ * kwait_queue_t
+ * head, tail: threads blocked in kwait_sleep, woken in FIFO order.
+ */
+typedef struct {
+    kthread_t *head;
+    kthread_t *tail;
+} kwait_queue_t;
+
+#define KWAIT_QUEUE_INIT { .head = NULL, .tail = NULL }
+
+/**
+ * kthread_t
+ * esp: saved stack pointer while the thread is switched out, must stay first.
+ * next: link in the run queue or a wait queue.
+ * all_next: link in the list of every thread, for the threads command.
+ * entry, arg: function the thread runs, returning from it is kthread_exit(0).
+ * joiners: threads waiting in kthread_join.
+ * scratch: per-thread arena returned by kscratch.
+ * switches: times the thread was switched in.
+ * fpu: FXSAVE area, saved and restored on every switch when SSE is enabled.
+ * canary: overwritten when the stack runs into the kthread_t.
+ */
+struct kthread {
+    uint32_t esp;
+    kthread_t *next;
+    kthread_t *all_next;
+    kthread_state_t state;
+    uint32_t id;
+    char name[KTHREAD_NAME_LEN];
+    kthread_fn entry;
+    void *arg;
+    int exit_code;
+    kwait_queue_t joiners;
+    karena_t scratch;
+    uint64_t switches;
+    uint8_t fpu[512] ALIGNED(16);
+    uint32_t canary;
+};
+
+// turns the caller into the main thread and starts the idle thread, after the heap and timer are up
+void kthread_init(void);
+kthread_t *kthread_current(void);
+kthread_t *kthread_first(void);
+const char *kthread_state_name(kthread_state_t state);
+
+// the thread is runnable on return, every thread must be joined to free its stack
+kthread_t *kthread_create(const char *name, kthread_fn entry, void *arg);
+NORETURN void kthread_exit(int code);
+int kthread_join(kthread_t *thread);
+void kthread_yield(void);
+
+// blocks the current thread until kthread_wake, call with interrupts disabled, returns with them disabled
+void kthread_block(void);
+// makes a blocked thread runnable, safe from interrupt handlers
+void kthread_wake(kthread_t *thread);
+// false before kthread_init and while preemption is disabled, callers then have to spin
+bool kthread_can_block(void);
+
+// keeps the current thread on the CPU, interrupts stay enabled, may nest
+void kthread_preempt_disable(void);
+void kthread_preempt_enable(void);
+// called by kirq_dispatch last, switches threads if the time slice ran out or a wakeup asked for it
+void kthread_irq_exit(void);
+
+void kwait_queue_init(kwait_queue_t *queue);
+// blocks on the queue, call with interrupts disabled after checking the condition, recheck it on return
+void kwait_sleep(kwait_queue_t *queue);
+void kwait_wake_one(kwait_queue_t *queue);
+void kwait_wake_all(kwait_queue_t *queue);
+
+#endif // AGAVE_KTHREAD_H
@@ -1,10 +1,41 @@
 #ifndef AGAVE_KTIMER_H
 #define AGAVE_KTIMER_H
 
+#include <stdbool.h>
+#include <stdint.h>
 #include <agave/pit.h>
 
+#define KTIMER_NEVER ((uint64_t)-1)
+
+typedef void (*ktimer_fn)(void *data);
+
+/**
+ * ktimer_t
+ * next, pprev: links in a wheel slot or the expired list, pprev is NULL while the timer is idle.
+ * expires: tick at which the callback becomes due.
+ * fn, data: callback and its argument, run from ktimer_run_expired with interrupts enabled.
+ * slot: wheel slot the timer is linked into.
+ */
+typedef struct ktimer {
+    struct ktimer *next;
+    struct ktimer **pprev;
+    uint64_t expires;
+    ktimer_fn fn;
+    void *data;
+    uint32_t slot;
+} ktimer_t;
+
 void ktimer_initialize(uint32_t frequency_hz);
+// moves the timer interrupt from the PIT to the boot CPU's LAPIC timer, needs the TSC clock
+bool ktimer_use_lapic(void);
+// "pit" or "lapic"
+const char *ktimer_device_name(void);
+uint32_t ktimer_get_frequency(void);
 uint64_t ktimer_get_ticks(void);
+// multiply and shift by factors computed in ktimer_initialize, no division
+uint64_t ktimer_ticks_to_milliseconds(uint64_t ticks);
+uint64_t ktimer_ticks_to_microseconds(uint64_t ticks);
+uint64_t ktimer_ticks_to_nanoseconds(uint64_t ticks);
 uint64_t ktimer_get_milliseconds(void);
 uint64_t ktimer_get_microseconds(void);
 uint64_t ktimer_get_nanoseconds(void);
@@ -13,4 +44,17 @@ void ksleep_micro(uint32_t microseconds);
 void ksleep_nano(uint32_t nanoseconds);
 void ktimer_wait_ticks(uint64_t ticks);
 
+void ktimer_setup(ktimer_t *timer, ktimer_fn fn, void *data);
+// (re)arms the timer for an absolute tick, callbacks in upper wheel levels may run up to 1/8 late
+void ktimer_arm(ktimer_t *timer, uint64_t expires);
+void ktimer_arm_ms(ktimer_t *timer, uint32_t milliseconds);
+// returns whether the timer was still pending
+bool ktimer_cancel(ktimer_t *timer);
+bool ktimer_is_pending(const ktimer_t *timer);
+
+// called from the timer interrupt, raises the timer softirq when timers are due
+void ktimer_interrupt(void);
+// runs every due callback, normally from the timer softirq with interrupts enabled
+void ktimer_run_expired(void);
+
 #endif // AGAVE_KTIMER_H
\ No newline at end of file
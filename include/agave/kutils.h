@@ -2,17 +2,89 @@
 #define AGAVE_KUTILS_H
 
 #include "stdbool.h"
+#include "stdint.h"
 #define kidle() while (1) { khalt_cpu(false); }
 
+// interrupt flag in the value ksave_interrupts returns and in interrupt frames
+#define EFLAGS_IF 0x200
+
 char* kitoa(int value, char* buffer, int base);
 char* kitoa_unsigned(unsigned int value, char* buffer, int base);
+char* kitoa64(int64_t value, char* buffer, int base);
+char* kitoa_unsigned64(uint64_t value, char* buffer, int base);
+
+// 64 by 32 bit division with two divl instructions, no runtime call
+static inline uint64_t kdiv_u64_u32(uint64_t n, uint32_t d, uint32_t *rem) {
+    uint32_t hi = (uint32_t)(n >> 32), lo = (uint32_t)n;
+    uint32_t q_hi = hi / d;
+    uint32_t q_lo, r;
+    __asm__("divl %4" : "=a"(q_lo), "=d"(r) : "a"(lo), "d"(hi % d), "rm"(d));
+    if (rem) *rem = r;
+    return ((uint64_t)q_hi << 32) | q_lo;
+}
+
+// (a * mul) >> shift with a 96-bit intermediate, shift must be below 64
+static inline uint64_t kmul_u64_u32_shr(uint64_t a, uint32_t mul, uint32_t shift) {
+    uint64_t lo = (uint64_t)(uint32_t)a * mul;
+    uint64_t hi = (uint64_t)(uint32_t)(a >> 32) * mul;
+    if (shift >= 32)
+        return (hi + (lo >> 32)) >> (shift - 32);
+    return (lo >> shift) + (hi << (32 - shift));
+}
+
+#ifdef KIRQ_TRACE
+// kirqlat.c, called with interrupts off whenever the helpers below change the interrupt flag
+void kirqlat_irqs_off(uint32_t site);
+void kirqlat_irqs_on(void);
+
+// address of the instruction, inlined helpers report the code that called them
+#define KIRQLAT_SITE() ({ uint32_t _site; __asm__ volatile("movl $1f, %0\n1:" : "=r"(_site)); _site; })
+#endif
 
 static inline void kenable_interrupts() {
+#ifdef KIRQ_TRACE
+    kirqlat_irqs_on();
+#endif
     __asm__ volatile("sti");
 }
 
 static inline void kdisable_interrupts() {
+#ifdef KIRQ_TRACE
+    uint32_t flags;
+    __asm__ volatile("pushf\n\tpop %0\n\tcli" : "=r"(flags) : : "memory");
+    if (flags & EFLAGS_IF)
+        kirqlat_irqs_off(KIRQLAT_SITE());
+#else
     __asm__ volatile("cli");
+#endif
+}
+
+// disables interrupts and returns the previous EFLAGS for krestore_interrupts
+static inline uint32_t ksave_interrupts(void) {
+    uint32_t flags;
+    __asm__ volatile("pushf\n\tpop %0\n\tcli" : "=r"(flags) : : "memory");
+#ifdef KIRQ_TRACE
+    if (flags & EFLAGS_IF)
+        kirqlat_irqs_off(KIRQLAT_SITE());
+#endif
+    return flags;
+}
+
+static inline void krestore_interrupts(uint32_t flags) {
+    if (flags & EFLAGS_IF) {
+#ifdef KIRQ_TRACE
+        kirqlat_irqs_on();
+#endif
+        __asm__ volatile("sti" : : : "memory");
+    }
+}
+
+// sti only takes effect after the next instruction, so a wakeup cannot slip in before the hlt
+static inline void kwait_for_interrupt(void) {
+#ifdef KIRQ_TRACE
+    kirqlat_irqs_on();
+#endif
+    __asm__ volatile("sti\n\thlt" : : : "memory");
 }
 
 static inline void khalt_cpu(bool disable_interrupts) {
@@ -10,6 +10,11 @@
 #define SCREEN_WIDTH 80
 #define SCREEN_HEIGHT 25
 
+// bytes of scrolled-off text kept for kscrollback, about one per character
+#ifndef KVID_SCROLLBACK_SIZE
+#define KVID_SCROLLBACK_SIZE (64 * 1024) // power of two
+#endif
+
 #define _VGA_BLACK         0x0
 #define _VGA_BLUE          0x1
 #define _VGA_GREEN         0x2
@@ -50,8 +55,6 @@ static inline uint8_t kcreate_color(kcolor_t fg, kcolor_t bg) {
     return fg | (bg << 4);
 }
 
-extern uint16_t* vidptr;
-
 extern uint8_t kcurrent_color;
 extern size_t kline_end[SCREEN_HEIGHT];
 
@@ -64,6 +67,8 @@ void ksetpos(size_t row, size_t col);
 kpos_t kgetpos(void);
 
 void kputchar(char c);
+// one lock hold, flush and cursor update for the whole buffer
+void kwrite(const char* buf, size_t len);
 void kprint(const char* str);
 void kprintf(const char* fmt, ...);
 
@@ -79,8 +84,17 @@ void kmove_cursor_down(void);
 void kvprintf(const char* fmt, va_list args);
 
 void kupdate_cursor(void);
+// for kpanic, the code that panicked may be holding the console lock
+void kvid_break_lock(void);
 
 int ksnprintf(char *buf, size_t size, const char *fmt, ...);
 
 void kclear(void);
+// blanks the row from col to its end and makes col the new end
+void kclear_line_from(size_t row, size_t col);
+
+// moves the view the given number of lines back into the scrollback, negative values go forward
+void kscrollback(int lines);
+// shows the live screen again if the view is scrolled back
+void kscrollback_reset(void);
 #endif //AGAVE_KVID_H
\ No newline at end of file
@@ -0,0 +1,40 @@
+#ifndef AGAVE_KVMM_H
+#define AGAVE_KVMM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <agave/kmem.h>
+
+// physical memory is identity mapped below KVMM_VMALLOC_START
+#define KVMM_VMALLOC_START 0xC0000000
+#define KVMM_VMALLOC_END   0xF0000000
+
+// IPI that makes the other CPUs drop TLB entries for unmapped pages
+#define KVMM_SHOOTDOWN_VECTOR 0xF1
+
+#define KVMM_FLAG_WRITE    0x002
+#define KVMM_FLAG_NOCACHE  0x010
+
+// kvmalloc hands requests of at least this size to vmalloc
+#define KVMM_VMALLOC_THRESHOLD 0x10000
+
+void kvmm_init(void);
+
+bool kvmm_map_page(uintptr_t virt, uintptr_t phys, uint32_t flags);
+// the page is gone from every CPU's TLB on return, so its frame can be reused
+void kvmm_unmap_page(uintptr_t virt);
+// maps firmware tables and MMIO above the RAM at their physical address, pages already mapped are kept
+bool kvmm_identity_map(uintptr_t start, size_t size, uint32_t flags);
+
+// virtually contiguous, backed by scattered frames, followed by an unmapped guard page
+void *vmalloc(size_t size);
+void vfree(void *ptr);
+bool kvmm_is_vmalloc(const void *ptr);
+
+// kmalloc for small sizes, vmalloc for large ones
+void *kvmalloc(size_t size);
+void *kvmalloc_tagged(size_t size, kmem_tag_t tag);
+void kvfree(void *ptr);
+
+#endif // AGAVE_KVMM_H
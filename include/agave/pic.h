@@ -8,6 +8,9 @@
 void pic_remap();
 
 void pic_unmask_irq(uint8_t irq);
+void pic_mask_irq(uint8_t irq);
+// masks every line, used once the IOAPIC takes over
+void pic_disable(void);
 void pic_send_eoi(uint8_t irq);
 
 #endif // AGAVE_PIC_H
\ No newline at end of file
@@ -3,7 +3,21 @@
 
 #include <stdint.h>
 
+#define PIT_FREQUENCY   1193182 // input clock in Hz
+#define PIT_NO_DEADLINE ((uint64_t)-1)
+
+// periodic interrupt at frequency_hz
 void pit_init(uint32_t frequency_hz);
-uint64_t pit_get_ticks(void);
+// one-shot interrupts, at the deadline or at the latest when the 16-bit counter runs out
+void pit_init_oneshot(void);
+
+// monotonic count of PIT input clocks since pit_init or pit_init_oneshot
+uint64_t pit_get_clocks(void);
+// next one-shot fires no later than the given pit_get_clocks value and clears the deadline,
+// ignored in periodic mode
+void pit_set_deadline(uint64_t clocks);
+
+// spins on channel 2 until the given number of clocks has passed, works with interrupts off
+void pit_busy_wait(uint16_t clocks);
 
-#endif // AGAVE_PIT_H
\ No newline at end of file
+#endif // AGAVE_PIT_H
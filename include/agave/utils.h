@@ -6,5 +6,6 @@
 #define ALIGNED(x)  __attribute__((aligned(x)))
 #define NAKED       __attribute__((naked))
 #define NORETURN    __attribute__((noreturn))
+#define UNUSED      __attribute__((unused))
 
 #endif // AGAVE_UTILS_H
@@ -1,96 +1,43 @@
 global isr_stub_table
-extern exception_handler
-extern irq0_handler
-extern irq1_handler
+extern kirq_dispatch
 
-; macro for exceptions with error code
-%macro isr_err_stub 1
-isr_stub_%1:
-    cli
-    push eax
-    push ebx
-    push ecx
-    push edx
-    push esi
-    push edi
-    push ebp
-    call exception_handler
-    pop ebp
-    pop edi
-    pop esi
-    pop edx
-    pop ecx
-    pop ebx
-    pop eax
-    iret
-%endmacro
+section .text
 
-; macro for IRQs / exceptions without error code
-%macro isr_no_err_stub 2
+; every vector gets a stub that pushes the same frame, kirq_frame_t, and
+; enters the common path. The CPU pushes an error code only for these
+; exceptions, the others push a zero in its place.
+%macro isr_stub 1
 isr_stub_%1:
-    cli
-    push eax
-    push ebx
-    push ecx
-    push edx
-    push esi
-    push edi
-    push ebp
-    call %2
-    pop ebp
-    pop edi
-    pop esi
-    pop edx
-    pop ecx
-    pop ebx
-    pop eax
-    iret
+%if %1 == 8 || (%1 >= 10 && %1 <= 14) || %1 == 17 || %1 == 21 || %1 == 29 || %1 == 30
+%else
+    push dword 0
+%endif
+    push dword %1
+    jmp isr_common
 %endmacro
 
-; default handler for unused IRQs
-default_irq_handler:
-    mov al, 0x20
-    out 0x20, al
+isr_common:
+    pusha
+    cld
+    push esp            ; kirq_frame_t *
+    call kirq_dispatch
+    add esp, 4
+    popa
+    add esp, 8          ; vector and error code
     iret
 
 ; --- stubs ---
-isr_no_err_stub 0, irq0_handler
-isr_no_err_stub 1, irq1_handler
-isr_no_err_stub 2, default_irq_handler
-isr_no_err_stub 3, default_irq_handler
-isr_no_err_stub 4, default_irq_handler
-isr_no_err_stub 5, default_irq_handler
-isr_no_err_stub 6, default_irq_handler
-isr_no_err_stub 7, default_irq_handler
-isr_err_stub    8
-isr_no_err_stub 9, default_irq_handler
-isr_err_stub   10
-isr_no_err_stub 11, default_irq_handler
-isr_err_stub   12
-isr_err_stub   13
-isr_err_stub   14
-isr_no_err_stub 15, default_irq_handler
-isr_no_err_stub 16, default_irq_handler
-isr_no_err_stub 17, default_irq_handler
-isr_err_stub   18
-isr_no_err_stub 19, default_irq_handler
-isr_no_err_stub 20, default_irq_handler
-isr_no_err_stub 21, default_irq_handler
-isr_no_err_stub 22, default_irq_handler
-isr_no_err_stub 23, default_irq_handler
-isr_no_err_stub 24, default_irq_handler
-isr_no_err_stub 25, default_irq_handler
-isr_no_err_stub 26, default_irq_handler
-isr_no_err_stub 27, default_irq_handler
-isr_no_err_stub 28, default_irq_handler
-isr_no_err_stub 29, default_irq_handler
-isr_no_err_stub 30, default_irq_handler
-isr_no_err_stub 31, default_irq_handler
+%assign i 0
+%rep 256
+    isr_stub i
+%assign i i+1
+%endrep
 
 ; --- ISR table ---
+section .rodata
 isr_stub_table:
 %assign i 0
-%rep 32
+%rep 256
     dd isr_stub_%+i
 %assign i i+1
-%endrep
\ No newline at end of file
+%endrep
@@ -0,0 +1,81 @@
+; ap_trampoline.s - real mode entry for application processors
+;
+; kcpu_smp_init copies this code to KCPU_TRAMPOLINE_BASE and fills in the
+; parameter block before sending the startup IPI. The processor starts in
+; real mode at the base with cs = base >> 4, so every address below is
+; computed relative to the copy instead of the link address.
+
+BITS 16
+
+TRAMPOLINE_BASE equ 0x8000
+%define REL(x) (TRAMPOLINE_BASE + (x) - ap_trampoline_start)
+
+section .rodata
+
+global ap_trampoline_start
+global ap_trampoline_params
+global ap_trampoline_end
+
+ap_trampoline_start:
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+
+    ; the temporary GDT is inside the copy, below 1 MB
+    o32 lgdt [REL(ap_gdt_ptr)]
+
+    mov eax, cr0
+    or  eax, 1
+    mov cr0, eax
+    jmp dword 0x08:REL(ap_protected_mode)
+
+BITS 32
+ap_protected_mode:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+
+    ; same paging and FPU setup as the boot CPU
+    mov eax, [REL(ap_param_cr4)]
+    mov cr4, eax
+    mov eax, [REL(ap_param_cr3)]
+    mov cr3, eax
+    mov eax, [REL(ap_param_cr0)]
+    mov cr0, eax
+
+    mov esp, [REL(ap_param_stack)]
+    xor ebp, ebp
+    push dword [REL(ap_param_cpu)]
+    call [REL(ap_param_entry)]
+
+.halt_loop:
+    cli
+    hlt
+    jmp .halt_loop
+
+align 8
+ap_gdt:
+    dq 0x0000000000000000      ; null descriptor
+    dq 0x00CF9A000000FFFF      ; code segment
+    dq 0x00CF92000000FFFF      ; data segment
+ap_gdt_end:
+
+ap_gdt_ptr:
+    dw ap_gdt_end - ap_gdt - 1
+    dd REL(ap_gdt)
+
+; layout must match kcpu_ap_params_t
+align 4
+ap_trampoline_params:
+ap_param_cr0:   dd 0
+ap_param_cr3:   dd 0
+ap_param_cr4:   dd 0
+ap_param_stack: dd 0
+ap_param_entry: dd 0
+ap_param_cpu:   dd 0
+
+ap_trampoline_end:
@@ -5,10 +5,13 @@ BITS 32
 ; -----------------------
 ; multiboot header
 ; -----------------------
+MB_MAGIC equ 0x1BADB002
+MB_FLAGS equ 0x3               ; page-align modules, request the memory map
+
 section .multiboot header align=4
-    dd 0x1BADB002              ; magic number
-    dd 0x0                     ; flags
-    dd -(0x1BADB002 + 0x0)     ; checksum
+    dd MB_MAGIC                ; magic number
+    dd MB_FLAGS                ; flags
+    dd -(MB_MAGIC + MB_FLAGS)  ; checksum
 
 ; -----------------------
 ; GDT
@@ -33,6 +36,9 @@ extern kmain
 
 _start:
     cli
+    ; the loader leaves its magic in eax and the multiboot info pointer in ebx
+    mov esi, eax
+    mov edi, ebx
     xor ebp, ebp
     mov esp, 0x9F000
 
@@ -53,6 +59,8 @@ protected_mode_entry:
     mov gs, ax
     mov ss, ax
 
+    push edi
+    push esi
     call kmain
 
 .halt_loop:
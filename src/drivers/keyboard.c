@@ -1,14 +1,14 @@
 #include "agave/input.h"
 #include "agave/ports.h"
 #include <agave/drivers/keyboard.h>
-#include <agave/idt.h>
 #include <agave/io.h>
 #include <agave/kdriver.h>
+#include <agave/kirq.h>
 #include <agave/keys.h>
 #include <agave/kvid.h>
-#include <agave/pic.h>
 #include <agave/utils.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 keyboard_state_t keyboard_state = {false, false};
 
@@ -35,13 +35,13 @@ static uint8_t scancode_to_ascii(uint8_t scancode) {
     return (scancode < sizeof(scancode_map)) ? scancode_map[scancode] : KEY_NONE;
 }
 
-void keyboard_handler(void) {
+static void _keyboard_interrupt(UNUSED kirq_frame_t *frame, UNUSED void *data) {
     static bool extended = false;
     uint8_t scancode = inb(KEYBOARD_DATA);
     bool released = scancode & 0x80;
     uint8_t keycode = scancode & 0x7F;
 
-    if (scancode == 0xE0) { extended = true; outb(PIC1_COMMAND, PIC_EOI); return; }
+    if (scancode == 0xE0) { extended = true; return; }
 
     bool is_shift = (keycode == LEFT_SHIFT_SCANCODE || keycode == RIGHT_SHIFT_SCANCODE);
     keyboard_state.shift_pressed = (keyboard_state.shift_pressed & !is_shift) | (is_shift & !released);
@@ -57,6 +57,8 @@ void keyboard_handler(void) {
             case LEFT_ARROW_SCANCODE: ascii = KEY_LEFT; break;
             case RIGHT_ARROW_SCANCODE: ascii = KEY_RIGHT; break;
             case DOWN_ARROW_SCANCODE: ascii = KEY_DOWN; break;
+            case PAGE_UP_SCANCODE: ascii = keyboard_state.shift_pressed ? KEY_SCROLL_UP : KEY_PAGE_UP; break;
+            case PAGE_DOWN_SCANCODE: ascii = keyboard_state.shift_pressed ? KEY_SCROLL_DOWN : KEY_PAGE_DOWN; break;
             default: ascii = KEY_NONE; break;
         }
         extended = false;
@@ -70,20 +72,14 @@ void keyboard_handler(void) {
         }
     }
 
-    if (ascii != KEY_NONE) {
-        if (!released) on_key_press(ascii);
-        else on_key_release(ascii);
-    }
-
-    outb(PIC1_COMMAND, PIC_EOI);
+    // the hooks, and with them the shell, run from the main loop
+    if (ascii != KEY_NONE)
+        input_post_key(ascii, released);
 }
-    
-CREATE_ISR(1, keyboard_handler)
 
 static int kb_init(void) {
     kprint("[info] keyboard driver initialized\n");
-    idt_set_descriptor(IRQ1, irq1_handler, IDT_FLAG_PRESENT | IDT_FLAG_INTERRUPT);
-    pic_unmask_irq(1);
+    kirq_register(1, "keyboard", _keyboard_interrupt, NULL);
     return 0;
 }
 
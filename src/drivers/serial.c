@@ -0,0 +1,268 @@
+#include <agave/drivers/serial.h>
+#include <agave/input.h>
+#include <agave/io.h>
+#include <agave/kcpu.h>
+#include <agave/keys.h>
+#include <agave/kirq.h>
+#include <agave/klock.h>
+#include <agave/kvid.h>
+#include <agave/utils.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#define SERIAL_PORT(reg) (SERIAL_COM1 + (reg))
+#define SERIAL_CSI_PARAMS 2
+#define SERIAL_PROBE_SPINS 100000
+
+typedef enum {
+    SERIAL_RX_TEXT,
+    SERIAL_RX_ESC,  // ESC seen
+    SERIAL_RX_CSI,  // ESC [ seen, collecting parameters
+    SERIAL_RX_SS3,  // ESC O seen, arrows in application cursor mode
+} serial_rx_state_t;
+
+/*
+ * The ring is written by whichever CPU prints, under the console lock, and
+ * drained into the FIFO by the boot CPU's interrupt handler, so both sides
+ * take serial_lock. Until the driver is initialized bytes are only queued.
+ * Writers run with interrupts off, the handler cannot drain the ring while
+ * they wait, so what does not fit is dropped rather than waited for. After
+ * a panic the handler will not run again and writers poll instead, the
+ * panic text is the output that matters most.
+ */
+static uint8_t tx_ring[SERIAL_TX_RING_SIZE];
+static uint32_t tx_head = 0;
+static uint32_t tx_tail = 0;
+static uint32_t fifo_size = 1;
+static volatile uint32_t tx_dropped = 0;
+static volatile bool probed = false;
+static volatile bool present = false;
+static volatile bool panicking = false;
+static kspinlock_t serial_lock = KSPINLOCK_INIT("serial");
+
+// only the interrupt handler touches the decoder
+static serial_rx_state_t rx_state = SERIAL_RX_TEXT;
+static uint32_t rx_params[SERIAL_CSI_PARAMS];
+static uint32_t rx_param_count = 0;
+static bool rx_after_cr = false;
+
+// serial_lock held, moves up to one FIFO load once the transmitter is empty
+static void _serial_tx_fill(void) {
+    if (!(inb(SERIAL_PORT(SERIAL_LSR)) & SERIAL_LSR_TX_EMPTY))
+        return;
+    for (uint32_t i = 0; i < fifo_size && tx_tail != tx_head; i++)
+        outb(SERIAL_PORT(SERIAL_DATA), tx_ring[tx_tail++ & (SERIAL_TX_RING_SIZE - 1)]);
+}
+
+// serial_lock held, for serial_flush and panics, empties at least one FIFO load without the interrupt
+static void _serial_tx_poll(void) {
+    while (!(inb(SERIAL_PORT(SERIAL_LSR)) & SERIAL_LSR_TX_EMPTY))
+        kcpu_pause();
+    _serial_tx_fill();
+}
+
+void serial_write(const char *buf, size_t len) {
+    if (probed && !present)
+        return;
+
+    uint32_t flags = kspin_lock_irqsave(&serial_lock);
+    size_t count = 0;
+    while (count < len) {
+        if (tx_head - tx_tail == SERIAL_TX_RING_SIZE) {
+            if (!panicking || !present)
+                break;
+            _serial_tx_poll();
+            continue;
+        }
+        tx_ring[tx_head++ & (SERIAL_TX_RING_SIZE - 1)] = (uint8_t)buf[count++];
+    }
+    tx_dropped += len - count;
+
+    // the transmitter may be idle, in which case no interrupt would come to start it
+    if (present)
+        _serial_tx_fill();
+    kspin_unlock_irqrestore(&serial_lock, flags);
+}
+
+void serial_flush(void) {
+    if (!present)
+        return;
+
+    uint32_t flags = kspin_lock_irqsave(&serial_lock);
+    while (tx_tail != tx_head)
+        _serial_tx_poll();
+    kspin_unlock_irqrestore(&serial_lock, flags);
+}
+
+uint32_t serial_dropped_count(void) {
+    return tx_dropped;
+}
+
+void serial_break_lock(void) {
+    panicking = true;
+    __atomic_store_n(&serial_lock.owner, serial_lock.next, __ATOMIC_RELEASE);
+}
+
+// a terminal has no key releases, every key is posted as a press and a release
+static void _serial_post(uint8_t key) {
+    input_post_key(key, false);
+    input_post_key(key, true);
+}
+
+static void _serial_csi_final(uint8_t c) {
+    uint32_t key = rx_param_count > 0 ? rx_params[0] : 0;
+    bool shift = rx_param_count > 1 && rx_params[1] == 2;
+
+    switch (c) {
+        case 'A': _serial_post(KEY_UP); break;
+        case 'B': _serial_post(KEY_DOWN); break;
+        case 'C': _serial_post(KEY_RIGHT); break;
+        case 'D': _serial_post(KEY_LEFT); break;
+        case '~':
+            // ESC [ 5 ~ and ESC [ 6 ~, xterm adds ;2 when shift is held
+            if (key == 5)
+                _serial_post(shift ? KEY_SCROLL_UP : KEY_PAGE_UP);
+            else if (key == 6)
+                _serial_post(shift ? KEY_SCROLL_DOWN : KEY_PAGE_DOWN);
+            break;
+        default: break;
+    }
+}
+
+static void _serial_receive(uint8_t c) {
+    switch (rx_state) {
+        case SERIAL_RX_ESC:
+            if (c == '[' || c == 'O') {
+                rx_state = c == '[' ? SERIAL_RX_CSI : SERIAL_RX_SS3;
+                rx_param_count = 0;
+                return;
+            }
+            // not a sequence, the escape was a key of its own
+            rx_state = SERIAL_RX_TEXT;
+            _serial_post(KEY_ESC);
+            break;
+
+        case SERIAL_RX_CSI:
+            if (c >= '0' && c <= '9') {
+                if (rx_param_count == 0)
+                    rx_params[rx_param_count++] = 0;
+                if (rx_param_count <= SERIAL_CSI_PARAMS)
+                    rx_params[rx_param_count - 1] = rx_params[rx_param_count - 1] * 10 + (c - '0');
+                return;
+            }
+            if (c == ';') {
+                if (rx_param_count == 0)
+                    rx_params[rx_param_count++] = 0;
+                if (rx_param_count < SERIAL_CSI_PARAMS)
+                    rx_params[rx_param_count] = 0;
+                rx_param_count++;
+                return;
+            }
+            // anything from 0x40 on ends the sequence, unknown ones are dropped
+            if (c >= 0x40 && c <= 0x7E) {
+                rx_state = SERIAL_RX_TEXT;
+                _serial_csi_final(c);
+            }
+            return;
+
+        case SERIAL_RX_SS3:
+            rx_state = SERIAL_RX_TEXT;
+            rx_param_count = 0;
+            _serial_csi_final(c);
+            return;
+
+        case SERIAL_RX_TEXT:
+            break;
+    }
+
+    // terminals send CR for enter, scripts often send LF or CR LF
+    bool after_cr = rx_after_cr;
+    rx_after_cr = c == '\r';
+
+    if (c == KEY_ESC)
+        rx_state = SERIAL_RX_ESC;
+    else if (c == '\r' || (c == '\n' && !after_cr))
+        _serial_post(KEY_ENTER);
+    else if (c == 0x7F || c == '\b')
+        _serial_post(KEY_BACKSPACE);
+    else if (c == '\t' || (c >= ' ' && c <= KEY_TILDE))
+        _serial_post(c);
+}
+
+static void _serial_interrupt(UNUSED kirq_frame_t *frame, UNUSED void *data) {
+    // the UART keeps its line raised while any cause is pending, all of them are handled before returning
+    for (;;) {
+        uint8_t iir = inb(SERIAL_PORT(SERIAL_IIR));
+        if (iir & SERIAL_IIR_NONE)
+            break;
+
+        switch (iir & SERIAL_IIR_ID_MASK) {
+            case SERIAL_IIR_RX_DATA:
+            case SERIAL_IIR_RX_TIMEOUT:
+                while (inb(SERIAL_PORT(SERIAL_LSR)) & SERIAL_LSR_DATA_READY)
+                    _serial_receive(inb(SERIAL_PORT(SERIAL_DATA)));
+                break;
+            case SERIAL_IIR_TX_EMPTY:
+                kspin_lock(&serial_lock);
+                _serial_tx_fill();
+                kspin_unlock(&serial_lock);
+                break;
+            case SERIAL_IIR_LINE:
+                inb(SERIAL_PORT(SERIAL_LSR));
+                break;
+            default:
+                inb(SERIAL_PORT(SERIAL_MSR));
+                break;
+        }
+    }
+}
+
+// a byte sent in loopback mode has to come back, otherwise there is no UART at the port
+static bool _serial_probe(void) {
+    outb(SERIAL_PORT(SERIAL_MCR), SERIAL_MCR_LOOPBACK | SERIAL_MCR_OUT2 | SERIAL_MCR_RTS);
+    outb(SERIAL_PORT(SERIAL_DATA), 0xAE);
+    for (uint32_t i = 0; i < SERIAL_PROBE_SPINS; i++) {
+        if (inb(SERIAL_PORT(SERIAL_LSR)) & SERIAL_LSR_DATA_READY)
+            return inb(SERIAL_PORT(SERIAL_DATA)) == 0xAE;
+        kcpu_pause();
+    }
+    return false;
+}
+
+static int serial_init(void) {
+    uint16_t divisor = SERIAL_CLOCK / SERIAL_BAUD;
+
+    outb(SERIAL_PORT(SERIAL_IER), 0);
+    outb(SERIAL_PORT(SERIAL_LCR), SERIAL_LCR_DLAB);
+    outb(SERIAL_PORT(SERIAL_DATA), (uint8_t)divisor);
+    outb(SERIAL_PORT(SERIAL_IER), (uint8_t)(divisor >> 8));
+    outb(SERIAL_PORT(SERIAL_LCR), SERIAL_LCR_8N1);
+    outb(SERIAL_PORT(SERIAL_IIR), SERIAL_FCR_ENABLE | SERIAL_FCR_CLEAR_RX |
+                                  SERIAL_FCR_CLEAR_TX | SERIAL_FCR_TRIGGER_14);
+
+    if (!_serial_probe()) {
+        probed = true;
+        kprint("[warn] no serial port at COM1\n");
+        return -1;
+    }
+
+    // an 8250 or 16450 has no FIFO and takes one byte per transmit interrupt
+    if ((inb(SERIAL_PORT(SERIAL_IIR)) & SERIAL_IIR_FIFO) == SERIAL_IIR_FIFO)
+        fifo_size = SERIAL_FIFO_SIZE;
+    outb(SERIAL_PORT(SERIAL_MCR), SERIAL_MCR_DTR | SERIAL_MCR_RTS | SERIAL_MCR_OUT2);
+
+    kirq_register(SERIAL_IRQ, "serial", _serial_interrupt, NULL);
+    outb(SERIAL_PORT(SERIAL_IER), SERIAL_IER_RX | SERIAL_IER_TX | SERIAL_IER_LINE);
+
+    // start on what was printed before the driver came up
+    uint32_t flags = kspin_lock_irqsave(&serial_lock);
+    present = true;
+    probed = true;
+    _serial_tx_fill();
+    kspin_unlock_irqrestore(&serial_lock, flags);
+
+    kprintf("[info] serial console on COM1 at %u baud, %u byte fifo\n", SERIAL_BAUD, fifo_size);
+    return 0;
+}
+
+KDRIVER_REGISTER(serial, serial_init)
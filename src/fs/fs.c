@@ -42,7 +42,7 @@ void fs_initialize(const char *name, fs_backend_t *backend, uint8_t flags) {
     kpanic("too many filesystems mounted");
   }
 
-  fs_t *fs = (fs_t *)kmalloc(sizeof(fs_t));
+  fs_t *fs = (fs_t *)kmalloc_tagged(sizeof(fs_t), KMEM_TAG_FS);
   if (!fs) {
     kpanic("failed to allocate memory for filesystem '%s'", name);
   }
@@ -166,7 +166,7 @@ fs_status_t fs_add_file(fs_t *fs, const char *path, const void *data,
   return fs->backend->add_file(fs->backend_data, path, data, size, metadata);
 }
 
-fs_status_t fs_read_file(fs_t *fs, const char *path, const void **out_data,
+fs_status_t fs_read_file(fs_t *fs, const char *path, void *buf, size_t capacity,
                          size_t *out_size) {
   fs_status_t status = ensure_valid_fs(fs);
   if (status != FS_STATUS_OK)
@@ -176,11 +176,11 @@ fs_status_t fs_read_file(fs_t *fs, const char *path, const void **out_data,
   if (status != FS_STATUS_OK)
     return status;
 
-  if (!out_data) {
+  if (capacity && !buf) {
     return FS_STATUS_ERROR_INVALID_ARGUMENT;
   }
 
-  return fs->backend->read_file(fs->backend_data, path, out_data, out_size);
+  return fs->backend->read_file(fs->backend_data, path, buf, capacity, out_size);
 }
 
 fs_status_t fs_remove_file(fs_t *fs, const char *path) {
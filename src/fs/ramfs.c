@@ -1,11 +1,20 @@
 #include <agave/fs/ramfs.h>
 #include <agave/fs.h>
 #include <agave/kmem.h>
+#include <agave/karena.h>
+#include <agave/kslab.h>
+#include <agave/kvmm.h>
+#include <agave/kjob.h>
+#include <agave/klock.h>
 #include <stdbool.h>
 #include <string.h>
 
 #define RAMFS_DEFAULT_FILE_PERMS (FS_PERM_READ | FS_PERM_WRITE)
 #define RAMFS_DEFAULT_DIR_PERMS  (FS_PERM_READ | FS_PERM_WRITE | FS_PERM_EXECUTE)
+#define RAMFS_LIST_INITIAL       16
+#define RAMFS_SIZE_JOBS          8 // subdirectories sized in parallel per level
+
+static kmem_cache_t *ramfs_node_cache = NULL;
 
 static uint32_t _ramfs_hash_string(const char *path) {
     uint32_t hash = 2166136261u;
@@ -108,14 +117,15 @@ static const char *_ramfs_basename(const char *path) {
     return last ? last + 1 : path;
 }
 
-static char *_ramfs_normalize_path(const char *path) {
+// the result lives in the scratch arena, callers pop their mark once they are done with it
+static char *_ramfs_normalize_path(karena_t *scratch, const char *path) {
     if (!path) {
         return NULL;
     }
 
     size_t len = strlen(path);
     size_t buf_len = len + 2; // room for leading slash and null terminator
-    char *normalized = (char *)kmalloc(buf_len);
+    char *normalized = (char *)karena_alloc(scratch, buf_len);
     if (!normalized) {
         return NULL;
     }
@@ -184,16 +194,16 @@ static fs_status_t _ramfs_parent_for(ramfs_t *fs, const char *normalized_path,
         return FS_STATUS_OK;
     }
 
-    size_t parent_len = (size_t)(last_sep - normalized_path);
-    char *parent_path = (char *)kmalloc(parent_len + 1);
+    karena_t *scratch = kscratch();
+    karena_mark_t mark = karena_mark(scratch);
+    char *parent_path = karena_strndup(scratch, normalized_path,
+                                       (size_t)(last_sep - normalized_path));
     if (!parent_path) {
         return FS_STATUS_ERROR_NO_SPACE;
     }
-    kmemcpy(parent_path, normalized_path, parent_len);
-    parent_path[parent_len] = '\0';
 
     ramfs_file_t *parent = _ramfs_lookup(fs, parent_path);
-    kfree(parent_path);
+    karena_pop(scratch, mark);
 
     if (!parent) {
         return FS_STATUS_ERROR_NO_ENTRY;
@@ -207,25 +217,32 @@ static fs_status_t _ramfs_parent_for(ramfs_t *fs, const char *normalized_path,
     return FS_STATUS_OK;
 }
 
-static ramfs_file_t *_ramfs_create_node(char *path, const void *data, size_t size,
+static ramfs_file_t *_ramfs_create_node(const char *path, const void *data, size_t size,
                                         uint8_t metadata) {
-    ramfs_file_t *node = (ramfs_file_t *)kmalloc(sizeof(ramfs_file_t));
+    ramfs_file_t *node = (ramfs_file_t *)kmem_cache_alloc(ramfs_node_cache);
     if (!node) {
-        kfree(path);
         return NULL;
     }
 
-    node->name = path;
+    size_t path_len = strlen(path);
+    char *name = (char *)kmalloc_tagged(path_len + 1, KMEM_TAG_RAMFS);
+    if (!name) {
+        kmem_cache_free(ramfs_node_cache, node);
+        return NULL;
+    }
+    kmemcpy(name, path, path_len + 1);
+
+    node->name = name;
     if (size > 0) {
         if (!data) {
-            kfree(node);
-            kfree(path);
+            kmem_cache_free(ramfs_node_cache, node);
+            kfree(name);
             return NULL;
         }
-        node->data = kmalloc(size);
+        node->data = kvmalloc_tagged(size, KMEM_TAG_RAMFS);
         if (!node->data) {
-            kfree(node);
-            kfree(path);
+            kmem_cache_free(ramfs_node_cache, node);
+            kfree(name);
             return NULL;
         }
         kmemcpy(node->data, data, size);
@@ -249,23 +266,52 @@ static void _ramfs_free_node(ramfs_file_t *node) {
         return;
     }
     if (node->data) {
-        kfree(node->data);
+        kvfree(node->data);
     }
     if (node->name) {
         kfree(node->name);
     }
-    kfree(node);
+    kmem_cache_free(ramfs_node_cache, node);
+}
+
+typedef struct {
+    ramfs_file_t *dir;
+    size_t total;
+} ramfs_size_job_t;
+
+static size_t _ramfs_directory_size_recursive(ramfs_file_t *dir);
+
+static void _ramfs_directory_size_job(void *data) {
+    ramfs_size_job_t *job = (ramfs_size_job_t *)data;
+    job->total = _ramfs_directory_size_recursive(job->dir);
 }
 
+// the first subdirectories of each level are handed to other CPUs, the rest is summed here meanwhile
 static size_t _ramfs_directory_size_recursive(ramfs_file_t *dir) {
+    kjob_group_t group = KJOB_GROUP_INIT;
+    kjob_t jobs[RAMFS_SIZE_JOBS];
+    ramfs_size_job_t sizes[RAMFS_SIZE_JOBS];
+    size_t spawned = 0;
+
     size_t total = 0;
     for (ramfs_file_t *child = dir->child; child; child = child->sibling) {
         if (ramfs_is_regular_file(child)) {
             total += child->size;
         } else if (ramfs_is_directory(child)) {
-            total += _ramfs_directory_size_recursive(child);
+            if (spawned < RAMFS_SIZE_JOBS && child->child) {
+                sizes[spawned].dir = child;
+                kjob_spawn(&group, &jobs[spawned], _ramfs_directory_size_job, &sizes[spawned]);
+                spawned++;
+            } else {
+                total += _ramfs_directory_size_recursive(child);
+            }
         }
     }
+
+    kjob_wait(&group);
+    for (size_t i = 0; i < spawned; i++) {
+        total += sizes[i].total;
+    }
     return total;
 }
 
@@ -273,22 +319,22 @@ void ramfs_mount(ramfs_t *fs)   { (void)fs; }
 void ramfs_unmount(ramfs_t *fs) { (void)fs; }
 
 ramfs_t *ramfs_create(void) {
-    ramfs_t *fs = (ramfs_t *)kmalloc(sizeof(ramfs_t));
+    if (!ramfs_node_cache) {
+        ramfs_node_cache = kmem_cache_create("ramfs_file", sizeof(ramfs_file_t), KMEM_TAG_RAMFS);
+        if (!ramfs_node_cache) {
+            return NULL;
+        }
+    }
+
+    ramfs_t *fs = (ramfs_t *)kmalloc_tagged(sizeof(ramfs_t), KMEM_TAG_RAMFS);
     if (!fs) {
         return NULL;
     }
 
     kmemset(fs, 0, sizeof(ramfs_t));
+    krw_init(&fs->lock, "ramfs");
 
-    char *root_path = (char *)kmalloc(2);
-    if (!root_path) {
-        kfree(fs);
-        return NULL;
-    }
-    root_path[0] = '/';
-    root_path[1] = '\0';
-
-    ramfs_file_t *root = _ramfs_create_node(root_path, NULL, 0,
+    ramfs_file_t *root = _ramfs_create_node("/", NULL, 0,
                                             RAMFS_FILE_TYPE_DIRECTORY | RAMFS_DEFAULT_DIR_PERMS);
     if (!root) {
         kfree(fs);
@@ -317,39 +363,39 @@ void ramfs_destroy(ramfs_t *fs) {
     kfree(fs);
 }
 
-fs_status_t ramfs_add_file(void *fs_ptr, const char *path, const void *data, size_t size,
-                           uint8_t metadata) {
-    ramfs_t *fs = (ramfs_t *)fs_ptr;
-
-    char *normalized = _ramfs_normalize_path(path);
+static fs_status_t _ramfs_add_file(ramfs_t *fs, const char *path, const void *data, size_t size,
+                                   uint8_t metadata) {
+    karena_t *scratch = kscratch();
+    karena_mark_t mark = karena_mark(scratch);
+    char *normalized = _ramfs_normalize_path(scratch, path);
     if (!normalized) {
         return FS_STATUS_ERROR_INVALID_ARGUMENT;
     }
 
     if (strcmp(normalized, "/") == 0) {
-        kfree(normalized);
+        karena_pop(scratch, mark);
         return FS_STATUS_ERROR_INVALID_ARGUMENT;
     }
 
     if (_ramfs_lookup(fs, normalized)) {
-        kfree(normalized);
+        karena_pop(scratch, mark);
         return FS_STATUS_ERROR_ALREADY_EXISTS;
     }
 
     if (size > 0 && !data) {
-        kfree(normalized);
+        karena_pop(scratch, mark);
         return FS_STATUS_ERROR_INVALID_ARGUMENT;
     }
 
     ramfs_file_t *parent = NULL;
     fs_status_t parent_status = _ramfs_parent_for(fs, normalized, &parent);
     if (parent_status != FS_STATUS_OK) {
-        kfree(normalized);
+        karena_pop(scratch, mark);
         return parent_status;
     }
 
     if (!ramfs_has_permission(parent, FS_PERM_WRITE)) {
-        kfree(normalized);
+        karena_pop(scratch, mark);
         return FS_STATUS_ERROR_PERMISSION_DENIED;
     }
 
@@ -361,6 +407,7 @@ fs_status_t ramfs_add_file(void *fs_ptr, const char *path, const void *data, siz
     uint8_t node_metadata = RAMFS_FILE_TYPE_REGULAR | (permissions & RAMFS_FILE_PERM_MASK);
 
     ramfs_file_t *node = _ramfs_create_node(normalized, data, size, node_metadata);
+    karena_pop(scratch, mark);
     if (!node) {
         return FS_STATUS_ERROR_NO_SPACE;
     }
@@ -373,16 +420,25 @@ fs_status_t ramfs_add_file(void *fs_ptr, const char *path, const void *data, siz
     return FS_STATUS_OK;
 }
 
-fs_status_t ramfs_write_file(void *fs_ptr, const char *path, const void *data, size_t size) {
+fs_status_t ramfs_add_file(void *fs_ptr, const char *path, const void *data, size_t size,
+                           uint8_t metadata) {
     ramfs_t *fs = (ramfs_t *)fs_ptr;
+    krw_write_lock(&fs->lock);
+    fs_status_t status = _ramfs_add_file(fs, path, data, size, metadata);
+    krw_write_unlock(&fs->lock);
+    return status;
+}
 
-    char *normalized = _ramfs_normalize_path(path);
+static fs_status_t _ramfs_write_file(ramfs_t *fs, const char *path, const void *data, size_t size) {
+    karena_t *scratch = kscratch();
+    karena_mark_t mark = karena_mark(scratch);
+    char *normalized = _ramfs_normalize_path(scratch, path);
     if (!normalized) {
         return FS_STATUS_ERROR_INVALID_ARGUMENT;
     }
 
     ramfs_file_t *file = _ramfs_lookup(fs, normalized);
-    kfree(normalized);
+    karena_pop(scratch, mark);
 
     if (!file) {
         return FS_STATUS_ERROR_NO_ENTRY;
@@ -399,7 +455,7 @@ fs_status_t ramfs_write_file(void *fs_ptr, const char *path, const void *data, s
 
     void *copy = NULL;
     if (size > 0) {
-        copy = kmalloc(size);
+        copy = kvmalloc_tagged(size, KMEM_TAG_RAMFS);
         if (!copy) {
             return FS_STATUS_ERROR_NO_SPACE;
         }
@@ -413,7 +469,7 @@ fs_status_t ramfs_write_file(void *fs_ptr, const char *path, const void *data, s
     file->size = size;
 
     if (old_data) {
-        kfree(old_data);
+        kvfree(old_data);
     }
 
     if (fs->total_size >= old_size) {
@@ -426,17 +482,25 @@ fs_status_t ramfs_write_file(void *fs_ptr, const char *path, const void *data, s
     return FS_STATUS_OK;
 }
 
-fs_status_t ramfs_read_file(void *fs_ptr, const char *path, const void **out_data,
-                            size_t *size) {
+fs_status_t ramfs_write_file(void *fs_ptr, const char *path, const void *data, size_t size) {
     ramfs_t *fs = (ramfs_t *)fs_ptr;
+    krw_write_lock(&fs->lock);
+    fs_status_t status = _ramfs_write_file(fs, path, data, size);
+    krw_write_unlock(&fs->lock);
+    return status;
+}
 
-    char *normalized = _ramfs_normalize_path(path);
+static fs_status_t _ramfs_read_file(ramfs_t *fs, const char *path, void *buf, size_t capacity,
+                                    size_t *size) {
+    karena_t *scratch = kscratch();
+    karena_mark_t mark = karena_mark(scratch);
+    char *normalized = _ramfs_normalize_path(scratch, path);
     if (!normalized) {
         return FS_STATUS_ERROR_INVALID_ARGUMENT;
     }
 
     ramfs_file_t *file = _ramfs_lookup(fs, normalized);
-    kfree(normalized);
+    karena_pop(scratch, mark);
 
     if (!file) {
         return FS_STATUS_ERROR_NO_ENTRY;
@@ -448,7 +512,7 @@ fs_status_t ramfs_read_file(void *fs_ptr, const char *path, const void **out_dat
         return FS_STATUS_ERROR_PERMISSION_DENIED;
     }
 
-    *out_data = file->data;
+    kmemcpy(buf, file->data, file->size < capacity ? file->size : capacity);
     if (size) {
         *size = file->size;
     }
@@ -456,16 +520,26 @@ fs_status_t ramfs_read_file(void *fs_ptr, const char *path, const void **out_dat
     return FS_STATUS_OK;
 }
 
-fs_status_t ramfs_remove_file(void *fs_ptr, const char *path) {
+// the copy is made under the lock, a writer may free or reallocate the data as soon as it is dropped
+fs_status_t ramfs_read_file(void *fs_ptr, const char *path, void *buf, size_t capacity,
+                            size_t *size) {
     ramfs_t *fs = (ramfs_t *)fs_ptr;
+    krw_read_lock(&fs->lock);
+    fs_status_t status = _ramfs_read_file(fs, path, buf, capacity, size);
+    krw_read_unlock(&fs->lock);
+    return status;
+}
 
-    char *normalized = _ramfs_normalize_path(path);
+static fs_status_t _ramfs_remove_file(ramfs_t *fs, const char *path) {
+    karena_t *scratch = kscratch();
+    karena_mark_t mark = karena_mark(scratch);
+    char *normalized = _ramfs_normalize_path(scratch, path);
     if (!normalized) {
         return FS_STATUS_ERROR_INVALID_ARGUMENT;
     }
 
     ramfs_file_t *file = _ramfs_lookup(fs, normalized);
-    kfree(normalized);
+    karena_pop(scratch, mark);
 
     if (!file) {
         return FS_STATUS_ERROR_NO_ENTRY;
@@ -494,16 +568,24 @@ fs_status_t ramfs_remove_file(void *fs_ptr, const char *path) {
     return FS_STATUS_OK;
 }
 
-fs_status_t ramfs_file_exists(void *fs_ptr, const char *path, bool *out_exists) {
+fs_status_t ramfs_remove_file(void *fs_ptr, const char *path) {
     ramfs_t *fs = (ramfs_t *)fs_ptr;
+    krw_write_lock(&fs->lock);
+    fs_status_t status = _ramfs_remove_file(fs, path);
+    krw_write_unlock(&fs->lock);
+    return status;
+}
 
-    char *normalized = _ramfs_normalize_path(path);
+static fs_status_t _ramfs_file_exists(ramfs_t *fs, const char *path, bool *out_exists) {
+    karena_t *scratch = kscratch();
+    karena_mark_t mark = karena_mark(scratch);
+    char *normalized = _ramfs_normalize_path(scratch, path);
     if (!normalized) {
         return FS_STATUS_ERROR_INVALID_ARGUMENT;
     }
 
     ramfs_file_t *file = _ramfs_lookup(fs, normalized);
-    kfree(normalized);
+    karena_pop(scratch, mark);
 
     if (file && ramfs_is_regular_file(file)) {
         *out_exists = true;
@@ -514,16 +596,24 @@ fs_status_t ramfs_file_exists(void *fs_ptr, const char *path, bool *out_exists)
     return FS_STATUS_ERROR_NO_ENTRY;
 }
 
-fs_status_t ramfs_file_size(void *fs_ptr, const char *path, size_t *out_size) {
+fs_status_t ramfs_file_exists(void *fs_ptr, const char *path, bool *out_exists) {
     ramfs_t *fs = (ramfs_t *)fs_ptr;
+    krw_read_lock(&fs->lock);
+    fs_status_t status = _ramfs_file_exists(fs, path, out_exists);
+    krw_read_unlock(&fs->lock);
+    return status;
+}
 
-    char *normalized = _ramfs_normalize_path(path);
+static fs_status_t _ramfs_file_size(ramfs_t *fs, const char *path, size_t *out_size) {
+    karena_t *scratch = kscratch();
+    karena_mark_t mark = karena_mark(scratch);
+    char *normalized = _ramfs_normalize_path(scratch, path);
     if (!normalized) {
         return FS_STATUS_ERROR_INVALID_ARGUMENT;
     }
 
     ramfs_file_t *file = _ramfs_lookup(fs, normalized);
-    kfree(normalized);
+    karena_pop(scratch, mark);
 
     if (!file) {
         return FS_STATUS_ERROR_NO_ENTRY;
@@ -539,34 +629,43 @@ fs_status_t ramfs_file_size(void *fs_ptr, const char *path, size_t *out_size) {
     return FS_STATUS_OK;
 }
 
-fs_status_t ramfs_make_directory(void *fs_ptr, const char *path) {
+fs_status_t ramfs_file_size(void *fs_ptr, const char *path, size_t *out_size) {
     ramfs_t *fs = (ramfs_t *)fs_ptr;
+    krw_read_lock(&fs->lock);
+    fs_status_t status = _ramfs_file_size(fs, path, out_size);
+    krw_read_unlock(&fs->lock);
+    return status;
+}
 
-    char *normalized = _ramfs_normalize_path(path);
+static fs_status_t _ramfs_make_directory(ramfs_t *fs, const char *path) {
+    karena_t *scratch = kscratch();
+    karena_mark_t mark = karena_mark(scratch);
+    char *normalized = _ramfs_normalize_path(scratch, path);
     if (!normalized) {
         return FS_STATUS_ERROR_INVALID_ARGUMENT;
     }
 
     if (_ramfs_lookup(fs, normalized)) {
-        kfree(normalized);
+        karena_pop(scratch, mark);
         return FS_STATUS_ERROR_ALREADY_EXISTS;
     }
 
     ramfs_file_t *parent = NULL;
     fs_status_t parent_status = _ramfs_parent_for(fs, normalized, &parent);
     if (parent_status != FS_STATUS_OK) {
-        kfree(normalized);
+        karena_pop(scratch, mark);
         return parent_status;
     }
 
     if (!ramfs_has_permission(parent, FS_PERM_WRITE)) {
-        kfree(normalized);
+        karena_pop(scratch, mark);
         return FS_STATUS_ERROR_PERMISSION_DENIED;
     }
 
     uint8_t node_metadata = RAMFS_FILE_TYPE_DIRECTORY | RAMFS_DEFAULT_DIR_PERMS;
 
     ramfs_file_t *node = _ramfs_create_node(normalized, NULL, 0, node_metadata);
+    karena_pop(scratch, mark);
     if (!node) {
         return FS_STATUS_ERROR_NO_SPACE;
     }
@@ -578,21 +677,29 @@ fs_status_t ramfs_make_directory(void *fs_ptr, const char *path) {
     return FS_STATUS_OK;
 }
 
-fs_status_t ramfs_remove_directory(void *fs_ptr, const char *path) {
+fs_status_t ramfs_make_directory(void *fs_ptr, const char *path) {
     ramfs_t *fs = (ramfs_t *)fs_ptr;
+    krw_write_lock(&fs->lock);
+    fs_status_t status = _ramfs_make_directory(fs, path);
+    krw_write_unlock(&fs->lock);
+    return status;
+}
 
-    char *normalized = _ramfs_normalize_path(path);
+static fs_status_t _ramfs_remove_directory(ramfs_t *fs, const char *path) {
+    karena_t *scratch = kscratch();
+    karena_mark_t mark = karena_mark(scratch);
+    char *normalized = _ramfs_normalize_path(scratch, path);
     if (!normalized) {
         return FS_STATUS_ERROR_INVALID_ARGUMENT;
     }
 
     if (strcmp(normalized, "/") == 0) {
-        kfree(normalized);
+        karena_pop(scratch, mark);
         return FS_STATUS_ERROR_PERMISSION_DENIED;
     }
 
     ramfs_file_t *dir = _ramfs_lookup(fs, normalized);
-    kfree(normalized);
+    karena_pop(scratch, mark);
 
     if (!dir) {
         return FS_STATUS_ERROR_NO_ENTRY;
@@ -618,16 +725,24 @@ fs_status_t ramfs_remove_directory(void *fs_ptr, const char *path) {
     return FS_STATUS_OK;
 }
 
-fs_status_t ramfs_directory_exists(void *fs_ptr, const char *path, bool *out_exists) {
+fs_status_t ramfs_remove_directory(void *fs_ptr, const char *path) {
     ramfs_t *fs = (ramfs_t *)fs_ptr;
+    krw_write_lock(&fs->lock);
+    fs_status_t status = _ramfs_remove_directory(fs, path);
+    krw_write_unlock(&fs->lock);
+    return status;
+}
 
-    char *normalized = _ramfs_normalize_path(path);
+static fs_status_t _ramfs_directory_exists(ramfs_t *fs, const char *path, bool *out_exists) {
+    karena_t *scratch = kscratch();
+    karena_mark_t mark = karena_mark(scratch);
+    char *normalized = _ramfs_normalize_path(scratch, path);
     if (!normalized) {
         return FS_STATUS_ERROR_INVALID_ARGUMENT;
     }
 
     ramfs_file_t *dir = _ramfs_lookup(fs, normalized);
-    kfree(normalized);
+    karena_pop(scratch, mark);
 
     if (dir && ramfs_is_directory(dir)) {
         *out_exists = true;
@@ -638,16 +753,24 @@ fs_status_t ramfs_directory_exists(void *fs_ptr, const char *path, bool *out_exi
     return FS_STATUS_ERROR_NO_ENTRY;
 }
 
-fs_status_t ramfs_directory_size(void *fs_ptr, const char *path, size_t *out_size) {
+fs_status_t ramfs_directory_exists(void *fs_ptr, const char *path, bool *out_exists) {
     ramfs_t *fs = (ramfs_t *)fs_ptr;
+    krw_read_lock(&fs->lock);
+    fs_status_t status = _ramfs_directory_exists(fs, path, out_exists);
+    krw_read_unlock(&fs->lock);
+    return status;
+}
 
-    char *normalized = _ramfs_normalize_path(path);
+static fs_status_t _ramfs_directory_size(ramfs_t *fs, const char *path, size_t *out_size) {
+    karena_t *scratch = kscratch();
+    karena_mark_t mark = karena_mark(scratch);
+    char *normalized = _ramfs_normalize_path(scratch, path);
     if (!normalized) {
         return FS_STATUS_ERROR_INVALID_ARGUMENT;
     }
 
     ramfs_file_t *dir = _ramfs_lookup(fs, normalized);
-    kfree(normalized);
+    karena_pop(scratch, mark);
 
     if (!dir) {
         return FS_STATUS_ERROR_NO_ENTRY;
@@ -663,32 +786,42 @@ fs_status_t ramfs_directory_size(void *fs_ptr, const char *path, size_t *out_siz
     return FS_STATUS_OK;
 }
 
-fs_status_t ramfs_list_directory(void *fs_ptr, const char *path, char ***out_list,
-                                 size_t max_entries, size_t *out_count) {
+fs_status_t ramfs_directory_size(void *fs_ptr, const char *path, size_t *out_size) {
     ramfs_t *fs = (ramfs_t *)fs_ptr;
+    krw_read_lock(&fs->lock);
+    fs_status_t status = _ramfs_directory_size(fs, path, out_size);
+    krw_read_unlock(&fs->lock);
+    return status;
+}
 
-    char *normalized = _ramfs_normalize_path(path ? path : "");
+static fs_status_t _ramfs_list_directory(ramfs_t *fs, const char *path, char ***out_list,
+                                         size_t max_entries, size_t *out_count) {
+    karena_t *scratch = kscratch();
+    karena_mark_t mark = karena_mark(scratch);
+    char *normalized = _ramfs_normalize_path(scratch, path ? path : "");
     if (!normalized) {
         return FS_STATUS_ERROR_INVALID_ARGUMENT;
     }
 
     ramfs_file_t *dir = _ramfs_lookup(fs, normalized);
     if (!dir) {
-        kfree(normalized);
+        karena_pop(scratch, mark);
         return FS_STATUS_ERROR_NO_ENTRY;
     }
     if (!ramfs_is_directory(dir)) {
-        kfree(normalized);
+        karena_pop(scratch, mark);
         return FS_STATUS_ERROR_NOT_DIRECTORY;
     }
     if (!ramfs_has_permission(dir, FS_PERM_READ)) {
-        kfree(normalized);
+        karena_pop(scratch, mark);
         return FS_STATUS_ERROR_PERMISSION_DENIED;
     }
 
-    char **list = (char **)kmalloc(sizeof(char *) * max_entries);
+    // grown on demand, krealloc usually extends it in place
+    size_t capacity = max_entries < RAMFS_LIST_INITIAL ? max_entries : RAMFS_LIST_INITIAL;
+    char **list = (char **)kmalloc_tagged(sizeof(char *) * (capacity ? capacity : 1), KMEM_TAG_RAMFS);
     if (!list) {
-        kfree(normalized);
+        karena_pop(scratch, mark);
         return FS_STATUS_ERROR_NO_SPACE;
     }
 
@@ -698,13 +831,24 @@ fs_status_t ramfs_list_directory(void *fs_ptr, const char *path, char ***out_lis
         const char *base = _ramfs_basename(child->name);
         size_t len = strlen(base);
 
-        char *entry = (char *)kmalloc(len + 1);
+        char *entry = NULL;
+        if (count == capacity) {
+            size_t new_capacity = capacity * 2 < max_entries ? capacity * 2 : max_entries;
+            char **grown = (char **)krealloc(list, sizeof(char *) * new_capacity);
+            if (grown) {
+                list = grown;
+                capacity = new_capacity;
+            }
+        }
+        if (count < capacity) {
+            entry = (char *)kmalloc_tagged(len + 1, KMEM_TAG_RAMFS);
+        }
         if (!entry) {
             for (size_t i = 0; i < count; i++) {
                 kfree(list[i]);
             }
             kfree(list);
-            kfree(normalized);
+            karena_pop(scratch, mark);
             return FS_STATUS_ERROR_NO_SPACE;
         }
 
@@ -712,22 +856,31 @@ fs_status_t ramfs_list_directory(void *fs_ptr, const char *path, char ***out_lis
         list[count++] = entry;
     }
 
-    kfree(normalized);
+    karena_pop(scratch, mark);
     *out_list = list;
     *out_count = count;
     return FS_STATUS_OK;
 }
 
-fs_status_t ramfs_get_file_metadata(void *fs_ptr, const char *path, uint8_t *out_metadata) {
+fs_status_t ramfs_list_directory(void *fs_ptr, const char *path, char ***out_list,
+                                 size_t max_entries, size_t *out_count) {
     ramfs_t *fs = (ramfs_t *)fs_ptr;
+    krw_read_lock(&fs->lock);
+    fs_status_t status = _ramfs_list_directory(fs, path, out_list, max_entries, out_count);
+    krw_read_unlock(&fs->lock);
+    return status;
+}
 
-    char *normalized = _ramfs_normalize_path(path);
+static fs_status_t _ramfs_get_file_metadata(ramfs_t *fs, const char *path, uint8_t *out_metadata) {
+    karena_t *scratch = kscratch();
+    karena_mark_t mark = karena_mark(scratch);
+    char *normalized = _ramfs_normalize_path(scratch, path);
     if (!normalized) {
         return FS_STATUS_ERROR_INVALID_ARGUMENT;
     }
 
     ramfs_file_t *file = _ramfs_lookup(fs, normalized);
-    kfree(normalized);
+    karena_pop(scratch, mark);
 
     if (!file) {
         return FS_STATUS_ERROR_NO_ENTRY;
@@ -737,16 +890,24 @@ fs_status_t ramfs_get_file_metadata(void *fs_ptr, const char *path, uint8_t *out
     return FS_STATUS_OK;
 }
 
-fs_status_t ramfs_set_file_permissions(void *fs_ptr, const char *path, uint8_t permissions) {
+fs_status_t ramfs_get_file_metadata(void *fs_ptr, const char *path, uint8_t *out_metadata) {
     ramfs_t *fs = (ramfs_t *)fs_ptr;
+    krw_read_lock(&fs->lock);
+    fs_status_t status = _ramfs_get_file_metadata(fs, path, out_metadata);
+    krw_read_unlock(&fs->lock);
+    return status;
+}
 
-    char *normalized = _ramfs_normalize_path(path);
+static fs_status_t _ramfs_set_file_permissions(ramfs_t *fs, const char *path, uint8_t permissions) {
+    karena_t *scratch = kscratch();
+    karena_mark_t mark = karena_mark(scratch);
+    char *normalized = _ramfs_normalize_path(scratch, path);
     if (!normalized) {
         return FS_STATUS_ERROR_INVALID_ARGUMENT;
     }
 
     ramfs_file_t *file = _ramfs_lookup(fs, normalized);
-    kfree(normalized);
+    karena_pop(scratch, mark);
 
     if (!file) {
         return FS_STATUS_ERROR_NO_ENTRY;
@@ -757,17 +918,25 @@ fs_status_t ramfs_set_file_permissions(void *fs_ptr, const char *path, uint8_t p
     return FS_STATUS_OK;
 }
 
-fs_status_t ramfs_get_file_permissions(void *fs_ptr, const char *path,
-                                       uint8_t *out_permissions) {
+fs_status_t ramfs_set_file_permissions(void *fs_ptr, const char *path, uint8_t permissions) {
     ramfs_t *fs = (ramfs_t *)fs_ptr;
+    krw_write_lock(&fs->lock);
+    fs_status_t status = _ramfs_set_file_permissions(fs, path, permissions);
+    krw_write_unlock(&fs->lock);
+    return status;
+}
 
-    char *normalized = _ramfs_normalize_path(path);
+static fs_status_t _ramfs_get_file_permissions(ramfs_t *fs, const char *path,
+                                               uint8_t *out_permissions) {
+    karena_t *scratch = kscratch();
+    karena_mark_t mark = karena_mark(scratch);
+    char *normalized = _ramfs_normalize_path(scratch, path);
     if (!normalized) {
         return FS_STATUS_ERROR_INVALID_ARGUMENT;
     }
 
     ramfs_file_t *file = _ramfs_lookup(fs, normalized);
-    kfree(normalized);
+    karena_pop(scratch, mark);
 
     if (!file) {
         return FS_STATUS_ERROR_NO_ENTRY;
@@ -777,6 +946,15 @@ fs_status_t ramfs_get_file_permissions(void *fs_ptr, const char *path,
     return FS_STATUS_OK;
 }
 
+fs_status_t ramfs_get_file_permissions(void *fs_ptr, const char *path,
+                                       uint8_t *out_permissions) {
+    ramfs_t *fs = (ramfs_t *)fs_ptr;
+    krw_read_lock(&fs->lock);
+    fs_status_t status = _ramfs_get_file_permissions(fs, path, out_permissions);
+    krw_read_unlock(&fs->lock);
+    return status;
+}
+
 fs_backend_t ramfs_backend = {
     .create = (void*(*)(void))ramfs_create,
     .destroy = (void(*)(void*))ramfs_destroy,
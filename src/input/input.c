@@ -1,8 +1,69 @@
 #include <agave/input.h>
 #include <agave/kvid.h>
 #include <agave/keys.h>
+#include <agave/kthread.h>
+#include <agave/kutils.h>
 
 input_hook_t input_hooks[MAX_INPUT_HOOKS] = {0};
+
+/*
+ * Single-producer/single-consumer ring between the interrupt handlers and
+ * the main loop. Only the producer writes head and only the consumer writes
+ * tail, so neither side needs a lock. Interrupt handlers run with interrupts
+ * off on a single CPU, so all IRQ sources together still act as one producer.
+ */
+#define INPUT_EVENT_RELEASED 0x100
+
+static uint16_t input_ring[INPUT_RING_SIZE];
+static volatile uint32_t input_head = 0;
+static volatile uint32_t input_tail = 0;
+static volatile uint32_t input_dropped = 0;
+static kwait_queue_t input_waiters = KWAIT_QUEUE_INIT;
+
+bool input_post_key(uint8_t c, bool released) {
+    uint32_t head = input_head;
+    if (head - input_tail == INPUT_RING_SIZE) {
+        input_dropped++;
+        return false;
+    }
+
+    input_ring[head & (INPUT_RING_SIZE - 1)] = c | (released ? INPUT_EVENT_RELEASED : 0);
+    // the slot must be written before the consumer can see the new head
+    __asm__ volatile("" : : : "memory");
+    input_head = head + 1;
+    kwait_wake_one(&input_waiters);
+    return true;
+}
+
+void input_dispatch(void) {
+    uint32_t tail = input_tail;
+    while (tail != input_head) {
+        __asm__ volatile("" : : : "memory");
+        uint16_t event = input_ring[tail & (INPUT_RING_SIZE - 1)];
+        input_tail = ++tail;
+
+        if (event & INPUT_EVENT_RELEASED)
+            on_key_release((uint8_t)event);
+        else
+            on_key_press((uint8_t)event);
+    }
+}
+
+bool input_has_pending(void) {
+    return input_tail != input_head;
+}
+
+void input_wait(void) {
+    uint32_t flags = ksave_interrupts();
+    while (!input_has_pending())
+        kwait_sleep(&input_waiters);
+    krestore_interrupts(flags);
+}
+
+uint32_t input_dropped_count(void) {
+    return input_dropped;
+}
+
 void on_key_press(uint8_t c) {
     for (int i = 0; i < MAX_INPUT_HOOKS; i++) {
         if (input_hooks[i].on_key_press && input_hooks[i].on_key_press(c)) {
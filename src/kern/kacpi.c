@@ -0,0 +1,187 @@
+#include <agave/kacpi.h>
+#include <agave/kvmm.h>
+#include <agave/kmem.h>
+#include <agave/utils.h>
+#include <string.h>
+#include <stddef.h>
+
+#define KACPI_EBDA_POINTER 0x40E
+#define KACPI_BIOS_START   0xE0000
+#define KACPI_BIOS_END     0x100000
+
+#define MADT_FLAG_PCAT_COMPAT 0x01
+
+#define MADT_LOCAL_APIC          0
+#define MADT_IO_APIC             1
+#define MADT_SOURCE_OVERRIDE     2
+#define MADT_LOCAL_APIC_ADDRESS  5
+
+#define MADT_CPU_ENABLED        0x01
+#define MADT_CPU_ONLINE_CAPABLE 0x02
+
+typedef struct {
+    char signature[8];
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt_address;
+    // revision 2 and later
+    uint32_t length;
+    uint64_t xsdt_address;
+    uint8_t extended_checksum;
+    uint8_t reserved[3];
+} PACKED kacpi_rsdp_t;
+
+typedef struct {
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} PACKED kacpi_header_t;
+
+typedef struct {
+    kacpi_header_t header;
+    uint32_t lapic_address;
+    uint32_t flags;
+} PACKED kacpi_madt_header_t;
+
+typedef struct {
+    uint8_t type;
+    uint8_t length;
+} PACKED kacpi_madt_entry_t;
+
+static kacpi_madt_t madt;
+static bool madt_found = false;
+
+static uint8_t _kacpi_checksum(const void *data, size_t length) {
+    const uint8_t *bytes = data;
+    uint8_t sum = 0;
+    for (size_t i = 0; i < length; i++)
+        sum += bytes[i];
+    return sum;
+}
+
+static const kacpi_rsdp_t *_kacpi_scan_rsdp(uintptr_t start, uintptr_t end) {
+    // the RSDP sits on a 16 byte boundary
+    for (uintptr_t addr = start; addr + sizeof(kacpi_rsdp_t) <= end; addr += 16) {
+        const kacpi_rsdp_t *rsdp = (const kacpi_rsdp_t *)addr;
+        if (strncmp(rsdp->signature, "RSD PTR ", 8) == 0 && _kacpi_checksum(rsdp, 20) == 0)
+            return rsdp;
+    }
+    return NULL;
+}
+
+// tables can sit above the identity mapped RAM, so map them before reading
+static const kacpi_header_t *_kacpi_map_table(uint64_t address) {
+    if (address >> 32)
+        return NULL;
+
+    const kacpi_header_t *header = (const kacpi_header_t *)(uintptr_t)address;
+    if (!kvmm_identity_map((uintptr_t)address, sizeof(kacpi_header_t), 0))
+        return NULL;
+    if (!kvmm_identity_map((uintptr_t)address, header->length, 0))
+        return NULL;
+    if (_kacpi_checksum(header, header->length) != 0)
+        return NULL;
+    return header;
+}
+
+static const kacpi_header_t *_kacpi_find_table(const kacpi_rsdp_t *rsdp, const char *signature) {
+    bool extended = rsdp->revision >= 2 && rsdp->xsdt_address &&
+                    _kacpi_checksum(rsdp, rsdp->length) == 0;
+    const kacpi_header_t *root = _kacpi_map_table(extended ? rsdp->xsdt_address : rsdp->rsdt_address);
+    if (!root)
+        return NULL;
+
+    size_t entry_size = extended ? 8 : 4;
+    size_t count = (root->length - sizeof(kacpi_header_t)) / entry_size;
+    const uint8_t *entries = (const uint8_t *)(root + 1);
+
+    for (size_t i = 0; i < count; i++) {
+        uint64_t address = extended ? *(const uint64_t *)(entries + i * 8)
+                                    : *(const uint32_t *)(entries + i * 4);
+        const kacpi_header_t *table = _kacpi_map_table(address);
+        if (table && strncmp(table->signature, signature, 4) == 0)
+            return table;
+    }
+    return NULL;
+}
+
+static void _kacpi_parse_madt(const kacpi_madt_header_t *header) {
+    madt.lapic_address = header->lapic_address;
+    madt.has_8259 = header->flags & MADT_FLAG_PCAT_COMPAT;
+
+    const uint8_t *entry = (const uint8_t *)(header + 1);
+    const uint8_t *end = (const uint8_t *)header + header->header.length;
+
+    while (entry + sizeof(kacpi_madt_entry_t) <= end) {
+        const kacpi_madt_entry_t *e = (const kacpi_madt_entry_t *)entry;
+        if (e->length < sizeof(kacpi_madt_entry_t) || entry + e->length > end)
+            break;
+
+        switch (e->type) {
+        case MADT_LOCAL_APIC: {
+            uint8_t apic_id = entry[3];
+            uint32_t flags = *(const uint32_t *)(entry + 4);
+            if ((flags & (MADT_CPU_ENABLED | MADT_CPU_ONLINE_CAPABLE)) && madt.cpu_count < KACPI_MAX_CPUS)
+                madt.cpu_apic_ids[madt.cpu_count++] = apic_id;
+            break;
+        }
+        case MADT_IO_APIC:
+            if (madt.ioapic_count < KACPI_MAX_IOAPICS) {
+                kacpi_ioapic_t *ioapic = &madt.ioapics[madt.ioapic_count++];
+                ioapic->id = entry[2];
+                ioapic->address = *(const uint32_t *)(entry + 4);
+                ioapic->gsi_base = *(const uint32_t *)(entry + 8);
+            }
+            break;
+        case MADT_SOURCE_OVERRIDE:
+            if (madt.override_count < KACPI_MAX_OVERRIDES) {
+                kacpi_override_t *override = &madt.overrides[madt.override_count++];
+                override->source = entry[3];
+                override->gsi = *(const uint32_t *)(entry + 4);
+                override->flags = *(const uint16_t *)(entry + 8);
+            }
+            break;
+        case MADT_LOCAL_APIC_ADDRESS: {
+            uint64_t address = *(const uint64_t *)(entry + 4);
+            if (!(address >> 32))
+                madt.lapic_address = (uint32_t)address;
+            break;
+        }
+        }
+
+        entry += e->length;
+    }
+}
+
+bool kacpi_init(void) {
+    // first KB of the EBDA, then the BIOS read-only area
+    const kacpi_rsdp_t *rsdp = NULL;
+    uint16_t ebda_segment;
+    kmemcpy(&ebda_segment, (const void *)KACPI_EBDA_POINTER, sizeof(ebda_segment));
+    uintptr_t ebda = (uintptr_t)ebda_segment << 4;
+    if (ebda)
+        rsdp = _kacpi_scan_rsdp(ebda, ebda + 1024);
+    if (!rsdp)
+        rsdp = _kacpi_scan_rsdp(KACPI_BIOS_START, KACPI_BIOS_END);
+    if (!rsdp)
+        return false;
+
+    const kacpi_header_t *header = _kacpi_find_table(rsdp, "APIC");
+    if (!header)
+        return false;
+
+    _kacpi_parse_madt((const kacpi_madt_header_t *)header);
+    madt_found = madt.cpu_count > 0;
+    return madt_found;
+}
+
+const kacpi_madt_t *kacpi_madt(void) {
+    return madt_found ? &madt : NULL;
+}
@@ -0,0 +1,128 @@
+#include <agave/karena.h>
+#include <agave/kpage.h>
+#include <agave/kmem.h>
+#include <agave/kthread.h>
+
+/*
+ * Chunks come straight from the page allocator so short-lived allocations
+ * never touch the heap. Each chunk records the one before it, so popping a
+ * mark only walks the chunks added since the mark, usually none.
+ */
+
+struct karena_chunk {
+    karena_chunk_t *prev;
+    uint32_t order;
+    size_t used; // offset of the first free byte from the start of the chunk
+};
+
+#define KARENA_HEADER_SIZE ((sizeof(karena_chunk_t) + KARENA_ALIGN - 1) & ~(size_t)(KARENA_ALIGN - 1))
+
+// used until kthread_init, afterwards every thread has its own
+static karena_t scratch = KARENA_INIT(KMEM_TAG_SCRATCH);
+
+static inline size_t _karena_chunk_size(karena_chunk_t *chunk) {
+    return (size_t)KPAGE_SIZE << chunk->order;
+}
+
+static karena_chunk_t *_karena_chunk_new(karena_t *arena, size_t size) {
+    uint32_t order = kpage_order_for(KARENA_HEADER_SIZE + size);
+    if (order <= KARENA_CHUNK_ORDER)
+        order = KARENA_CHUNK_ORDER;
+    if (((size_t)KPAGE_SIZE << order) - KARENA_HEADER_SIZE < size)
+        return NULL;
+
+    karena_chunk_t *chunk;
+    if (order == KARENA_CHUNK_ORDER && arena->spare) {
+        chunk = arena->spare;
+        arena->spare = NULL;
+    } else {
+        chunk = kpage_alloc(order);
+        if (!chunk)
+            return NULL;
+        chunk->order = order;
+        kmem_stats_alloc(arena->tag, (size_t)KPAGE_SIZE << order);
+    }
+
+    chunk->used = KARENA_HEADER_SIZE;
+    chunk->prev = arena->current;
+    arena->current = chunk;
+    return chunk;
+}
+
+static void _karena_chunk_release(karena_t *arena, karena_chunk_t *chunk) {
+    if (chunk->order == KARENA_CHUNK_ORDER && !arena->spare) {
+        arena->spare = chunk;
+        return;
+    }
+
+    kmem_stats_free(arena->tag, _karena_chunk_size(chunk));
+    kpage_free(chunk, chunk->order);
+}
+
+void karena_init(karena_t *arena, kmem_tag_t tag) {
+    arena->current = NULL;
+    arena->spare = NULL;
+    arena->tag = tag;
+}
+
+void karena_destroy(karena_t *arena) {
+    karena_reset(arena);
+    if (arena->spare) {
+        kmem_stats_free(arena->tag, _karena_chunk_size(arena->spare));
+        kpage_free(arena->spare, arena->spare->order);
+        arena->spare = NULL;
+    }
+}
+
+void *karena_alloc(karena_t *arena, size_t size) {
+    size = (size + KARENA_ALIGN - 1) & ~(size_t)(KARENA_ALIGN - 1);
+    if (size == 0)
+        size = KARENA_ALIGN;
+
+    karena_chunk_t *chunk = arena->current;
+    if (!chunk || _karena_chunk_size(chunk) - chunk->used < size) {
+        chunk = _karena_chunk_new(arena, size);
+        if (!chunk)
+            return NULL;
+    }
+
+    void *ptr = (char *)chunk + chunk->used;
+    chunk->used += size;
+    return ptr;
+}
+
+char *karena_strndup(karena_t *arena, const char *str, size_t len) {
+    char *copy = karena_alloc(arena, len + 1);
+    if (!copy)
+        return NULL;
+
+    kmemcpy(copy, str, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+karena_mark_t karena_mark(karena_t *arena) {
+    karena_mark_t mark = { arena->current, arena->current ? arena->current->used : 0 };
+    return mark;
+}
+
+void karena_pop(karena_t *arena, karena_mark_t mark) {
+    while (arena->current && arena->current != mark.chunk) {
+        karena_chunk_t *chunk = arena->current;
+        arena->current = chunk->prev;
+        _karena_chunk_release(arena, chunk);
+    }
+
+    if (arena->current)
+        arena->current->used = mark.used;
+}
+
+void karena_reset(karena_t *arena) {
+    karena_mark_t empty = { NULL, 0 };
+    karena_pop(arena, empty);
+}
+
+karena_t *kscratch(void) {
+    kthread_t *thread = kthread_current();
+    return thread ? &thread->scratch : &scratch;
+}
@@ -0,0 +1,116 @@
+#include <agave/kclock.h>
+#include <agave/kcpu.h>
+#include <agave/pit.h>
+#include <agave/kutils.h>
+
+// each calibration run lasts about 50 ms, the fastest run wins
+#define KCLOCK_CALIBRATE_CLOCKS 59659
+#define KCLOCK_CALIBRATE_RUNS   3
+
+static uint64_t _kclock_read_tsc(void) {
+    return kcpu_rdtsc();
+}
+
+static kclocksource_t pit_source = { .name = "pit", .read = pit_get_clocks };
+static kclocksource_t tsc_source = { .name = "tsc", .read = _kclock_read_tsc };
+
+/*
+ * Readers sample the source and base under a sequence count instead of a
+ * lock, so the clock can be read from interrupt handlers. The count is odd
+ * while the base is being replaced and readers retry until they see the same
+ * even value before and after.
+ */
+static volatile uint32_t clock_seq = 0;
+static const kclocksource_t *clock_source = &pit_source;
+static uint64_t clock_base_count = 0;
+static uint64_t clock_base_ns = 0;
+
+void kclock_conv_init(kclock_conv_t *conv, uint32_t to, uint32_t from) {
+    uint32_t rem;
+    uint64_t mult = kdiv_u64_u32((uint64_t)to << 32, from, &rem);
+    uint32_t shift = 32;
+
+    while (mult >> 32) {
+        mult >>= 1;
+        shift--;
+    }
+    // long division one bit at a time, from is below 2^31 so rem << 1 cannot overflow
+    while (mult < 0x80000000u && shift < 63) {
+        rem <<= 1;
+        mult = (mult << 1) | (rem >= from);
+        if (rem >= from)
+            rem -= from;
+        shift++;
+    }
+
+    conv->mult = (uint32_t)mult;
+    conv->shift = shift;
+}
+
+static uint32_t _kclock_calibrate_tsc_khz(void) {
+    uint64_t best = (uint64_t)-1;
+    for (int run = 0; run < KCLOCK_CALIBRATE_RUNS; run++) {
+        uint64_t start = kcpu_rdtsc();
+        pit_busy_wait(KCLOCK_CALIBRATE_CLOCKS);
+        uint64_t cycles = kcpu_rdtsc() - start;
+        if (cycles < best)
+            best = cycles;
+    }
+
+    return (uint32_t)(best * PIT_FREQUENCY / ((uint64_t)KCLOCK_CALIBRATE_CLOCKS * 1000));
+}
+
+static void _kclock_set_source(const kclocksource_t *source) {
+    uint32_t flags = ksave_interrupts();
+    uint64_t now = kclock_ns();
+
+    clock_seq++;
+    __asm__ volatile("" : : : "memory");
+    clock_base_count = source->read();
+    clock_base_ns = now;
+    clock_source = source;
+    __asm__ volatile("" : : : "memory");
+    clock_seq++;
+
+    krestore_interrupts(flags);
+}
+
+void kclock_init(void) {
+    pit_source.frequency_khz = PIT_FREQUENCY / 1000;
+    kclock_conv_init(&pit_source.to_ns, 1000000000, PIT_FREQUENCY);
+
+    if (!kcpu_has(KCPU_FEATURE_TSC))
+        return;
+
+    uint32_t flags = ksave_interrupts();
+    tsc_source.frequency_khz = _kclock_calibrate_tsc_khz();
+    krestore_interrupts(flags);
+    if (tsc_source.frequency_khz == 0)
+        return;
+
+    kclock_conv_init(&tsc_source.to_ns, 1000000, tsc_source.frequency_khz);
+    _kclock_set_source(&tsc_source);
+}
+
+uint64_t kclock_ns(void) {
+    uint32_t seq;
+    uint64_t ns;
+    do {
+        seq = clock_seq;
+        __asm__ volatile("" : : : "memory");
+        const kclocksource_t *source = clock_source;
+        ns = clock_base_ns + kclock_convert(&source->to_ns, source->read() - clock_base_count);
+        __asm__ volatile("" : : : "memory");
+    } while ((seq & 1) || seq != clock_seq);
+    return ns;
+}
+
+const kclocksource_t *kclock_source(void) {
+    return clock_source;
+}
+
+void kclock_delay_ns(uint64_t nanoseconds) {
+    uint64_t start = kclock_ns();
+    while (kclock_ns() - start < nanoseconds)
+        kcpu_pause();
+}
@@ -1,7 +1,9 @@
 #include <agave/time.h>
+#include <agave/drivers/serial.h>
 #include <agave/io.h>
 #include <agave/kcore.h>
 #include <agave/kcpu.h>
+#include <agave/ktimer.h>
 #include <agave/kutils.h>
 #include <agave/kvid.h>
 #include <agave/pit.h>
@@ -26,12 +28,16 @@ void kshutdown(void) {
 
 void kpanic_ex(const char *file, int line, const char *func, const char *fmt, ...) {
     kdisable_interrupts();
+    kvid_break_lock();
+    serial_break_lock();
+    // what is still queued goes out first, the panic text follows it in order
+    serial_flush();
     ksetcolor(kcreate_color(LIGHT_RED, BLACK));
     kclear();
 
     uint64_t ticks = kcore_get_information()->uptime_ticks;
-    uint64_t seconds = ticks / TICK_FREQUENCY;
-    uint64_t ms = (ticks % TICK_FREQUENCY) * 1000 / TICK_FREQUENCY;
+    uint32_t ms;
+    uint64_t seconds = kdiv_u64_u32(ktimer_ticks_to_milliseconds(ticks), 1000, &ms);
 
     datetime_t dt;
     datetime_get_current(&dt);
@@ -40,7 +46,7 @@ void kpanic_ex(const char *file, int line, const char *func, const char *fmt, ..
     kprintf("            KERNEL PANIC\n");
     kprintf("========================================\n\n");
 
-    kprintf("[uptime]  %llu.%03llus\n", seconds, ms);
+    kprintf("[uptime]  %llu.%03us\n", seconds, ms);
     char datetime_str[32];
     datetime_to_string(&dt, datetime_str, sizeof(datetime_str));
     kprintf("[datetime] %s\n", datetime_str);
@@ -56,6 +62,8 @@ void kpanic_ex(const char *file, int line, const char *func, const char *fmt, ..
 
     kprintf("system halted.\n");
     kprintf("========================================\n");
+    // interrupts stay off from here on, nothing else would send what is still queued
+    serial_flush();
 
     for (;;) {
         khalt_cpu(false);
@@ -65,11 +73,11 @@ void kpanic_ex(const char *file, int line, const char *func, const char *fmt, ..
 void kcore_initialize() {
   kcore_info.kernel_version = KERNEL_VERSION;
   kcore_info.cpus_count = kcpu_get_cpu_count();
-  kcore_info.boot_ticks = pit_get_ticks();
+  kcore_info.boot_ticks = ktimer_get_ticks();
   kcore_info.uptime_ticks = 0;
 }
 
 kcore_information_t *kcore_get_information() {
-  kcore_info.uptime_ticks = pit_get_ticks() - kcore_info.boot_ticks;
+  kcore_info.uptime_ticks = ktimer_get_ticks() - kcore_info.boot_ticks;
   return &kcore_info;
 }
\ No newline at end of file
@@ -1,5 +1,264 @@
 #include <agave/kcpu.h>
+#include <agave/kacpi.h>
+#include <agave/klapic.h>
+#include <agave/kjob.h>
+#include <agave/kclock.h>
+#include <agave/kpage.h>
+#include <agave/kmem.h>
+#include <agave/idt.h>
+#include <agave/kirq.h>
+#include <agave/kvid.h>
+#include <stddef.h>
 
-uint32_t kcpu_get_cpu_count() {
-    return 1;
-}
\ No newline at end of file
+#define CPUID_1_EDX_PSE  (1u << 3)
+#define CPUID_1_EDX_TSC  (1u << 4)
+#define CPUID_1_EDX_APIC (1u << 9)
+#define CPUID_1_EDX_PGE  (1u << 13)
+#define CPUID_1_EDX_FXSR (1u << 24)
+#define CPUID_1_EDX_SSE  (1u << 25)
+#define CPUID_1_EDX_SSE2 (1u << 26)
+#define CPUID_7_EBX_ERMS (1u << 9)
+#define CPUID_80000007_EDX_INVARIANT_TSC (1u << 8)
+
+#define CR0_MP         (1u << 1)
+#define CR0_EM         (1u << 2)
+#define CR4_OSFXSR     (1u << 9)
+#define CR4_OSXMMEXCPT (1u << 10)
+
+#define GDT_ACCESS_CODE 0x9A
+#define GDT_ACCESS_DATA 0x92
+#define GDT_ACCESS_TSS  0x89
+#define GDT_FLAGS_FLAT  0xC // 4 KB granularity, 32-bit
+#define GDT_FLAGS_BYTE  0x4 // byte granularity, 32-bit
+
+#define KCPU_BOOT_STACK   0x9F000
+#define KCPU_STACK_ORDER  2 // 16 KB, the same as a thread stack
+#define KCPU_INIT_DELAY_NS    10000000ull // 10 ms between INIT and the first startup IPI
+#define KCPU_STARTUP_WAIT_NS  200000ull
+#define KCPU_RETRY_WAIT_NS    100000000ull
+
+// filled in before each startup IPI, the layout matches ap_trampoline_params
+typedef struct {
+    uint32_t cr0;
+    uint32_t cr3;
+    uint32_t cr4;
+    uint32_t stack;
+    uint32_t entry;
+    uint32_t cpu;
+} kcpu_ap_params_t;
+
+extern const uint8_t ap_trampoline_start[];
+extern const uint8_t ap_trampoline_params[];
+extern const uint8_t ap_trampoline_end[];
+
+static uint32_t features = 0;
+static kcpu_local_t cpus[KCPU_MAX];
+static volatile uint32_t cpu_count = 1;
+
+static void _kcpu_enable_sse(void) {
+    uint32_t cr0, cr4;
+    __asm__ volatile("mov %%cr0, %0" : "=r"(cr0));
+    cr0 = (cr0 & ~CR0_EM) | CR0_MP;
+    __asm__ volatile("mov %0, %%cr0" : : "r"(cr0));
+
+    __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+    cr4 |= CR4_OSFXSR | CR4_OSXMMEXCPT;
+    __asm__ volatile("mov %0, %%cr4" : : "r"(cr4));
+}
+
+static uint64_t _kcpu_gdt_entry(uint32_t base, uint32_t limit, uint8_t access, uint8_t flags) {
+    uint64_t entry = limit & 0xFFFF;
+    entry |= (uint64_t)(base & 0xFFFFFF) << 16;
+    entry |= (uint64_t)access << 40;
+    entry |= (uint64_t)((limit >> 16) & 0xF) << 48;
+    entry |= (uint64_t)(flags & 0xF) << 52;
+    entry |= (uint64_t)(base >> 24) << 56;
+    return entry;
+}
+
+// every CPU gets its own GDT so %gs can point at its kcpu_local_t and the TSS busy bit is not shared
+static void _kcpu_load_local(kcpu_local_t *cpu, uint32_t stack_top) {
+    cpu->self = cpu;
+    cpu->tss.ss0 = KCPU_SEL_DATA;
+    cpu->tss.esp0 = stack_top;
+    cpu->tss.iomap_base = sizeof(kcpu_tss_t);
+
+    cpu->gdt[0] = 0;
+    cpu->gdt[KCPU_SEL_CODE / 8] = _kcpu_gdt_entry(0, 0xFFFFF, GDT_ACCESS_CODE, GDT_FLAGS_FLAT);
+    cpu->gdt[KCPU_SEL_DATA / 8] = _kcpu_gdt_entry(0, 0xFFFFF, GDT_ACCESS_DATA, GDT_FLAGS_FLAT);
+    cpu->gdt[KCPU_SEL_LOCAL / 8] = _kcpu_gdt_entry((uint32_t)cpu, sizeof(kcpu_local_t) - 1,
+                                                   GDT_ACCESS_DATA, GDT_FLAGS_BYTE);
+    cpu->gdt[KCPU_SEL_TSS / 8] = _kcpu_gdt_entry((uint32_t)&cpu->tss, sizeof(kcpu_tss_t) - 1,
+                                                 GDT_ACCESS_TSS, 0);
+
+    struct {
+        uint16_t limit;
+        uint32_t base;
+    } PACKED gdtr = { sizeof(cpu->gdt) - 1, (uint32_t)cpu->gdt };
+
+    __asm__ volatile(
+        "lgdt %0\n\t"
+        "ljmp %1, $1f\n"
+        "1:\n\t"
+        "mov %2, %%ax\n\t"
+        "mov %%ax, %%ds\n\t"
+        "mov %%ax, %%es\n\t"
+        "mov %%ax, %%fs\n\t"
+        "mov %%ax, %%ss\n\t"
+        "mov %3, %%ax\n\t"
+        "mov %%ax, %%gs\n\t"
+        "mov %4, %%ax\n\t"
+        "ltr %%ax"
+        : : "m"(gdtr), "i"(KCPU_SEL_CODE), "i"(KCPU_SEL_DATA), "i"(KCPU_SEL_LOCAL), "i"(KCPU_SEL_TSS)
+        : "eax", "memory");
+}
+
+void kcpu_init(void) {
+    uint32_t max_leaf, eax, ebx, ecx, edx;
+    kcpu_cpuid(0, &max_leaf, &ebx, &ecx, &edx);
+
+    kcpu_cpuid(1, &eax, &ebx, &ecx, &edx);
+    if (edx & CPUID_1_EDX_PSE)  features |= KCPU_FEATURE_PSE;
+    if (edx & CPUID_1_EDX_TSC)  features |= KCPU_FEATURE_TSC;
+    if (edx & CPUID_1_EDX_PGE)  features |= KCPU_FEATURE_PGE;
+    if (edx & CPUID_1_EDX_FXSR) features |= KCPU_FEATURE_FXSR;
+    if (edx & CPUID_1_EDX_APIC) features |= KCPU_FEATURE_APIC;
+
+    // the initial APIC ID, kcpu_smp_init reads the register once the APIC is mapped
+    cpus[0].id = 0;
+    cpus[0].apic_id = ebx >> 24;
+    cpus[0].online = true;
+    _kcpu_load_local(&cpus[0], KCPU_BOOT_STACK);
+
+    // SSE state is only saved with FXSAVE, so both are required
+    if ((edx & CPUID_1_EDX_FXSR) && (edx & CPUID_1_EDX_SSE)) {
+        _kcpu_enable_sse();
+        features |= KCPU_FEATURE_SSE;
+        if (edx & CPUID_1_EDX_SSE2)
+            features |= KCPU_FEATURE_SSE2;
+    }
+
+    if (max_leaf >= 7) {
+        kcpu_cpuid(7, &eax, &ebx, &ecx, &edx);
+        if (ebx & CPUID_7_EBX_ERMS)
+            features |= KCPU_FEATURE_ERMS;
+    }
+
+    uint32_t max_extended;
+    kcpu_cpuid(0x80000000, &max_extended, &ebx, &ecx, &edx);
+    if (max_extended >= 0x80000007) {
+        kcpu_cpuid(0x80000007, &eax, &ebx, &ecx, &edx);
+        if (edx & CPUID_80000007_EDX_INVARIANT_TSC)
+            features |= KCPU_FEATURE_INVARIANT_TSC;
+    }
+}
+
+bool kcpu_has(uint32_t feature) {
+    return (features & feature) == feature;
+}
+
+// nothing to do, the point is to get the CPU out of hlt in kjob_worker_loop
+static void _kcpu_wake_interrupt(UNUSED kirq_frame_t *frame, UNUSED void *data) {
+}
+
+// entered from the trampoline with paging on, the stack set up and the boot GDT still loaded
+static void _kcpu_ap_main(kcpu_local_t *cpu) {
+    _kcpu_load_local(cpu, (uint32_t)cpu->stack + ((size_t)KPAGE_SIZE << KCPU_STACK_ORDER));
+    __asm__ volatile("lidt %0" : : "m"(idtr));
+    klapic_enable();
+
+    __atomic_store_n(&cpu->online, true, __ATOMIC_RELEASE);
+    kjob_worker_loop();
+}
+
+static bool _kcpu_wait_online(kcpu_local_t *cpu, uint64_t timeout_ns) {
+    uint64_t deadline = kclock_ns() + timeout_ns;
+    while (!__atomic_load_n(&cpu->online, __ATOMIC_ACQUIRE)) {
+        if (kclock_ns() >= deadline)
+            return false;
+        kcpu_pause();
+    }
+    return true;
+}
+
+// a CPU that missed the deadline may still be on its way, INIT stops it so the slot can go to the next one
+static void _kcpu_abandon(kcpu_local_t *cpu) {
+    klapic_send_init(cpu->apic_id);
+    kclock_delay_ns(KCPU_INIT_DELAY_NS);
+
+    __atomic_store_n(&cpu->online, false, __ATOMIC_RELEASE);
+    kpage_free(cpu->stack, KCPU_STACK_ORDER);
+    kmem_stats_free(KMEM_TAG_THREAD, (size_t)KPAGE_SIZE << KCPU_STACK_ORDER);
+    cpu->stack = NULL;
+}
+
+// INIT, then up to two startup IPIs as in the MultiProcessor Specification
+static bool _kcpu_start(kcpu_local_t *cpu, kcpu_ap_params_t *params) {
+    cpu->stack = kpage_alloc(KCPU_STACK_ORDER);
+    if (!cpu->stack)
+        return false;
+    kmem_stats_alloc(KMEM_TAG_THREAD, (size_t)KPAGE_SIZE << KCPU_STACK_ORDER);
+
+    params->stack = (uint32_t)cpu->stack + ((size_t)KPAGE_SIZE << KCPU_STACK_ORDER);
+    params->cpu = (uint32_t)cpu;
+
+    klapic_send_init(cpu->apic_id);
+    kclock_delay_ns(KCPU_INIT_DELAY_NS);
+
+    klapic_send_startup(cpu->apic_id, KCPU_TRAMPOLINE_BASE >> KPAGE_SHIFT);
+    if (_kcpu_wait_online(cpu, KCPU_STARTUP_WAIT_NS))
+        return true;
+    klapic_send_startup(cpu->apic_id, KCPU_TRAMPOLINE_BASE >> KPAGE_SHIFT);
+    if (_kcpu_wait_online(cpu, KCPU_RETRY_WAIT_NS))
+        return true;
+
+    _kcpu_abandon(cpu);
+    return false;
+}
+
+void kcpu_smp_init(void) {
+    if (!kcpu_has(KCPU_FEATURE_APIC) || !kacpi_init())
+        return;
+
+    const kacpi_madt_t *madt = kacpi_madt();
+    if (!klapic_init(madt->lapic_address))
+        return;
+    cpus[0].apic_id = klapic_id();
+    kirq_register_vector(KCPU_WAKE_VECTOR, "wakeup", _kcpu_wake_interrupt, NULL);
+
+    // the startup IPI can only point below 1 MB, so the trampoline runs from a copy there
+    kmemcpy((void *)KCPU_TRAMPOLINE_BASE, ap_trampoline_start, ap_trampoline_end - ap_trampoline_start);
+    kcpu_ap_params_t *params = (kcpu_ap_params_t *)(KCPU_TRAMPOLINE_BASE + (ap_trampoline_params - ap_trampoline_start));
+    __asm__ volatile("mov %%cr0, %0" : "=r"(params->cr0));
+    __asm__ volatile("mov %%cr3, %0" : "=r"(params->cr3));
+    __asm__ volatile("mov %%cr4, %0" : "=r"(params->cr4));
+    params->entry = (uint32_t)_kcpu_ap_main;
+
+    for (uint32_t i = 0; i < madt->cpu_count && cpu_count < KCPU_MAX; i++) {
+        if (madt->cpu_apic_ids[i] == cpus[0].apic_id)
+            continue;
+
+        kcpu_local_t *cpu = &cpus[cpu_count];
+        cpu->id = cpu_count;
+        cpu->apic_id = madt->cpu_apic_ids[i];
+        // one CPU that does not answer is no reason to give up on the rest
+        if (!_kcpu_start(cpu, params)) {
+            kprintf("[warn] cpu with apic id %u did not start\n", cpu->apic_id);
+            continue;
+        }
+        __atomic_store_n(&cpu_count, cpu_count + 1, __ATOMIC_RELEASE);
+    }
+}
+
+uint32_t kcpu_get_cpu_count(void) {
+    return __atomic_load_n(&cpu_count, __ATOMIC_ACQUIRE);
+}
+
+kcpu_local_t *kcpu_get(uint32_t id) {
+    return &cpus[id];
+}
+
+void kcpu_wake(kcpu_local_t *cpu) {
+    if (__atomic_exchange_n(&cpu->sleeping, false, __ATOMIC_SEQ_CST))
+        klapic_send_ipi(cpu->apic_id, KCPU_WAKE_VECTOR);
+}
@@ -0,0 +1,233 @@
+#ifndef KMEM_TLSF
+
+#include <agave/kmem.h>
+#include <stdint.h>
+
+#define BLOCK_FREE      0x1
+#define BLOCK_PREV_FREE 0x2
+#define BLOCK_TAG_SHIFT 8
+#define BLOCK_TAG_MASK  (0xFFu << BLOCK_TAG_SHIFT)
+
+/**
+ * block_header_t
+ * size: payload size in bytes. Free blocks repeat it in a footer at the end of the payload
+ *       so that the following block can find its predecessor in O(1).
+ * flags: BLOCK_FREE for this block, BLOCK_PREV_FREE if the physically previous block is free,
+ *        the allocation tag in bits 8-15 while the block is in use.
+ * next_free, prev_free: links in the explicit free list, only valid while the block is free.
+ */
+typedef struct block_header {
+    size_t size;
+    uint32_t flags;
+    struct block_header *next_free;
+    struct block_header *prev_free;
+} block_header_t;
+
+#define BLOCK_MIN_SIZE 8
+
+static block_header_t *free_list = NULL;
+
+static inline block_header_t *next_block(block_header_t *block) {
+    return (block_header_t*)((char*)block + sizeof(block_header_t) + block->size);
+}
+
+static inline block_header_t *prev_block(block_header_t *block) {
+    size_t prev_size = *((size_t*)block - 1);
+    return (block_header_t*)((char*)block - prev_size - sizeof(block_header_t));
+}
+
+static inline void write_footer(block_header_t *block) {
+    *(size_t*)((char*)next_block(block) - sizeof(size_t)) = block->size;
+}
+
+static void free_list_insert(block_header_t *block) {
+    block->prev_free = NULL;
+    block->next_free = free_list;
+    if (free_list) free_list->prev_free = block;
+    free_list = block;
+}
+
+static void free_list_remove(block_header_t *block) {
+    if (block->prev_free) block->prev_free->next_free = block->next_free;
+    else free_list = block->next_free;
+    if (block->next_free) block->next_free->prev_free = block->prev_free;
+}
+
+static void mark_free(block_header_t *block) {
+    block->flags |= BLOCK_FREE;
+    write_footer(block);
+    next_block(block)->flags |= BLOCK_PREV_FREE;
+    free_list_insert(block);
+}
+
+void kheap_add_region(void *start, size_t size) {
+    uintptr_t begin = ((uintptr_t)start + 15) & ~(uintptr_t)15;
+    uintptr_t end = ((uintptr_t)start + size) & ~(uintptr_t)7;
+    if (end <= begin || end - begin < 3 * sizeof(block_header_t) + BLOCK_MIN_SIZE)
+        return;
+
+    block_header_t *block = (block_header_t*)begin;
+    block->size = end - begin - 2 * sizeof(block_header_t);
+    block->flags = 0;
+
+    // zero-sized, permanently used epilogue so coalescing never runs past the region
+    block_header_t *epilogue = next_block(block);
+    epilogue->size = 0;
+    epilogue->flags = 0;
+
+    mark_free(block);
+}
+
+static void *take_block(block_header_t *block, size_t size) {
+    if (block->size >= size + sizeof(block_header_t) + BLOCK_MIN_SIZE) {
+        block_header_t *rest = (block_header_t*)((char*)block + sizeof(block_header_t) + size);
+        rest->size = block->size - size - sizeof(block_header_t);
+        rest->flags = 0;
+        block->size = size;
+        mark_free(rest);
+    } else {
+        next_block(block)->flags &= ~BLOCK_PREV_FREE;
+    }
+    block->flags &= ~BLOCK_FREE;
+    return (char*)block + sizeof(block_header_t);
+}
+
+static inline size_t round_size(size_t size) {
+    size = (size + 7) & ~7;
+    return size < BLOCK_MIN_SIZE ? BLOCK_MIN_SIZE : size;
+}
+
+static void *alloc_first_fit(size_t size) {
+    for (block_header_t *curr = free_list; curr; curr = curr->next_free) {
+        if (curr->size >= size) {
+            free_list_remove(curr);
+            return take_block(curr, size);
+        }
+    }
+    return NULL;
+}
+
+static void *alloc_aligned_fit(size_t size, size_t align) {
+    for (block_header_t *curr = free_list; curr; curr = curr->next_free) {
+        uintptr_t payload = (uintptr_t)curr + sizeof(block_header_t);
+        uintptr_t end = payload + curr->size;
+        uintptr_t aligned = (payload + align - 1) & ~(uintptr_t)(align - 1);
+
+        // the gap in front of the aligned block must fit a free block of its own
+        while (aligned != payload && aligned - payload < sizeof(block_header_t) + BLOCK_MIN_SIZE)
+            aligned += align;
+
+        if (aligned + size > end)
+            continue;
+
+        if (aligned == payload) {
+            free_list_remove(curr);
+            return take_block(curr, size);
+        }
+
+        // shrink the free block to the gap and carve the aligned block out of its tail
+        block_header_t *block = (block_header_t*)(aligned - sizeof(block_header_t));
+        block->size = end - aligned;
+        block->flags = BLOCK_PREV_FREE;
+        curr->size = (uintptr_t)block - payload;
+        write_footer(curr);
+        return take_block(block, size);
+    }
+    return NULL;
+}
+
+void* kheap_alloc(size_t size) {
+    size = round_size(size);
+
+    void *ptr = alloc_first_fit(size);
+    if (!ptr && kheap_grow(size))
+        ptr = alloc_first_fit(size);
+    return ptr;
+}
+
+void* kheap_alloc_aligned(size_t size, size_t align) {
+    size = round_size(size);
+
+    void *ptr = alloc_aligned_fit(size, align);
+    if (!ptr && kheap_grow(size + align + sizeof(block_header_t) + BLOCK_MIN_SIZE))
+        ptr = alloc_aligned_fit(size, align);
+    return ptr;
+}
+
+void kheap_free(void* ptr) {
+    if (!ptr) return;
+
+    block_header_t *block = (block_header_t*)((char*)ptr - sizeof(block_header_t));
+
+    block_header_t *next = next_block(block);
+    if (next->flags & BLOCK_FREE) {
+        free_list_remove(next);
+        block->size += sizeof(block_header_t) + next->size;
+    }
+
+    if (block->flags & BLOCK_PREV_FREE) {
+        block_header_t *prev = prev_block(block);
+        free_list_remove(prev);
+        prev->size += sizeof(block_header_t) + block->size;
+        block = prev;
+    }
+
+    mark_free(block);
+}
+
+// frees the part of a used block beyond size, merged with a free successor
+static void trim_used(block_header_t *block, size_t size) {
+    if (block->size < size + sizeof(block_header_t) + BLOCK_MIN_SIZE)
+        return;
+
+    block_header_t *rest = (block_header_t*)((char*)block + sizeof(block_header_t) + size);
+    rest->size = block->size - size - sizeof(block_header_t);
+    rest->flags = 0;
+    block->size = size;
+
+    block_header_t *next = next_block(rest);
+    if (next->flags & BLOCK_FREE) {
+        free_list_remove(next);
+        rest->size += sizeof(block_header_t) + next->size;
+    }
+    mark_free(rest);
+}
+
+bool kheap_resize(void* ptr, size_t size) {
+    block_header_t *block = (block_header_t*)((char*)ptr - sizeof(block_header_t));
+    size = round_size(size);
+
+    if (size > block->size) {
+        block_header_t *next = next_block(block);
+        if (!(next->flags & BLOCK_FREE) || block->size + sizeof(block_header_t) + next->size < size)
+            return false;
+
+        free_list_remove(next);
+        block->size += sizeof(block_header_t) + next->size;
+        next_block(block)->flags &= ~BLOCK_PREV_FREE;
+    }
+
+    trim_used(block, size);
+    return true;
+}
+
+size_t kheap_block_size(void* ptr) {
+    return ((block_header_t*)((char*)ptr - sizeof(block_header_t)))->size;
+}
+
+void kheap_set_tag(void* ptr, kmem_tag_t tag) {
+    block_header_t *block = (block_header_t*)((char*)ptr - sizeof(block_header_t));
+    block->flags = (block->flags & ~BLOCK_TAG_MASK) | ((uint32_t)tag << BLOCK_TAG_SHIFT);
+}
+
+kmem_tag_t kheap_get_tag(void* ptr) {
+    block_header_t *block = (block_header_t*)((char*)ptr - sizeof(block_header_t));
+    return (kmem_tag_t)((block->flags & BLOCK_TAG_MASK) >> BLOCK_TAG_SHIFT);
+}
+
+void kheap_walk_free(void (*fn)(size_t size, void *ctx), void *ctx) {
+    for (block_header_t *curr = free_list; curr; curr = curr->next_free)
+        fn(curr->size, ctx);
+}
+
+#endif // KMEM_TLSF
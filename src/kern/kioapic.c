@@ -0,0 +1,122 @@
+#include <agave/kioapic.h>
+#include <agave/kvmm.h>
+#include <agave/kpage.h>
+#include <agave/kutils.h>
+#include <stddef.h>
+
+// registers are reached through a select register and a data window
+#define IOAPIC_REGSEL 0x00
+#define IOAPIC_WINDOW 0x10
+
+#define IOAPIC_VERSION  0x01
+#define IOAPIC_REDTBL   0x10 // two registers per entry, low half first
+
+#define REDTBL_ACTIVE_LOW 0x02000
+#define REDTBL_LEVEL      0x08000
+#define REDTBL_MASKED     0x10000
+
+/**
+ * kioapic_t
+ * regs: mapped register window.
+ * gsi_base, gsi_count: global system interrupts served by this IOAPIC.
+ */
+typedef struct {
+    volatile uint32_t *regs;
+    uint32_t gsi_base;
+    uint32_t gsi_count;
+} kioapic_t;
+
+static kioapic_t ioapics[KACPI_MAX_IOAPICS];
+static uint32_t ioapic_count = 0;
+
+// the select and data registers are a pair, callers keep interrupts off around them
+static uint32_t _kioapic_read(kioapic_t *ioapic, uint32_t reg) {
+    ioapic->regs[IOAPIC_REGSEL / 4] = reg;
+    return ioapic->regs[IOAPIC_WINDOW / 4];
+}
+
+static void _kioapic_write(kioapic_t *ioapic, uint32_t reg, uint32_t value) {
+    ioapic->regs[IOAPIC_REGSEL / 4] = reg;
+    ioapic->regs[IOAPIC_WINDOW / 4] = value;
+}
+
+static kioapic_t *_kioapic_find(uint32_t gsi, uint32_t *pin) {
+    for (uint32_t i = 0; i < ioapic_count; i++) {
+        kioapic_t *ioapic = &ioapics[i];
+        if (gsi >= ioapic->gsi_base && gsi - ioapic->gsi_base < ioapic->gsi_count) {
+            *pin = gsi - ioapic->gsi_base;
+            return ioapic;
+        }
+    }
+    return NULL;
+}
+
+bool kioapic_init(const kacpi_madt_t *madt) {
+    for (uint32_t i = 0; i < madt->ioapic_count; i++) {
+        const kacpi_ioapic_t *entry = &madt->ioapics[i];
+        if (!kvmm_identity_map(entry->address, KPAGE_SIZE, KVMM_FLAG_WRITE | KVMM_FLAG_NOCACHE))
+            continue;
+
+        kioapic_t *ioapic = &ioapics[ioapic_count++];
+        ioapic->regs = (volatile uint32_t *)(uintptr_t)entry->address;
+        ioapic->gsi_base = entry->gsi_base;
+
+        uint32_t flags = ksave_interrupts();
+        ioapic->gsi_count = ((_kioapic_read(ioapic, IOAPIC_VERSION) >> 16) & 0xFF) + 1;
+        // firmware may leave entries enabled, nothing is delivered until a driver asks for it
+        for (uint32_t pin = 0; pin < ioapic->gsi_count; pin++) {
+            _kioapic_write(ioapic, IOAPIC_REDTBL + pin * 2, REDTBL_MASKED);
+            _kioapic_write(ioapic, IOAPIC_REDTBL + pin * 2 + 1, 0);
+        }
+        krestore_interrupts(flags);
+    }
+    return ioapic_count != 0;
+}
+
+uint32_t kioapic_get_gsi_count(void) {
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < ioapic_count; i++)
+        count += ioapics[i].gsi_count;
+    return count;
+}
+
+bool kioapic_route(uint32_t gsi, uint8_t vector, uint8_t apic_id, uint16_t flags) {
+    uint32_t pin;
+    kioapic_t *ioapic = _kioapic_find(gsi, &pin);
+    if (!ioapic)
+        return false;
+
+    // bus default for ISA interrupts is edge triggered and active high
+    uint32_t low = REDTBL_MASKED | vector;
+    if ((flags & KACPI_IRQ_POLARITY_MASK) == KACPI_IRQ_ACTIVE_LOW)
+        low |= REDTBL_ACTIVE_LOW;
+    if ((flags & KACPI_IRQ_TRIGGER_MASK) == KACPI_IRQ_LEVEL)
+        low |= REDTBL_LEVEL;
+
+    uint32_t irq_flags = ksave_interrupts();
+    _kioapic_write(ioapic, IOAPIC_REDTBL + pin * 2 + 1, (uint32_t)apic_id << 24);
+    _kioapic_write(ioapic, IOAPIC_REDTBL + pin * 2, low);
+    krestore_interrupts(irq_flags);
+    return true;
+}
+
+static void _kioapic_set_masked(uint32_t gsi, bool masked) {
+    uint32_t pin;
+    kioapic_t *ioapic = _kioapic_find(gsi, &pin);
+    if (!ioapic)
+        return;
+
+    uint32_t flags = ksave_interrupts();
+    uint32_t low = _kioapic_read(ioapic, IOAPIC_REDTBL + pin * 2);
+    low = masked ? low | REDTBL_MASKED : low & ~REDTBL_MASKED;
+    _kioapic_write(ioapic, IOAPIC_REDTBL + pin * 2, low);
+    krestore_interrupts(flags);
+}
+
+void kioapic_mask(uint32_t gsi) {
+    _kioapic_set_masked(gsi, true);
+}
+
+void kioapic_unmask(uint32_t gsi) {
+    _kioapic_set_masked(gsi, false);
+}
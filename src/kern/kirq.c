@@ -0,0 +1,185 @@
+#include <agave/kirq.h>
+#include <agave/kirqlat.h>
+#include <agave/kioapic.h>
+#include <agave/klapic.h>
+#include <agave/kacpi.h>
+#include <agave/idt.h>
+#include <agave/pic.h>
+#include <agave/kcpu.h>
+#include <agave/kcore.h>
+#include <agave/klock.h>
+#include <agave/ksoftirq.h>
+#include <agave/kthread.h>
+#include <agave/kutils.h>
+#include <stddef.h>
+
+#define KIRQ_EXCEPTION_COUNT 32
+#define KIRQ_PAGE_FAULT      14
+
+static const char *exception_names[KIRQ_EXCEPTION_COUNT] = {
+    "divide error", "debug", "non-maskable interrupt", "breakpoint",
+    "overflow", "bound range exceeded", "invalid opcode", "device not available",
+    "double fault", "coprocessor segment overrun", "invalid TSS", "segment not present",
+    "stack-segment fault", "general protection fault", "page fault", "reserved",
+    "x87 floating-point exception", "alignment check", "machine check", "SIMD floating-point exception",
+    "virtualization exception", "control protection exception", "reserved", "reserved",
+    "reserved", "reserved", "reserved", "reserved",
+    "hypervisor injection exception", "VMM communication exception", "security exception", "reserved",
+};
+
+static kirq_handler_t handler_pool[KIRQ_MAX_HANDLERS];
+static uint32_t handler_count = 0;
+static kirq_handler_t *handlers[IDT_MAX_DESCRIPTORS];
+static kirq_stats_t stats[IDT_MAX_DESCRIPTORS];
+static kspinlock_t handlers_lock = KSPINLOCK_INIT("irq handlers");
+
+static bool use_apic = false;
+static uint16_t enabled_irqs = 0;
+static uint32_t irq_gsi[IRQ_COUNT];
+static uint16_t irq_flags[IRQ_COUNT];
+
+// ISA IRQs map to the GSI of the same number unless the MADT overrides them
+static void _kirq_apply_overrides(const kacpi_madt_t *madt) {
+    for (uint32_t irq = 0; irq < IRQ_COUNT; irq++) {
+        irq_gsi[irq] = irq;
+        irq_flags[irq] = 0;
+    }
+    for (uint32_t i = 0; i < madt->override_count; i++) {
+        const kacpi_override_t *override = &madt->overrides[i];
+        if (override->source < IRQ_COUNT) {
+            irq_gsi[override->source] = override->gsi;
+            irq_flags[override->source] = override->flags;
+        }
+    }
+}
+
+void kirq_init(void) {
+    const kacpi_madt_t *madt = kacpi_madt();
+    if (!madt || !klapic_available() || !kioapic_init(madt))
+        return;
+
+    _kirq_apply_overrides(madt);
+    // every IRQ goes to the boot CPU, it is the only one running threads
+    uint8_t apic_id = (uint8_t)klapic_id();
+    for (uint32_t irq = 0; irq < IRQ_COUNT; irq++) {
+        if (!kioapic_route(irq_gsi[irq], (uint8_t)(IRQ_BASE + irq), apic_id, irq_flags[irq]))
+            continue;
+        if (enabled_irqs & (1u << irq))
+            kioapic_unmask(irq_gsi[irq]);
+    }
+
+    pic_disable();
+    use_apic = true;
+}
+
+bool kirq_uses_apic(void) {
+    return use_apic;
+}
+
+const char *kirq_controller_name(void) {
+    return use_apic ? "ioapic" : "8259";
+}
+
+void kirq_unmask(uint8_t irq) {
+    enabled_irqs |= 1u << irq;
+    if (use_apic)
+        kioapic_unmask(irq_gsi[irq]);
+    else
+        pic_unmask_irq(irq);
+}
+
+void kirq_mask(uint8_t irq) {
+    enabled_irqs &= ~(1u << irq);
+    if (use_apic)
+        kioapic_mask(irq_gsi[irq]);
+    else
+        pic_mask_irq(irq);
+}
+
+void kirq_eoi(uint8_t irq) {
+    if (use_apic)
+        klapic_eoi();
+    else
+        pic_send_eoi(irq);
+}
+
+bool kirq_register_vector(uint8_t vector, const char *name, kirq_handler_fn fn, void *data) {
+    uint32_t flags = kspin_lock_irqsave(&handlers_lock);
+    if (handler_count == KIRQ_MAX_HANDLERS) {
+        kspin_unlock_irqrestore(&handlers_lock, flags);
+        return false;
+    }
+
+    kirq_handler_t *handler = &handler_pool[handler_count++];
+    handler->fn = fn;
+    handler->data = data;
+    handler->name = name;
+    handler->next = NULL;
+
+    // other CPUs walk the list without the lock, the handler is linked once it is complete
+    kirq_handler_t **link = &handlers[vector];
+    while (*link)
+        link = &(*link)->next;
+    __atomic_store_n(link, handler, __ATOMIC_RELEASE);
+    kspin_unlock_irqrestore(&handlers_lock, flags);
+    return true;
+}
+
+bool kirq_register(uint8_t irq, const char *name, kirq_handler_fn fn, void *data) {
+    if (irq >= IRQ_COUNT || !kirq_register_vector(IRQ_BASE + irq, name, fn, data))
+        return false;
+    kirq_unmask(irq);
+    return true;
+}
+
+NORETURN static void _kirq_exception(kirq_frame_t *frame) {
+    uint32_t cr2 = 0;
+    if (frame->vector == KIRQ_PAGE_FAULT)
+        __asm__ volatile("mov %%cr2, %0" : "=r"(cr2));
+    kpanic("%s (vector %u, error 0x%x) at eip 0x%x, cr2 0x%x, cpu %u",
+           exception_names[frame->vector], frame->vector, frame->error_code,
+           frame->eip, cr2, kcpu_this()->id);
+    __builtin_unreachable();
+}
+
+// spurious APIC interrupts and unknown vectors are not acknowledged
+static void _kirq_eoi_vector(uint32_t vector) {
+    if (vector >= IRQ_BASE && vector < IRQ_BASE + IRQ_COUNT)
+        kirq_eoi((uint8_t)(vector - IRQ_BASE));
+    else if (vector >= KIRQ_LOCAL_VECTOR_BASE && vector != KLAPIC_SPURIOUS_VECTOR)
+        klapic_eoi();
+}
+
+void kirq_dispatch(kirq_frame_t *frame) {
+    uint32_t vector = frame->vector;
+    kirqlat_irq_enter(frame);
+    // rdtsc faults without a TSC, handlers on such CPUs are counted but not timed
+    bool timed = kcpu_has(KCPU_FEATURE_TSC);
+    uint64_t start = timed ? kcpu_rdtsc() : 0;
+
+    kirq_handler_t *handler = __atomic_load_n(&handlers[vector], __ATOMIC_ACQUIRE);
+    if (!handler && vector < KIRQ_EXCEPTION_COUNT)
+        _kirq_exception(frame);
+    for (; handler; handler = __atomic_load_n(&handler->next, __ATOMIC_ACQUIRE))
+        handler->fn(frame, handler->data);
+    _kirq_eoi_vector(vector);
+
+    uint64_t cycles = timed ? kcpu_rdtsc() - start : 0;
+    __atomic_add_fetch(&stats[vector].count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&stats[vector].cycles, cycles, __ATOMIC_RELAXED);
+
+    // softirqs and threads only run on the boot CPU, the others just go back to their worker loop
+    if (kcpu_this()->id == 0) {
+        ksoftirq_irq_exit();
+        kthread_irq_exit();
+    }
+    kirqlat_irq_exit(frame, cycles);
+}
+
+const kirq_handler_t *kirq_get_handlers(uint8_t vector) {
+    return handlers[vector];
+}
+
+const kirq_stats_t *kirq_get_stats(uint8_t vector) {
+    return &stats[vector];
+}
@@ -0,0 +1,148 @@
+#include <agave/kirqlat.h>
+#include <agave/kcpu.h>
+#include <agave/idt.h>
+#include <agave/kutils.h>
+#include <stddef.h>
+
+static bool tracing = false;
+static kirqlat_hist_t irqs_off;
+static kirqlat_hist_t handlers[IDT_MAX_DESCRIPTORS];
+static kirqlat_offender_t worst[KIRQLAT_WORST];
+
+#ifdef KIRQ_TRACE
+static volatile uint32_t worst_busy = 0;
+
+static uint32_t _kirqlat_bucket(uint64_t cycles) {
+    if (cycles >> 32)
+        return KIRQLAT_BUCKETS - 1;
+    return cycles ? 31 - (uint32_t)__builtin_clz((uint32_t)cycles) : 0;
+}
+
+// every CPU records into the same histograms, so the counters are updated atomically
+static void _kirqlat_record(kirqlat_hist_t *hist, uint64_t cycles) {
+    __atomic_add_fetch(&hist->count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&hist->total_cycles, cycles, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&hist->buckets[_kirqlat_bucket(cycles)], 1, __ATOMIC_RELAXED);
+
+    uint64_t max = __atomic_load_n(&hist->max_cycles, __ATOMIC_RELAXED);
+    while (cycles > max && !__atomic_compare_exchange_n(&hist->max_cycles, &max, cycles, true,
+                                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+        ;
+}
+
+// a plain flag, the hooks run from inside the interrupt helpers that the locks use
+static void _kirqlat_offender(uint32_t site, uint32_t cpu, uint64_t cycles) {
+    if (cycles <= worst[KIRQLAT_WORST - 1].cycles)
+        return;
+
+    while (__atomic_exchange_n(&worst_busy, 1, __ATOMIC_ACQUIRE))
+        kcpu_pause();
+
+    // one entry per site, a new site replaces the shortest entry
+    uint32_t i = 0;
+    while (i < KIRQLAT_WORST - 1 && worst[i].site != site)
+        i++;
+    if (cycles > worst[i].cycles) {
+        while (i > 0 && worst[i - 1].cycles < cycles) {
+            worst[i] = worst[i - 1];
+            i--;
+        }
+        worst[i].site = site;
+        worst[i].cpu = cpu;
+        worst[i].cycles = cycles;
+    }
+
+    __atomic_store_n(&worst_busy, 0, __ATOMIC_RELEASE);
+}
+
+void kirqlat_irqs_off(uint32_t site) {
+    if (!tracing)
+        return;
+
+    kcpu_local_t *cpu = kcpu_this();
+    if (cpu->irqoff_open)
+        return;
+    cpu->irqoff_site = site;
+    cpu->irqoff_start = kcpu_rdtsc();
+    cpu->irqoff_open = true;
+}
+
+void kirqlat_irqs_on(void) {
+    if (!tracing)
+        return;
+
+    kcpu_local_t *cpu = kcpu_this();
+    if (!cpu->irqoff_open)
+        return;
+    cpu->irqoff_open = false;
+
+    uint64_t cycles = kcpu_rdtsc() - cpu->irqoff_start;
+    _kirqlat_record(&irqs_off, cycles);
+    _kirqlat_offender(cpu->irqoff_site, cpu->id, cycles);
+}
+
+// the CPU cleared the flag on entry, that only starts a section if the interrupted code had it set
+void kirqlat_irq_enter(const kirq_frame_t *frame) {
+    if (frame->eflags & EFLAGS_IF)
+        kirqlat_irqs_off(frame->vector);
+}
+
+/*
+ * After a thread switch in kthread_irq_exit the section may have been closed
+ * by the thread that ran meanwhile, or opened by another one, either way it
+ * ends here because iret sets the flag again.
+ */
+void kirqlat_irq_exit(const kirq_frame_t *frame, uint64_t handler_cycles) {
+    if (!tracing)
+        return;
+
+    _kirqlat_record(&handlers[frame->vector], handler_cycles);
+    if (frame->eflags & EFLAGS_IF)
+        kirqlat_irqs_on();
+}
+#endif // KIRQ_TRACE
+
+void kirqlat_init(void) {
+#ifdef KIRQ_TRACE
+    // every measurement is a pair of rdtsc reads, which fault on CPUs without a TSC
+    tracing = kcpu_has(KCPU_FEATURE_TSC);
+#endif
+}
+
+bool kirqlat_enabled(void) {
+    return tracing;
+}
+
+static void _kirqlat_clear(kirqlat_hist_t *hist) {
+    hist->count = 0;
+    hist->total_cycles = 0;
+    hist->max_cycles = 0;
+    for (uint32_t i = 0; i < KIRQLAT_BUCKETS; i++)
+        hist->buckets[i] = 0;
+}
+
+// other CPUs may record while this runs, a reset is only approximate
+void kirqlat_reset(void) {
+    uint32_t flags = ksave_interrupts();
+    _kirqlat_clear(&irqs_off);
+    for (uint32_t vector = 0; vector < IDT_MAX_DESCRIPTORS; vector++)
+        _kirqlat_clear(&handlers[vector]);
+    for (uint32_t i = 0; i < KIRQLAT_WORST; i++) {
+        worst[i].site = 0;
+        worst[i].cpu = 0;
+        worst[i].cycles = 0;
+    }
+    krestore_interrupts(flags);
+}
+
+const kirqlat_hist_t *kirqlat_irqs_off_hist(void) {
+    return &irqs_off;
+}
+
+const kirqlat_hist_t *kirqlat_handler_hist(uint8_t vector) {
+    return &handlers[vector];
+}
+
+const kirqlat_offender_t *kirqlat_worst(void) {
+    return worst;
+}
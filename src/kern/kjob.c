@@ -0,0 +1,212 @@
+#include <agave/kjob.h>
+#include <agave/kcpu.h>
+#include <agave/kthread.h>
+#include <agave/kutils.h>
+#include <stdbool.h>
+
+// ranges are halved at most this many times per job, deeper splits come from the spawned halves
+#define KJOB_SPLIT_DEPTH 16
+
+/*
+ * Chase-Lev deques, one per CPU. The owner pushes and pops at the bottom
+ * without a lock, other CPUs steal from the top with a compare-and-swap,
+ * and only the last job is contended between the owner and a thief. On the
+ * boot CPU several threads share the deque, so its owner side runs with
+ * preemption disabled.
+ */
+typedef struct {
+    volatile uint32_t top;
+    volatile uint32_t bottom;
+    kjob_t *volatile slots[KJOB_DEQUE_SIZE];
+} kjob_deque_t;
+
+typedef struct {
+    kjob_range_fn fn;
+    void *ctx;
+    size_t grain;
+    size_t begin;
+    size_t end;
+} kjob_range_t;
+
+static kjob_deque_t deques[KCPU_MAX];
+
+static bool _kjob_push(kjob_deque_t *deque, kjob_t *job) {
+    uint32_t bottom = deque->bottom;
+    uint32_t top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    if (bottom - top >= KJOB_DEQUE_SIZE)
+        return false;
+
+    deque->slots[bottom & (KJOB_DEQUE_SIZE - 1)] = job;
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+static kjob_t *_kjob_pop(kjob_deque_t *deque) {
+    uint32_t bottom = deque->bottom - 1;
+    __atomic_store_n(&deque->bottom, bottom, __ATOMIC_RELAXED);
+    // the store to bottom has to be visible before top is read, or a thief could take the same job
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    uint32_t top = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+
+    if ((int32_t)(bottom - top) < 0) {
+        deque->bottom = bottom + 1;
+        return NULL;
+    }
+
+    kjob_t *job = deque->slots[bottom & (KJOB_DEQUE_SIZE - 1)];
+    if (bottom == top) {
+        if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, false,
+                                         __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+            job = NULL;
+        deque->bottom = bottom + 1;
+    }
+    return job;
+}
+
+static kjob_t *_kjob_steal(kjob_deque_t *deque) {
+    uint32_t top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    uint32_t bottom = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+    if ((int32_t)(bottom - top) <= 0)
+        return NULL;
+
+    kjob_t *job = deque->slots[top & (KJOB_DEQUE_SIZE - 1)];
+    if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, false,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED))
+        return NULL;
+    return job;
+}
+
+static bool _kjob_available(void) {
+    uint32_t count = kcpu_get_cpu_count();
+    for (uint32_t i = 0; i < count; i++) {
+        if ((int32_t)(deques[i].bottom - deques[i].top) > 0)
+            return true;
+    }
+    return false;
+}
+
+// own deque first, then the others starting after our own index so thieves spread out
+static kjob_t *_kjob_find(kcpu_local_t *cpu, bool *stolen) {
+    kthread_preempt_disable();
+    kjob_t *job = _kjob_pop(&deques[cpu->id]);
+    kthread_preempt_enable();
+    *stolen = false;
+    if (job)
+        return job;
+
+    uint32_t count = kcpu_get_cpu_count();
+    for (uint32_t i = 1; i < count; i++) {
+        job = _kjob_steal(&deques[(cpu->id + i) % count]);
+        if (job) {
+            *stolen = true;
+            return job;
+        }
+    }
+    return NULL;
+}
+
+static void _kjob_run(kcpu_local_t *cpu, kjob_t *job, bool stolen) {
+    // the storage belongs to the waiter and may be gone once the count drops
+    kjob_group_t *group = job->group;
+    job->fn(job->data);
+
+    cpu->jobs_run++;
+    if (stolen)
+        cpu->jobs_stolen++;
+    __atomic_sub_fetch(&group->pending, 1, __ATOMIC_RELEASE);
+}
+
+static void _kjob_wake_one(kcpu_local_t *self) {
+    // pairs with the fence in kjob_worker_loop, either we see the sleeper or it sees the job
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    uint32_t count = kcpu_get_cpu_count();
+    for (uint32_t i = 1; i < count; i++) {
+        kcpu_local_t *cpu = kcpu_get((self->id + i) % count);
+        if (cpu->sleeping) {
+            kcpu_wake(cpu);
+            return;
+        }
+    }
+}
+
+void kjob_spawn(kjob_group_t *group, kjob_t *job, kjob_fn fn, void *data) {
+    job->fn = fn;
+    job->data = data;
+    job->group = group;
+    __atomic_add_fetch(&group->pending, 1, __ATOMIC_RELAXED);
+
+    kcpu_local_t *cpu = kcpu_this();
+    kthread_preempt_disable();
+    bool queued = _kjob_push(&deques[cpu->id], job);
+    kthread_preempt_enable();
+
+    if (queued)
+        _kjob_wake_one(cpu);
+    else
+        _kjob_run(cpu, job, false);
+}
+
+void kjob_wait(kjob_group_t *group) {
+    kcpu_local_t *cpu = kcpu_this();
+    while (__atomic_load_n(&group->pending, __ATOMIC_ACQUIRE)) {
+        bool stolen;
+        kjob_t *job = _kjob_find(cpu, &stolen);
+        if (job)
+            _kjob_run(cpu, job, stolen);
+        else
+            kcpu_pause();
+    }
+}
+
+static void _kjob_range(void *data) {
+    kjob_range_t *range = data;
+    kjob_group_t group = KJOB_GROUP_INIT;
+    kjob_t jobs[KJOB_SPLIT_DEPTH];
+    kjob_range_t halves[KJOB_SPLIT_DEPTH];
+
+    // the upper halves go to other CPUs, the lowest piece runs here
+    size_t begin = range->begin, end = range->end;
+    for (size_t n = 0; end - begin > range->grain && n < KJOB_SPLIT_DEPTH; n++) {
+        size_t mid = begin + (end - begin) / 2;
+        halves[n] = *range;
+        halves[n].begin = mid;
+        halves[n].end = end;
+        kjob_spawn(&group, &jobs[n], _kjob_range, &halves[n]);
+        end = mid;
+    }
+
+    range->fn(begin, end, range->ctx);
+    kjob_wait(&group);
+}
+
+void kjob_parallel_for(size_t count, size_t grain, kjob_range_fn fn, void *ctx) {
+    if (count == 0)
+        return;
+
+    kjob_range_t range = { .fn = fn, .ctx = ctx, .grain = grain ? grain : 1, .begin = 0, .end = count };
+    _kjob_range(&range);
+}
+
+void kjob_worker_loop(void) {
+    kcpu_local_t *cpu = kcpu_this();
+    for (;;) {
+        bool stolen;
+        kjob_t *job = _kjob_find(cpu, &stolen);
+        if (job) {
+            _kjob_run(cpu, job, stolen);
+            continue;
+        }
+
+        // interrupts stay off until the hlt, so a wakeup IPI after the check is not lost
+        kdisable_interrupts();
+        __atomic_store_n(&cpu->sleeping, true, __ATOMIC_SEQ_CST);
+        if (_kjob_available()) {
+            cpu->sleeping = false;
+            kenable_interrupts();
+            continue;
+        }
+        kwait_for_interrupt();
+        cpu->sleeping = false;
+    }
+}
@@ -0,0 +1,145 @@
+#include <agave/klapic.h>
+#include <agave/kvmm.h>
+#include <agave/kpage.h>
+#include <agave/kirq.h>
+#include <agave/kcpu.h>
+#include <agave/kclock.h>
+#include <agave/ktimer.h>
+#include <agave/kutils.h>
+#include <agave/utils.h>
+#include <stddef.h>
+
+#define LAPIC_ID       0x020
+#define LAPIC_EOI      0x0B0
+#define LAPIC_SVR      0x0F0
+#define LAPIC_ICR_LOW  0x300
+#define LAPIC_ICR_HIGH 0x310
+#define LAPIC_LVT_TIMER     0x320
+#define LAPIC_TIMER_INITIAL 0x380
+#define LAPIC_TIMER_CURRENT 0x390
+#define LAPIC_TIMER_DIVIDE  0x3E0
+
+#define LAPIC_SVR_ENABLE 0x100
+
+#define ICR_FIXED          0x00000
+#define ICR_INIT           0x00500
+#define ICR_STARTUP        0x00600
+#define ICR_DELIVERY_BUSY  0x01000
+#define ICR_LEVEL_ASSERT   0x04000
+
+#define LVT_MASKED         0x10000
+#define LVT_TIMER_PERIODIC 0x20000
+
+#define TIMER_DIVIDE_16 0x3
+// the timer counts its bus clock down for this long to find its rate
+#define KLAPIC_CALIBRATE_NS 10000000
+
+static volatile uint32_t *lapic = NULL;
+
+static uint32_t timer_khz = 0;
+static kclock_conv_t ns_to_timer;
+
+static inline uint32_t _klapic_read(uint32_t reg) {
+    return lapic[reg / 4];
+}
+
+static inline void _klapic_write(uint32_t reg, uint32_t value) {
+    lapic[reg / 4] = value;
+}
+
+bool klapic_init(uint32_t base) {
+    if (!kvmm_identity_map(base, KPAGE_SIZE, KVMM_FLAG_WRITE | KVMM_FLAG_NOCACHE))
+        return false;
+
+    lapic = (volatile uint32_t *)(uintptr_t)base;
+    klapic_enable();
+    return true;
+}
+
+bool klapic_available(void) {
+    return lapic != NULL;
+}
+
+void klapic_enable(void) {
+    _klapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | KLAPIC_SPURIOUS_VECTOR);
+}
+
+uint32_t klapic_id(void) {
+    return _klapic_read(LAPIC_ID) >> 24;
+}
+
+void klapic_eoi(void) {
+    _klapic_write(LAPIC_EOI, 0);
+}
+
+static void _klapic_send(uint32_t apic_id, uint32_t command) {
+    uint32_t flags = ksave_interrupts();
+    while (_klapic_read(LAPIC_ICR_LOW) & ICR_DELIVERY_BUSY)
+        kcpu_pause();
+    // the write to the low half sends the IPI, so the destination goes first
+    _klapic_write(LAPIC_ICR_HIGH, apic_id << 24);
+    _klapic_write(LAPIC_ICR_LOW, command);
+    krestore_interrupts(flags);
+}
+
+void klapic_send_ipi(uint32_t apic_id, uint8_t vector) {
+    _klapic_send(apic_id, ICR_FIXED | ICR_LEVEL_ASSERT | vector);
+}
+
+void klapic_send_init(uint32_t apic_id) {
+    _klapic_send(apic_id, ICR_INIT | ICR_LEVEL_ASSERT);
+}
+
+void klapic_send_startup(uint32_t apic_id, uint8_t page) {
+    _klapic_send(apic_id, ICR_STARTUP | ICR_LEVEL_ASSERT | page);
+}
+
+static void _klapic_timer_interrupt(UNUSED kirq_frame_t *frame, UNUSED void *data) {
+    ktimer_interrupt();
+}
+
+bool klapic_timer_init(void) {
+    if (!lapic)
+        return false;
+
+    uint32_t flags = ksave_interrupts();
+    _klapic_write(LAPIC_TIMER_DIVIDE, TIMER_DIVIDE_16);
+    _klapic_write(LAPIC_LVT_TIMER, LVT_MASKED | KLAPIC_TIMER_VECTOR);
+    _klapic_write(LAPIC_TIMER_INITIAL, 0xFFFFFFFF);
+    kclock_delay_ns(KLAPIC_CALIBRATE_NS);
+    uint32_t elapsed = 0xFFFFFFFF - _klapic_read(LAPIC_TIMER_CURRENT);
+    _klapic_write(LAPIC_TIMER_INITIAL, 0);
+    krestore_interrupts(flags);
+
+    timer_khz = elapsed / (KLAPIC_CALIBRATE_NS / 1000000);
+    if (!timer_khz)
+        return false;
+
+    kclock_conv_init(&ns_to_timer, timer_khz, 1000000);
+    return kirq_register_vector(KLAPIC_TIMER_VECTOR, "lapic timer", _klapic_timer_interrupt, NULL);
+}
+
+uint32_t klapic_timer_khz(void) {
+    return timer_khz;
+}
+
+void klapic_timer_periodic(uint32_t frequency_hz) {
+    uint32_t count = (uint32_t)kdiv_u64_u32((uint64_t)timer_khz * 1000, frequency_hz, NULL);
+    _klapic_write(LAPIC_LVT_TIMER, LVT_TIMER_PERIODIC | KLAPIC_TIMER_VECTOR);
+    _klapic_write(LAPIC_TIMER_INITIAL, count ? count : 1);
+}
+
+void klapic_timer_oneshot(uint64_t nanoseconds) {
+    uint64_t count = kclock_convert(&ns_to_timer, nanoseconds);
+    if (count == 0)
+        count = 1;
+    if (count > 0xFFFFFFFF)
+        count = 0xFFFFFFFF;
+    _klapic_write(LAPIC_LVT_TIMER, KLAPIC_TIMER_VECTOR);
+    _klapic_write(LAPIC_TIMER_INITIAL, (uint32_t)count);
+}
+
+void klapic_timer_stop(void) {
+    // an initial count of zero stops the countdown without raising an interrupt
+    _klapic_write(LAPIC_TIMER_INITIAL, 0);
+}
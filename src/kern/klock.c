@@ -0,0 +1,216 @@
+#include <agave/klock.h>
+#include <agave/kthread.h>
+#include <agave/kclock.h>
+#include <agave/kcpu.h>
+#include <agave/kutils.h>
+#include <stddef.h>
+
+#ifdef KLOCK_STATS
+static klock_stats_t *registry = NULL;
+static volatile uint32_t registry_busy = 0;
+
+// a plain flag, the registry cannot use a lock that registers itself
+static void _klock_register(klock_stats_t *stats) {
+    uint32_t flags = ksave_interrupts();
+    while (__atomic_exchange_n(&registry_busy, 1, __ATOMIC_ACQUIRE))
+        kcpu_pause();
+    if (!stats->registered) {
+        stats->next = registry;
+        registry = stats;
+        stats->registered = true;
+    }
+    __atomic_store_n(&registry_busy, 0, __ATOMIC_RELEASE);
+    krestore_interrupts(flags);
+}
+
+// runs with the lock held, readers share it so the counters are updated atomically
+static void _klock_acquired(klock_stats_t *stats, uint32_t spins, bool exclusive) {
+    if (!stats->registered)
+        _klock_register(stats);
+
+    __atomic_add_fetch(&stats->acquisitions, 1, __ATOMIC_RELAXED);
+    if (spins) {
+        __atomic_add_fetch(&stats->contended, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&stats->spins, spins, __ATOMIC_RELAXED);
+    }
+    if (exclusive)
+        stats->acquired_ns = kclock_ns();
+}
+
+static void _klock_released(klock_stats_t *stats) {
+    uint64_t held = kclock_ns() - stats->acquired_ns;
+    if (held > stats->max_hold_ns)
+        stats->max_hold_ns = held;
+}
+#else
+#define _klock_acquired(stats, spins, exclusive) ((void)(spins))
+#define _klock_released(stats) ((void)0)
+#endif // KLOCK_STATS
+
+static void _klock_stats_init(klock_stats_t *stats, const char *name) {
+    stats->name = name;
+    stats->acquisitions = 0;
+    stats->contended = 0;
+    stats->spins = 0;
+    stats->max_hold_ns = 0;
+    stats->acquired_ns = 0;
+    stats->registered = false;
+    stats->next = NULL;
+}
+
+void kspin_init(kspinlock_t *lock, const char *name) {
+    lock->next = 0;
+    lock->owner = 0;
+    _klock_stats_init(&lock->stats, name);
+}
+
+static void _kspin_acquire(kspinlock_t *lock) {
+    uint16_t ticket = __atomic_fetch_add(&lock->next, 1, __ATOMIC_RELAXED);
+    uint32_t spins = 0;
+    while (__atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE) != ticket) {
+        kcpu_pause();
+        spins++;
+    }
+    _klock_acquired(&lock->stats, spins, true);
+}
+
+static void _kspin_release(kspinlock_t *lock) {
+    _klock_released(&lock->stats);
+    // only the holder writes owner, so a plain increment is enough
+    __atomic_store_n(&lock->owner, (uint16_t)(lock->owner + 1), __ATOMIC_RELEASE);
+}
+
+void kspin_lock(kspinlock_t *lock) {
+    kthread_preempt_disable();
+    _kspin_acquire(lock);
+}
+
+bool kspin_trylock(kspinlock_t *lock) {
+    kthread_preempt_disable();
+    // the lock is free when the next ticket is the one being served, take it only then
+    uint16_t owner = __atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE);
+    uint16_t expected = owner;
+    if (!__atomic_compare_exchange_n(&lock->next, &expected, (uint16_t)(owner + 1), false,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        kthread_preempt_enable();
+        return false;
+    }
+    _klock_acquired(&lock->stats, 0, true);
+    return true;
+}
+
+void kspin_unlock(kspinlock_t *lock) {
+    _kspin_release(lock);
+    kthread_preempt_enable();
+}
+
+uint32_t kspin_lock_irqsave(kspinlock_t *lock) {
+    uint32_t flags = ksave_interrupts();
+    kthread_preempt_disable();
+    _kspin_acquire(lock);
+    return flags;
+}
+
+void kspin_unlock_irqrestore(kspinlock_t *lock, uint32_t flags) {
+    _kspin_release(lock);
+    krestore_interrupts(flags);
+    kthread_preempt_enable();
+}
+
+void krw_init(krwlock_t *lock, const char *name) {
+    lock->state = 0;
+    lock->writers_waiting = 0;
+    _klock_stats_init(&lock->stats, name);
+}
+
+static void _krw_read_acquire(krwlock_t *lock) {
+    uint32_t spins = 0;
+    for (;;) {
+        int32_t state = __atomic_load_n(&lock->state, __ATOMIC_RELAXED);
+        if (state >= 0 && !__atomic_load_n(&lock->writers_waiting, __ATOMIC_RELAXED) &&
+            __atomic_compare_exchange_n(&lock->state, &state, state + 1, false,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+        kcpu_pause();
+        spins++;
+    }
+    _klock_acquired(&lock->stats, spins, false);
+}
+
+static void _krw_read_release(krwlock_t *lock) {
+    __atomic_sub_fetch(&lock->state, 1, __ATOMIC_RELEASE);
+}
+
+static void _krw_write_acquire(krwlock_t *lock) {
+    uint32_t spins = 0;
+    __atomic_add_fetch(&lock->writers_waiting, 1, __ATOMIC_RELAXED);
+    for (;;) {
+        int32_t expected = 0;
+        if (__atomic_compare_exchange_n(&lock->state, &expected, -1, false,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+        kcpu_pause();
+        spins++;
+    }
+    __atomic_sub_fetch(&lock->writers_waiting, 1, __ATOMIC_RELAXED);
+    _klock_acquired(&lock->stats, spins, true);
+}
+
+static void _krw_write_release(krwlock_t *lock) {
+    _klock_released(&lock->stats);
+    __atomic_store_n(&lock->state, 0, __ATOMIC_RELEASE);
+}
+
+void krw_read_lock(krwlock_t *lock) {
+    kthread_preempt_disable();
+    _krw_read_acquire(lock);
+}
+
+void krw_read_unlock(krwlock_t *lock) {
+    _krw_read_release(lock);
+    kthread_preempt_enable();
+}
+
+void krw_write_lock(krwlock_t *lock) {
+    kthread_preempt_disable();
+    _krw_write_acquire(lock);
+}
+
+void krw_write_unlock(krwlock_t *lock) {
+    _krw_write_release(lock);
+    kthread_preempt_enable();
+}
+
+uint32_t krw_read_lock_irqsave(krwlock_t *lock) {
+    uint32_t flags = ksave_interrupts();
+    kthread_preempt_disable();
+    _krw_read_acquire(lock);
+    return flags;
+}
+
+void krw_read_unlock_irqrestore(krwlock_t *lock, uint32_t flags) {
+    _krw_read_release(lock);
+    krestore_interrupts(flags);
+    kthread_preempt_enable();
+}
+
+uint32_t krw_write_lock_irqsave(krwlock_t *lock) {
+    uint32_t flags = ksave_interrupts();
+    kthread_preempt_disable();
+    _krw_write_acquire(lock);
+    return flags;
+}
+
+void krw_write_unlock_irqrestore(krwlock_t *lock, uint32_t flags) {
+    _krw_write_release(lock);
+    krestore_interrupts(flags);
+    kthread_preempt_enable();
+}
+
+const klock_stats_t *klock_stats_first(void) {
+#ifdef KLOCK_STATS
+    return registry;
+#else
+    return NULL;
+#endif
+}
@@ -1,77 +1,180 @@
 #include <agave/kmem.h>
-
-extern uint8_t _end;
-#define HEAP_START ((uintptr_t)&_end)
+#include <agave/kcore.h>
+#include <agave/kpage.h>
+#include <agave/kslab.h>
+#include <agave/klock.h>
 
 #ifndef HEAP_SIZE
-#define HEAP_SIZE 0x4000000 // 64 MB
+#define HEAP_SIZE 0x400000 // initial size and minimum growth step
 #endif
 
-static block_header_t *heap_start = (block_header_t*)HEAP_START;
+// room for the region's first block header, its end marker and alignment
+#define KHEAP_REGION_OVERHEAD 64
+
+static kmem_tag_stats_t tag_stats[KMEM_TAG_COUNT] = {
+    [KMEM_TAG_MISC]    = { .name = "misc" },
+    [KMEM_TAG_SLAB]    = { .name = "slab" },
+    [KMEM_TAG_VMM]     = { .name = "vmm" },
+    [KMEM_TAG_FS]      = { .name = "fs" },
+    [KMEM_TAG_RAMFS]   = { .name = "ramfs" },
+    [KMEM_TAG_COMMAND] = { .name = "command" },
+    [KMEM_TAG_SCRATCH] = { .name = "scratch" },
+    [KMEM_TAG_THREAD]  = { .name = "thread" },
+};
+
+static size_t heap_regions = 0;
+static size_t heap_bytes = 0;
+
+// interrupt handlers may allocate, so both locks are taken with interrupts disabled
+static kspinlock_t heap_lock = KSPINLOCK_INIT("heap");
+static kspinlock_t stats_lock = KSPINLOCK_INIT("kmem stats");
+
+static bool kheap_add_pages(uint32_t order) {
+    void *region = kpage_alloc(order);
+    if (!region) return false;
+
+    kheap_add_region(region, (size_t)KPAGE_SIZE << order);
+    heap_regions++;
+    heap_bytes += (size_t)KPAGE_SIZE << order;
+    return true;
+}
 
 void kheap_init(void) {
-    heap_start->size = HEAP_SIZE - sizeof(block_header_t);
-    heap_start->free = true;
-    heap_start->next = NULL;
+    if (!kheap_add_pages(kpage_order_for(HEAP_SIZE)))
+        kpanic("unable to allocate the initial %u byte heap", HEAP_SIZE);
+}
+
+bool kheap_grow(size_t size) {
+    uint32_t order = kpage_order_for(size + KHEAP_REGION_OVERHEAD);
+    if (((size_t)KPAGE_SIZE << order) < size + KHEAP_REGION_OVERHEAD) return false;
+
+    uint32_t min_order = kpage_order_for(HEAP_SIZE);
+    return kheap_add_pages(order > min_order ? order : min_order);
+}
+
+uint32_t kheap_lock(void) {
+    return kspin_lock_irqsave(&heap_lock);
+}
+
+void kheap_unlock(uint32_t flags) {
+    kspin_unlock_irqrestore(&heap_lock, flags);
+}
+
+void kmem_stats_alloc(kmem_tag_t tag, size_t bytes) {
+    kmem_tag_stats_t *stats = &tag_stats[tag];
+    uint32_t flags = kspin_lock_irqsave(&stats_lock);
+    stats->live_bytes += bytes;
+    stats->live_allocs++;
+    stats->total_allocs++;
+    if (stats->live_bytes > stats->peak_bytes)
+        stats->peak_bytes = stats->live_bytes;
+    kspin_unlock_irqrestore(&stats_lock, flags);
+}
+
+void kmem_stats_free(kmem_tag_t tag, size_t bytes) {
+    kmem_tag_stats_t *stats = &tag_stats[tag];
+    uint32_t flags = kspin_lock_irqsave(&stats_lock);
+    stats->live_bytes -= bytes;
+    stats->live_allocs--;
+    kspin_unlock_irqrestore(&stats_lock, flags);
+}
+
+const kmem_tag_stats_t *kmem_get_tag_stats(kmem_tag_t tag) {
+    return tag < KMEM_TAG_COUNT ? &tag_stats[tag] : NULL;
+}
+
+static void _kmem_count_free_block(size_t size, void *ctx) {
+    kmem_heap_info_t *info = ctx;
+    info->free_bytes += size;
+    info->free_blocks++;
+    if (size > info->largest_free)
+        info->largest_free = size;
+
+    size_t bucket = 0;
+    while (bucket + 1 < KMEM_HISTOGRAM_BUCKETS && size >= ((size_t)32 << bucket))
+        bucket++;
+    info->histogram[bucket]++;
 }
 
-void kmemcpy(void* dest, const void* src, size_t n) {
-    unsigned char *d = dest;
-    const unsigned char *s = src;
-    for (size_t i = 0; i < n; i++) d[i] = s[i];
+void kmem_get_heap_info(kmem_heap_info_t *info) {
+    kmemset(info, 0, sizeof(kmem_heap_info_t));
+    uint32_t flags = kspin_lock_irqsave(&heap_lock);
+    info->region_count = heap_regions;
+    info->total_bytes = heap_bytes;
+    kheap_walk_free(_kmem_count_free_block, info);
+    kspin_unlock_irqrestore(&heap_lock, flags);
 }
 
-static void coalesce_next(block_header_t *block) {
-    if (block->next && block->next->free) {
-        block->size += sizeof(block_header_t) + block->next->size;
-        block->next = block->next->next;
+void* kmalloc_tagged(size_t size, kmem_tag_t tag) {
+    if (size <= KSLAB_MAX_SIZE)
+        return kslab_alloc(size, tag);
+
+    uint32_t flags = kspin_lock_irqsave(&heap_lock);
+    void *ptr = kheap_alloc(size);
+    if (ptr) {
+        kheap_set_tag(ptr, tag);
+        kmem_stats_alloc(tag, kheap_block_size(ptr));
     }
-} 
+    kspin_unlock_irqrestore(&heap_lock, flags);
+    return ptr;
+}
 
 void* kmalloc(size_t size) {
-    size = (size + 7) & ~7;
-    block_header_t *curr = heap_start;
-
-    while (curr) {
-        if (curr->free && curr->size >= size) {
-            if (curr->size >= size + sizeof(block_header_t) + 8) {
-                block_header_t *new_block = (block_header_t*)((char*)curr + sizeof(block_header_t) + size);
-                new_block->size = curr->size - size - sizeof(block_header_t);
-                new_block->free = true;
-                new_block->next = curr->next;
-                curr->next = new_block;
-                curr->size = size;
-            }
-            curr->free = false;
-            return (char*)curr + sizeof(block_header_t);
-        }
-        curr = curr->next;
-    }
-    return NULL;
+    return kmalloc_tagged(size, KMEM_TAG_MISC);
 }
 
 void kfree(void* ptr) {
     if (!ptr) return;
 
-    block_header_t *block = (block_header_t*)((char*)ptr - sizeof(block_header_t));
-    block->free = true;
-    coalesce_next(block);
+    if (kslab_owns(ptr)) {
+        kslab_free(ptr);
+    } else {
+        uint32_t flags = kspin_lock_irqsave(&heap_lock);
+        kmem_stats_free(kheap_get_tag(ptr), kheap_block_size(ptr));
+        kheap_free(ptr);
+        kspin_unlock_irqrestore(&heap_lock, flags);
+    }
+}
 
-    block_header_t *curr = heap_start;
-    while (curr && curr->next != block) curr = curr->next;
-    if (curr && curr->free) coalesce_next(curr);
+static void _kmem_stats_resize(kmem_tag_t tag, size_t old_bytes, size_t new_bytes) {
+    kmem_tag_stats_t *stats = &tag_stats[tag];
+    uint32_t flags = kspin_lock_irqsave(&stats_lock);
+    stats->live_bytes = stats->live_bytes - old_bytes + new_bytes;
+    if (stats->live_bytes > stats->peak_bytes)
+        stats->peak_bytes = stats->live_bytes;
+    kspin_unlock_irqrestore(&stats_lock, flags);
 }
 
 void* krealloc(void* ptr, size_t new_size) {
     if (!ptr) return kmalloc(new_size);
     if (new_size == 0) { kfree(ptr); return NULL; }
 
-    block_header_t *block = (block_header_t*)((char*)ptr - sizeof(block_header_t));
-    if (block->size >= new_size) return ptr;
+    size_t old_size;
+    kmem_tag_t tag;
+    if (kslab_owns(ptr)) {
+        old_size = kslab_object_size(ptr);
+        tag = kslab_object_tag(ptr);
+        // keep the object unless a smaller size class would do
+        if (new_size <= old_size && (new_size > old_size / 2 || old_size == KSLAB_MIN_SIZE))
+            return ptr;
+    } else {
+        old_size = kheap_block_size(ptr);
+        tag = kheap_get_tag(ptr);
+        // only shrink when at least half the block comes back
+        if (new_size <= old_size && new_size > old_size / 2)
+            return ptr;
+        uint32_t flags = kspin_lock_irqsave(&heap_lock);
+        bool resized = kheap_resize(ptr, new_size);
+        if (resized)
+            _kmem_stats_resize(tag, old_size, kheap_block_size(ptr));
+        kspin_unlock_irqrestore(&heap_lock, flags);
+        if (resized)
+            return ptr;
+    }
 
-    void *new_ptr = kmalloc(new_size);
+    void *new_ptr = kmalloc_tagged(new_size, tag);
     if (!new_ptr) return NULL;
-    kmemcpy(new_ptr, ptr, block->size);
+    kmemcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
     kfree(ptr);
     return new_ptr;
 }
@@ -81,14 +184,6 @@ void* kcalloc(size_t num, size_t size) {
     if (num && total_size / num != size) return NULL;
 
     void *ptr = kmalloc(total_size);
-    if (ptr) {
-        unsigned char *p = ptr;
-        for (size_t i = 0; i < total_size; i++) p[i] = 0;
-    }
+    if (ptr) kmemset(ptr, 0, total_size);
     return ptr;
 }
-
-void kmemset(void* dest, int value, size_t n) {
-    unsigned char *d = dest;
-    for (size_t i = 0; i < n; i++) d[i] = (unsigned char)value;
-}
\ No newline at end of file
@@ -0,0 +1,245 @@
+#include <agave/kmemops.h>
+#include <agave/kmem.h>
+#include <agave/kcpu.h>
+#include <agave/kutils.h>
+
+// below this the SSE2 variants fall back to the string instructions
+#define KMEMOPS_SSE2_MIN_SIZE 256
+// copies this large bypass the cache so they do not evict the working set
+#define KMEMOPS_NT_MIN_SIZE   0x40000
+// overlapping moves with dest at least this far above src are copied forward in chunks
+#define KMEMOPS_MOVE_CHUNK_MIN 64
+
+/*
+ * The SSE2 variants also run in interrupt handlers, which do not save FPU
+ * state, so they save and restore the xmm registers they use. Threads get
+ * their own xmm state from the FXSAVE in the context switch.
+ */
+
+static void _kmemcpy_bytes(void *dest, const void *src, size_t n) {
+    unsigned char *d = dest;
+    const unsigned char *s = src;
+    for (size_t i = 0; i < n; i++) d[i] = s[i];
+}
+
+static void _kmemset_bytes(void *dest, int value, size_t n) {
+    unsigned char *d = dest;
+    for (size_t i = 0; i < n; i++) d[i] = (unsigned char)value;
+}
+
+static void _kmemcpy_movsd(void *dest, const void *src, size_t n) {
+    size_t dwords = n >> 2, bytes = n & 3;
+    __asm__ volatile("rep movsl" : "+D"(dest), "+S"(src), "+c"(dwords) : : "memory");
+    __asm__ volatile("rep movsb" : "+D"(dest), "+S"(src), "+c"(bytes) : : "memory");
+}
+
+static void _kmemset_stosd(void *dest, int value, size_t n) {
+    uint32_t pattern = (uint8_t)value * 0x01010101u;
+    size_t dwords = n >> 2, bytes = n & 3;
+    __asm__ volatile("rep stosl" : "+D"(dest), "+c"(dwords) : "a"(pattern) : "memory");
+    __asm__ volatile("rep stosb" : "+D"(dest), "+c"(bytes) : "a"(pattern) : "memory");
+}
+
+static void _kmemcpy_erms(void *dest, const void *src, size_t n) {
+    __asm__ volatile("rep movsb" : "+D"(dest), "+S"(src), "+c"(n) : : "memory");
+}
+
+static void _kmemset_erms(void *dest, int value, size_t n) {
+    __asm__ volatile("rep stosb" : "+D"(dest), "+c"(n) : "a"(value) : "memory");
+}
+
+/*
+ * The kernel is built without SSE code generation, so the xmm registers are
+ * only touched by these asm blocks and keep their values between them. The
+ * unaligned head and tail are covered by overlapping 16 and 64 byte moves.
+ */
+
+static void _kmemcpy_sse2(void *dest, const void *src, size_t n) {
+    if (n < KMEMOPS_SSE2_MIN_SIZE) {
+        _kmemcpy_movsd(dest, src, n);
+        return;
+    }
+
+    uint8_t saved[64];
+    unsigned char *d = dest;
+    const unsigned char *s = src;
+    __asm__ volatile("movdqu %%xmm0, 0(%[save])\n\t"
+                     "movdqu %%xmm1, 16(%[save])\n\t"
+                     "movdqu %%xmm2, 32(%[save])\n\t"
+                     "movdqu %%xmm3, 48(%[save])\n\t"
+                     "movdqu (%[s]), %%xmm0\n\t"
+                     "movdqu %%xmm0, (%[d])\n\t"
+                     :
+                     : [d] "r"(d), [s] "r"(s), [save] "r"(saved)
+                     : "memory");
+
+    size_t head = -(uintptr_t)d & 15;
+    unsigned char *d_end = d + n;
+    const unsigned char *s_end = s + n;
+    d += head;
+    s += head;
+    size_t blocks = (n - head) >> 6;
+
+#define SSE2_COPY_LOOP(store)          \
+    "1:\n\t"                           \
+    "movdqu 0(%[s]), %%xmm0\n\t"       \
+    "movdqu 16(%[s]), %%xmm1\n\t"      \
+    "movdqu 32(%[s]), %%xmm2\n\t"      \
+    "movdqu 48(%[s]), %%xmm3\n\t"      \
+    store " %%xmm0, 0(%[d])\n\t"       \
+    store " %%xmm1, 16(%[d])\n\t"      \
+    store " %%xmm2, 32(%[d])\n\t"      \
+    store " %%xmm3, 48(%[d])\n\t"      \
+    "add $64, %[s]\n\t"                \
+    "add $64, %[d]\n\t"                \
+    "dec %[n]\n\t"                     \
+    "jnz 1b\n\t"
+
+    if (n >= KMEMOPS_NT_MIN_SIZE) {
+        __asm__ volatile(SSE2_COPY_LOOP("movntdq") "sfence"
+                         : [d] "+r"(d), [s] "+r"(s), [n] "+r"(blocks) : : "memory");
+    } else {
+        __asm__ volatile(SSE2_COPY_LOOP("movdqa")
+                         : [d] "+r"(d), [s] "+r"(s), [n] "+r"(blocks) : : "memory");
+    }
+#undef SSE2_COPY_LOOP
+
+    __asm__ volatile("movdqu -64(%[s]), %%xmm0\n\t"
+                     "movdqu -48(%[s]), %%xmm1\n\t"
+                     "movdqu -32(%[s]), %%xmm2\n\t"
+                     "movdqu -16(%[s]), %%xmm3\n\t"
+                     "movdqu %%xmm0, -64(%[d])\n\t"
+                     "movdqu %%xmm1, -48(%[d])\n\t"
+                     "movdqu %%xmm2, -32(%[d])\n\t"
+                     "movdqu %%xmm3, -16(%[d])\n\t"
+                     "movdqu 0(%[save]), %%xmm0\n\t"
+                     "movdqu 16(%[save]), %%xmm1\n\t"
+                     "movdqu 32(%[save]), %%xmm2\n\t"
+                     "movdqu 48(%[save]), %%xmm3\n\t"
+                     :
+                     : [d] "r"(d_end), [s] "r"(s_end), [save] "r"(saved)
+                     : "memory");
+}
+
+static void _kmemset_sse2(void *dest, int value, size_t n) {
+    if (n < KMEMOPS_SSE2_MIN_SIZE) {
+        _kmemset_stosd(dest, value, n);
+        return;
+    }
+
+    uint8_t saved[16];
+    unsigned char *d = dest;
+    unsigned char *d_end = d + n;
+    uint32_t pattern = (uint8_t)value * 0x01010101u;
+    size_t head = -(uintptr_t)d & 15;
+    size_t blocks = (n - head) >> 6;
+
+    __asm__ volatile("movdqu %%xmm0, (%[save])\n\t"
+                     "movd %[pattern], %%xmm0\n\t"
+                     "pshufd $0, %%xmm0, %%xmm0\n\t"
+                     "movdqu %%xmm0, (%[d])\n\t"
+                     "add %[head], %[d]\n\t"
+                     "1:\n\t"
+                     "movdqa %%xmm0, 0(%[d])\n\t"
+                     "movdqa %%xmm0, 16(%[d])\n\t"
+                     "movdqa %%xmm0, 32(%[d])\n\t"
+                     "movdqa %%xmm0, 48(%[d])\n\t"
+                     "add $64, %[d]\n\t"
+                     "dec %[n]\n\t"
+                     "jnz 1b\n\t"
+                     "movdqu %%xmm0, -64(%[end])\n\t"
+                     "movdqu %%xmm0, -48(%[end])\n\t"
+                     "movdqu %%xmm0, -32(%[end])\n\t"
+                     "movdqu %%xmm0, -16(%[end])\n\t"
+                     "movdqu (%[save]), %%xmm0\n\t"
+                     : [d] "+r"(d), [n] "+r"(blocks)
+                     : [pattern] "r"(pattern), [head] "r"(head), [end] "r"(d_end), [save] "r"(saved)
+                     : "memory");
+}
+
+static const kmemops_variant_t variants[] = {
+    { "bytes", 0,                 _kmemcpy_bytes, _kmemset_bytes },
+    { "movsd", 0,                 _kmemcpy_movsd, _kmemset_stosd },
+    { "sse2",  KCPU_FEATURE_SSE2, _kmemcpy_sse2,  _kmemset_sse2  },
+    { "erms",  KCPU_FEATURE_ERMS, _kmemcpy_erms,  _kmemset_erms  },
+};
+
+#define VARIANT_COUNT (sizeof(variants) / sizeof(variants[0]))
+
+// the string instructions work on every supported CPU, so they are safe before kmemops_init
+static const kmemops_variant_t *selected = &variants[1];
+static kmemcpy_fn memcpy_impl = _kmemcpy_movsd;
+static kmemset_fn memset_impl = _kmemset_stosd;
+
+void kmemops_init(void) {
+    // later entries are preferred
+    for (size_t i = VARIANT_COUNT; i-- > 0;) {
+        if (kcpu_has(variants[i].features)) {
+            selected = &variants[i];
+            break;
+        }
+    }
+    memcpy_impl = selected->copy;
+    memset_impl = selected->set;
+}
+
+const kmemops_variant_t *kmemops_variants(size_t *count) {
+    *count = VARIANT_COUNT;
+    return variants;
+}
+
+const kmemops_variant_t *kmemops_selected(void) {
+    return selected;
+}
+
+void kmemcpy(void *dest, const void *src, size_t n) {
+    memcpy_impl(dest, src, n);
+}
+
+void kmemset(void *dest, int value, size_t n) {
+    memset_impl(dest, value, n);
+}
+
+void kmemmove(void *dest, const void *src, size_t n) {
+    if ((uintptr_t)dest - (uintptr_t)src >= n && (uintptr_t)src - (uintptr_t)dest >= n) {
+        memcpy_impl(dest, src, n);
+        return;
+    }
+
+    // overlapping, the string instructions copy one element at a time in either direction
+    if ((uintptr_t)dest < (uintptr_t)src) {
+        _kmemcpy_movsd(dest, src, n);
+        return;
+    }
+
+    /*
+     * With dest above src, chunks of the distance between them do not
+     * overlap, so they go through the selected copy starting from the end.
+     */
+    size_t distance = (uintptr_t)dest - (uintptr_t)src;
+    if (distance >= KMEMOPS_MOVE_CHUNK_MIN) {
+        while (n > distance) {
+            n -= distance;
+            memcpy_impl((unsigned char *)dest + n, (const unsigned char *)src + n, distance);
+        }
+        memcpy_impl(dest, src, n);
+        return;
+    }
+
+    // close overlaps run the string instructions backwards, interrupt handlers must not see DF set
+    unsigned char *d = (unsigned char *)dest + n - 1;
+    const unsigned char *s = (const unsigned char *)src + n - 1;
+    size_t bytes = n & 3;
+    uint32_t flags = ksave_interrupts();
+    __asm__ volatile("std\n\t"
+                     "rep movsb\n\t"
+                     "sub $3, %%esi\n\t"
+                     "sub $3, %%edi\n\t"
+                     "mov %[dwords], %%ecx\n\t"
+                     "rep movsl\n\t"
+                     "cld"
+                     : "+D"(d), "+S"(s), "+c"(bytes)
+                     : [dwords] "r"(n >> 2)
+                     : "memory");
+    krestore_interrupts(flags);
+}
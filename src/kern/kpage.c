@@ -0,0 +1,236 @@
+#include <agave/kpage.h>
+#include <agave/kcore.h>
+#include <agave/klock.h>
+#include <stdbool.h>
+
+#define KPAGE_MAX_REGIONS 32
+#define KPAGE_LOW_MEMORY  0x100000 // everything below 1 MB stays reserved
+
+extern uint8_t _end;
+
+typedef struct {
+    uint32_t start_pfn;
+    uint32_t end_pfn;
+} kpage_region_t;
+
+static kpage_t *pages = NULL;
+static size_t page_count = 0;
+
+static kpage_t *free_lists[KPAGE_MAX_ORDER + 1];
+static size_t total_pages = 0;
+static size_t free_pages = 0;
+static kspinlock_t kpage_lock = KSPINLOCK_INIT("kpage");
+
+static inline uint32_t _kpage_pfn(kpage_t *page) {
+    return (uint32_t)(page - pages);
+}
+
+static inline void *_kpage_address(kpage_t *page) {
+    return (void*)((uintptr_t)_kpage_pfn(page) << KPAGE_SHIFT);
+}
+
+static void _kpage_list_push(uint32_t order, kpage_t *page) {
+    page->order = (uint8_t)order;
+    page->flags |= KPAGE_FLAG_FREE;
+    page->prev = NULL;
+    page->next = free_lists[order];
+    if (free_lists[order])
+        free_lists[order]->prev = page;
+    free_lists[order] = page;
+}
+
+static void _kpage_list_remove(uint32_t order, kpage_t *page) {
+    if (page->prev)
+        page->prev->next = page->next;
+    else
+        free_lists[order] = page->next;
+    if (page->next)
+        page->next->prev = page->prev;
+    page->flags &= ~KPAGE_FLAG_FREE;
+}
+
+static void _kpage_free_range(uint32_t start_pfn, uint32_t end_pfn) {
+    uint32_t pfn = start_pfn;
+    while (pfn < end_pfn) {
+        uint32_t order = KPAGE_MAX_ORDER;
+        while (order > 0 && ((pfn & ((1u << order) - 1)) || pfn + (1u << order) > end_pfn))
+            order--;
+
+        for (uint32_t i = 0; i < (1u << order); i++)
+            pages[pfn + i].flags &= ~KPAGE_FLAG_RESERVED;
+
+        _kpage_list_push(order, &pages[pfn]);
+        total_pages += 1u << order;
+        free_pages += 1u << order;
+        pfn += 1u << order;
+    }
+}
+
+static size_t _kpage_read_memory_map(uint32_t magic, multiboot_info_t *mbi,
+                                     kpage_region_t *regions) {
+    if (magic != MULTIBOOT_BOOTLOADER_MAGIC || !mbi)
+        kpanic("kernel was not booted by a multiboot loader (magic 0x%x)", magic);
+
+    size_t count = 0;
+
+    if (mbi->flags & MULTIBOOT_INFO_MEM_MAP) {
+        uintptr_t entry_addr = mbi->mmap_addr;
+        uintptr_t end_addr = mbi->mmap_addr + mbi->mmap_length;
+
+        while (entry_addr < end_addr && count < KPAGE_MAX_REGIONS) {
+            multiboot_mmap_entry_t *entry = (multiboot_mmap_entry_t*)entry_addr;
+            entry_addr += entry->size + sizeof(entry->size);
+
+            if (entry->type != MULTIBOOT_MEMORY_AVAILABLE || entry->addr >= KPAGE_MEMORY_LIMIT)
+                continue;
+
+            uint64_t end = entry->addr + entry->len;
+            if (end > KPAGE_MEMORY_LIMIT)
+                end = KPAGE_MEMORY_LIMIT;
+
+            regions[count].start_pfn = (uint32_t)((entry->addr + KPAGE_SIZE - 1) >> KPAGE_SHIFT);
+            regions[count].end_pfn = (uint32_t)(end >> KPAGE_SHIFT);
+            if (regions[count].end_pfn > regions[count].start_pfn)
+                count++;
+        }
+    } else if (mbi->flags & MULTIBOOT_INFO_MEMORY) {
+        // mem_upper is the amount of memory above 1 MB in KB
+        regions[0].start_pfn = KPAGE_LOW_MEMORY >> KPAGE_SHIFT;
+        uint64_t end = KPAGE_LOW_MEMORY + (uint64_t)mbi->mem_upper * 1024u;
+        if (end > KPAGE_MEMORY_LIMIT)
+            end = KPAGE_MEMORY_LIMIT;
+        regions[0].end_pfn = (uint32_t)(end >> KPAGE_SHIFT);
+        count = 1;
+    } else {
+        kpanic("bootloader did not provide a memory map");
+    }
+
+    return count;
+}
+
+void kpage_init(uint32_t magic, multiboot_info_t *mbi) {
+    // copy the map first, the descriptor array may be placed on top of the multiboot data
+    kpage_region_t regions[KPAGE_MAX_REGIONS];
+    size_t region_count = _kpage_read_memory_map(magic, mbi, regions);
+
+    uint32_t max_pfn = 0;
+    for (size_t i = 0; i < region_count; i++) {
+        if (regions[i].end_pfn > max_pfn)
+            max_pfn = regions[i].end_pfn;
+    }
+
+    uintptr_t kernel_end = ((uintptr_t)&_end + KPAGE_SIZE - 1) & ~(uintptr_t)(KPAGE_SIZE - 1);
+    pages = (kpage_t*)kernel_end;
+    page_count = max_pfn;
+
+    uintptr_t pages_end = kernel_end + page_count * sizeof(kpage_t);
+    uint32_t first_free_pfn = (uint32_t)((pages_end + KPAGE_SIZE - 1) >> KPAGE_SHIFT);
+
+    for (size_t pfn = 0; pfn < page_count; pfn++) {
+        pages[pfn].next = NULL;
+        pages[pfn].prev = NULL;
+        pages[pfn].order = 0;
+        pages[pfn].flags = KPAGE_FLAG_RESERVED;
+    }
+
+    for (uint32_t order = 0; order <= KPAGE_MAX_ORDER; order++)
+        free_lists[order] = NULL;
+
+    for (size_t i = 0; i < region_count; i++) {
+        uint32_t start = regions[i].start_pfn;
+        if (start < first_free_pfn)
+            start = first_free_pfn;
+        if (start < regions[i].end_pfn)
+            _kpage_free_range(start, regions[i].end_pfn);
+    }
+}
+
+uint32_t kpage_order_for(size_t size) {
+    uint32_t order = 0;
+    while (order < KPAGE_MAX_ORDER && ((size_t)KPAGE_SIZE << order) < size)
+        order++;
+    return order;
+}
+
+static void *_kpage_alloc(uint32_t order) {
+    if (order > KPAGE_MAX_ORDER)
+        return NULL;
+
+    uint32_t current = order;
+    while (current <= KPAGE_MAX_ORDER && !free_lists[current])
+        current++;
+    if (current > KPAGE_MAX_ORDER)
+        return NULL;
+
+    kpage_t *page = free_lists[current];
+    _kpage_list_remove(current, page);
+
+    // hand the upper halves back until the block has the requested order
+    while (current > order) {
+        current--;
+        _kpage_list_push(current, page + (1u << current));
+    }
+
+    page->order = (uint8_t)order;
+    free_pages -= 1u << order;
+    return _kpage_address(page);
+}
+
+static void _kpage_free(void *addr, uint32_t order) {
+    kpage_t *page = kpage_of(addr);
+    if (!page || order > KPAGE_MAX_ORDER)
+        return;
+
+    free_pages += 1u << order;
+    page->flags &= ~KPAGE_FLAG_SLAB;
+
+    uint32_t pfn = _kpage_pfn(page);
+    while (order < KPAGE_MAX_ORDER) {
+        uint32_t buddy_pfn = pfn ^ (1u << order);
+        if (buddy_pfn >= page_count)
+            break;
+
+        kpage_t *buddy = &pages[buddy_pfn];
+        if (!(buddy->flags & KPAGE_FLAG_FREE) || buddy->order != order)
+            break;
+
+        _kpage_list_remove(order, buddy);
+        pfn &= ~(1u << order);
+        order++;
+    }
+
+    _kpage_list_push(order, &pages[pfn]);
+}
+
+// the heap and slab locks nest outside this one, so it has to disable interrupts as well
+void *kpage_alloc(uint32_t order) {
+    uint32_t flags = kspin_lock_irqsave(&kpage_lock);
+    void *addr = _kpage_alloc(order);
+    kspin_unlock_irqrestore(&kpage_lock, flags);
+    return addr;
+}
+
+void kpage_free(void *addr, uint32_t order) {
+    uint32_t flags = kspin_lock_irqsave(&kpage_lock);
+    _kpage_free(addr, order);
+    kspin_unlock_irqrestore(&kpage_lock, flags);
+}
+
+kpage_t *kpage_of(const void *addr) {
+    uintptr_t pfn = (uintptr_t)addr >> KPAGE_SHIFT;
+    if (!pages || pfn >= page_count)
+        return NULL;
+    return &pages[pfn];
+}
+
+uintptr_t kpage_memory_end(void) {
+    return (uintptr_t)page_count << KPAGE_SHIFT;
+}
+
+size_t kpage_total_count(void) {
+    return total_pages;
+}
+
+size_t kpage_free_count(void) {
+    return free_pages;
+}
@@ -0,0 +1,257 @@
+#include <agave/kslab.h>
+#include <agave/kmem.h>
+#include <agave/klock.h>
+#include <stdint.h>
+
+struct kslab {
+    kmem_cache_t *cache;
+    kslab_t *prev;
+    kslab_t *next;
+    void *free_list;
+    size_t in_use;
+};
+
+#define KSLAB_HEADER_SIZE ((sizeof(kslab_t) + 15) & ~15)
+
+// every slab keeps one tag byte per object between the header and the objects
+#define KSLAB_OBJECTS_PER_SLAB(sz) ((KSLAB_SIZE - KSLAB_HEADER_SIZE - 16) / ((sz) + 1))
+#define KSLAB_TAGS(slab)           ((uint8_t *)(slab) + KSLAB_HEADER_SIZE)
+#define KSLAB_OBJECTS(slab, cache) \
+    ((char *)(slab) + KSLAB_HEADER_SIZE + (((cache)->objects_per_slab + 15) & ~15))
+
+#define SIZE_CLASS(i, sz, nm) [i] = { .name = nm, .object_size = sz, \
+    .objects_per_slab = KSLAB_OBJECTS_PER_SLAB(sz), .tag = KMEM_TAG_MISC, \
+    .lock = KSPINLOCK_INIT(nm), \
+    .next = (i) + 1 < KSLAB_CLASS_COUNT ? &size_classes[(i) + 1] : NULL }
+
+static kmem_cache_t size_classes[KSLAB_CLASS_COUNT] = {
+    SIZE_CLASS(0, 16, "kmalloc-16"),
+    SIZE_CLASS(1, 32, "kmalloc-32"),
+    SIZE_CLASS(2, 64, "kmalloc-64"),
+    SIZE_CLASS(3, 128, "kmalloc-128"),
+    SIZE_CLASS(4, 256, "kmalloc-256"),
+    SIZE_CLASS(5, 512, "kmalloc-512"),
+    SIZE_CLASS(6, 1024, "kmalloc-1024"),
+    SIZE_CLASS(7, 2048, "kmalloc-2048"),
+};
+
+static kmem_cache_t *caches = &size_classes[0];
+static kspinlock_t caches_lock = KSPINLOCK_INIT("slab caches");
+
+static inline kslab_t *_kslab_of(const void *ptr) {
+    return (kslab_t *)((uintptr_t)ptr & ~(uintptr_t)(KSLAB_SIZE - 1));
+}
+
+static void _kslab_list_push(kslab_t **list, kslab_t *slab) {
+    slab->prev = NULL;
+    slab->next = *list;
+    if (*list)
+        (*list)->prev = slab;
+    *list = slab;
+}
+
+static void _kslab_list_remove(kslab_t **list, kslab_t *slab) {
+    if (slab->prev)
+        slab->prev->next = slab->next;
+    else
+        *list = slab->next;
+    if (slab->next)
+        slab->next->prev = slab->prev;
+    slab->prev = NULL;
+    slab->next = NULL;
+}
+
+static kslab_t *_kslab_create(kmem_cache_t *cache) {
+    kslab_t *slab = kpage_alloc(KSLAB_ORDER);
+    if (!slab)
+        return NULL;
+
+    kpage_of(slab)->flags |= KPAGE_FLAG_SLAB;
+
+    slab->cache = cache;
+    slab->prev = NULL;
+    slab->next = NULL;
+    slab->in_use = 0;
+    slab->free_list = NULL;
+
+    char *objects = KSLAB_OBJECTS(slab, cache);
+    for (size_t i = cache->objects_per_slab; i-- > 0;) {
+        void **obj = (void **)(objects + i * cache->object_size);
+        *obj = slab->free_list;
+        slab->free_list = obj;
+    }
+
+    cache->slab_count++;
+    return slab;
+}
+
+static void _kslab_release(kmem_cache_t *cache, kslab_t *slab) {
+    cache->slab_count--;
+    kpage_free(slab, KSLAB_ORDER);
+}
+
+static void _kslab_release_list(kmem_cache_t *cache, kslab_t *list) {
+    while (list) {
+        kslab_t *next = list->next;
+        _kslab_release(cache, list);
+        list = next;
+    }
+}
+
+kmem_cache_t *kmem_cache_create(const char *name, size_t object_size, kmem_tag_t tag) {
+    object_size = (object_size + 7) & ~7;
+    if (object_size < sizeof(void *))
+        object_size = sizeof(void *);
+    if (KSLAB_OBJECTS_PER_SLAB(object_size) == 0)
+        return NULL;
+
+    kmem_cache_t *cache = kmalloc_tagged(sizeof(kmem_cache_t), KMEM_TAG_SLAB);
+    if (!cache)
+        return NULL;
+
+    kmemset(cache, 0, sizeof(kmem_cache_t));
+    cache->name = name;
+    cache->object_size = object_size;
+    cache->objects_per_slab = KSLAB_OBJECTS_PER_SLAB(object_size);
+    cache->tag = tag;
+    kspin_init(&cache->lock, name);
+
+    kspin_lock(&caches_lock);
+    cache->next = caches;
+    caches = cache;
+    kspin_unlock(&caches_lock);
+    return cache;
+}
+
+void kmem_cache_destroy(kmem_cache_t *cache) {
+    if (!cache)
+        return;
+
+    kspin_lock(&caches_lock);
+    for (kmem_cache_t **link = &caches; *link; link = &(*link)->next) {
+        if (*link == cache) {
+            *link = cache->next;
+            break;
+        }
+    }
+    kspin_unlock(&caches_lock);
+
+    _kslab_release_list(cache, cache->partial);
+    _kslab_release_list(cache, cache->full);
+    _kslab_release_list(cache, cache->empty);
+    kfree(cache);
+}
+
+static inline size_t _kslab_object_index(kmem_cache_t *cache, kslab_t *slab, const void *ptr) {
+    return (size_t)((const char *)ptr - KSLAB_OBJECTS(slab, cache)) / cache->object_size;
+}
+
+static void *_kmem_cache_alloc(kmem_cache_t *cache, kmem_tag_t tag) {
+    kslab_t *slab = cache->partial;
+    if (!slab) {
+        slab = cache->empty;
+        if (slab)
+            cache->empty = NULL;
+        else if (!(slab = _kslab_create(cache)))
+            return NULL;
+        _kslab_list_push(&cache->partial, slab);
+    }
+
+    void **obj = slab->free_list;
+    slab->free_list = *obj;
+    slab->in_use++;
+    cache->active_objects++;
+
+    if (!slab->free_list) {
+        _kslab_list_remove(&cache->partial, slab);
+        _kslab_list_push(&cache->full, slab);
+    }
+
+    KSLAB_TAGS(slab)[_kslab_object_index(cache, slab, obj)] = (uint8_t)tag;
+    kmem_stats_alloc(tag, cache->object_size);
+    return obj;
+}
+
+void *kmem_cache_alloc(kmem_cache_t *cache) {
+    uint32_t flags = kspin_lock_irqsave(&cache->lock);
+    void *obj = _kmem_cache_alloc(cache, cache->tag);
+    kspin_unlock_irqrestore(&cache->lock, flags);
+    return obj;
+}
+
+static void _kmem_cache_free(kmem_cache_t *cache, void *ptr) {
+    kslab_t *slab = _kslab_of(ptr);
+    bool was_full = slab->free_list == NULL;
+
+    kmem_tag_t tag = (kmem_tag_t)KSLAB_TAGS(slab)[_kslab_object_index(cache, slab, ptr)];
+    kmem_stats_free(tag, cache->object_size);
+
+    *(void **)ptr = slab->free_list;
+    slab->free_list = ptr;
+    slab->in_use--;
+    cache->active_objects--;
+
+    if (was_full) {
+        _kslab_list_remove(&cache->full, slab);
+        _kslab_list_push(&cache->partial, slab);
+    }
+
+    if (slab->in_use == 0) {
+        _kslab_list_remove(&cache->partial, slab);
+        if (cache->empty)
+            _kslab_release(cache, slab);
+        else
+            cache->empty = slab;
+    }
+}
+
+void kmem_cache_free(kmem_cache_t *cache, void *ptr) {
+    if (!ptr)
+        return;
+
+    uint32_t flags = kspin_lock_irqsave(&cache->lock);
+    _kmem_cache_free(cache, ptr);
+    kspin_unlock_irqrestore(&cache->lock, flags);
+}
+
+static kmem_cache_t *_kslab_class_for(size_t size) {
+    size_t class_size = KSLAB_MIN_SIZE;
+    for (size_t i = 0; i < KSLAB_CLASS_COUNT; i++, class_size <<= 1) {
+        if (size <= class_size)
+            return &size_classes[i];
+    }
+    return NULL;
+}
+
+void *kslab_alloc(size_t size, kmem_tag_t tag) {
+    kmem_cache_t *cache = _kslab_class_for(size);
+    if (!cache)
+        return NULL;
+
+    uint32_t flags = kspin_lock_irqsave(&cache->lock);
+    void *obj = _kmem_cache_alloc(cache, tag);
+    kspin_unlock_irqrestore(&cache->lock, flags);
+    return obj;
+}
+
+void kslab_free(void *ptr) {
+    kmem_cache_free(_kslab_of(ptr)->cache, ptr);
+}
+
+bool kslab_owns(const void *ptr) {
+    kpage_t *page = kpage_of(_kslab_of(ptr));
+    return page && (page->flags & KPAGE_FLAG_SLAB);
+}
+
+size_t kslab_object_size(const void *ptr) {
+    return _kslab_of(ptr)->cache->object_size;
+}
+
+kmem_tag_t kslab_object_tag(const void *ptr) {
+    kslab_t *slab = _kslab_of(ptr);
+    return (kmem_tag_t)KSLAB_TAGS(slab)[_kslab_object_index(slab->cache, slab, ptr)];
+}
+
+kmem_cache_t *kslab_first_cache(void) {
+    return caches;
+}
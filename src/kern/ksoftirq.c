@@ -0,0 +1,104 @@
+#include <agave/ksoftirq.h>
+#include <agave/kclock.h>
+#include <agave/kcpu.h>
+#include <agave/kthread.h>
+#include <agave/kutils.h>
+#include <stddef.h>
+
+// handlers raised again while running are retried this many times before being left to the idle loop
+#define KSOFTIRQ_MAX_RESTART 8
+
+static ksoftirq_fn handlers[KSOFTIRQ_COUNT];
+
+static ksoftirq_stats_t stats[KSOFTIRQ_COUNT] = {
+    [KSOFTIRQ_TIMER] = { .name = "timer" },
+};
+
+static volatile uint32_t pending = 0;
+// non-zero while handlers run or softirqs are disabled, keeps them from nesting
+static volatile uint32_t nesting = 0;
+
+void ksoftirq_open(ksoftirq_type_t type, ksoftirq_fn fn) {
+    handlers[type] = fn;
+}
+
+void ksoftirq_raise(ksoftirq_type_t type) {
+    uint32_t flags = ksave_interrupts();
+    pending |= 1u << type;
+    krestore_interrupts(flags);
+}
+
+bool ksoftirq_pending(void) {
+    return pending != 0;
+}
+
+// interrupts are disabled on entry and on return, handlers run with them enabled
+static void _ksoftirq_dispatch(void) {
+    // a handler preempted by another thread would hold up every later softirq
+    kthread_preempt_disable();
+    nesting++;
+
+    for (int restart = 0; pending && restart < KSOFTIRQ_MAX_RESTART; restart++) {
+        uint32_t active = pending;
+        pending = 0;
+        kenable_interrupts();
+
+        for (uint32_t type = 0; active; type++, active >>= 1) {
+            if (!(active & 1) || !handlers[type])
+                continue;
+
+            uint64_t start = kclock_ns();
+            handlers[type]();
+            uint64_t elapsed = kclock_ns() - start;
+
+            stats[type].runs++;
+            stats[type].total_ns += elapsed;
+            if (elapsed > stats[type].max_ns)
+                stats[type].max_ns = elapsed;
+        }
+
+        kdisable_interrupts();
+    }
+
+    nesting--;
+    kthread_preempt_enable();
+}
+
+/*
+ * Handlers take locks that threads hold without disabling interrupts, so
+ * they do not run on top of code with preemption disabled. Those softirqs
+ * wait for kthread_preempt_enable to bring the count back to zero.
+ */
+static bool _ksoftirq_can_run(void) {
+    return !nesting && pending && kcpu_this()->preempt_count == 0;
+}
+
+void ksoftirq_run(void) {
+    uint32_t flags = ksave_interrupts();
+    if (_ksoftirq_can_run())
+        _ksoftirq_dispatch();
+    krestore_interrupts(flags);
+}
+
+void ksoftirq_irq_exit(void) {
+    if (_ksoftirq_can_run())
+        _ksoftirq_dispatch();
+}
+
+void ksoftirq_disable(void) {
+    uint32_t flags = ksave_interrupts();
+    nesting++;
+    krestore_interrupts(flags);
+}
+
+void ksoftirq_enable(void) {
+    uint32_t flags = ksave_interrupts();
+    nesting--;
+    if (_ksoftirq_can_run())
+        _ksoftirq_dispatch();
+    krestore_interrupts(flags);
+}
+
+const ksoftirq_stats_t *ksoftirq_get_stats(ksoftirq_type_t type) {
+    return &stats[type];
+}
@@ -0,0 +1,362 @@
+#include <agave/kthread.h>
+#include <agave/ktimer.h>
+#include <agave/ksoftirq.h>
+#include <agave/kmem.h>
+#include <agave/kpage.h>
+#include <agave/kcore.h>
+#include <agave/kcpu.h>
+#include <agave/kutils.h>
+#include <agave/utils.h>
+#include <string.h>
+#include <stddef.h>
+
+#define KTHREAD_CANARY 0x7E57AC0Du
+
+#define FXSAVE_FCW_DEFAULT   0x037F
+#define FXSAVE_MXCSR_DEFAULT 0x1F80
+#define FXSAVE_MXCSR_OFFSET  24
+
+/*
+ * Round-robin on the boot CPU, application processors only run jobs. The
+ * current thread, preempt count and need_resched live in the boot CPU's
+ * kcpu_local_t. The run queue holds runnable threads other than the current
+ * one and the idle thread, which only runs when the queue is empty.
+ * Switches happen with interrupts disabled, either voluntarily from
+ * kthread_yield/kthread_block or on interrupt exit when need_resched is set
+ * by the slice timer or by a wakeup that arrived while idling.
+ */
+static kthread_t main_thread;
+static kthread_t *idle_thread = NULL;
+static kthread_t *run_head = NULL;
+static kthread_t *run_tail = NULL;
+static kthread_t *all_threads = NULL;
+static uint32_t next_id = 0;
+
+static bool fpu_switch = false;
+static ktimer_t slice_timer;
+
+// callee-saved registers are pushed on the old stack, popped from the new one, and ret resumes the new thread
+NAKED static void _kthread_switch_stacks(UNUSED uint32_t *save_esp, UNUSED uint32_t new_esp) {
+    __asm__ volatile(
+        "mov 4(%esp), %eax\n\t"
+        "mov 8(%esp), %edx\n\t"
+        "push %ebp\n\t"
+        "push %ebx\n\t"
+        "push %esi\n\t"
+        "push %edi\n\t"
+        "mov %esp, (%eax)\n\t"
+        "mov %edx, %esp\n\t"
+        "pop %edi\n\t"
+        "pop %esi\n\t"
+        "pop %ebx\n\t"
+        "pop %ebp\n\t"
+        "ret"
+    );
+}
+
+static void _kthread_run_push(kthread_t *thread) {
+    thread->next = NULL;
+    if (run_tail)
+        run_tail->next = thread;
+    else
+        run_head = thread;
+    run_tail = thread;
+}
+
+static kthread_t *_kthread_run_pop(void) {
+    kthread_t *thread = run_head;
+    if (thread) {
+        run_head = thread->next;
+        if (!run_head)
+            run_tail = NULL;
+    }
+    return thread;
+}
+
+static void _kthread_slice_expired(void *data) {
+    (void)data;
+    // nobody is waiting, so the running thread just gets another slice
+    if (run_head)
+        kcpu_get(0)->need_resched = true;
+    else
+        ktimer_arm_ms(&slice_timer, KTHREAD_SLICE_MS);
+}
+
+// interrupts must be disabled, the current thread is queued again if it is still running
+static void _kthread_schedule(void) {
+    kcpu_local_t *cpu = kcpu_this();
+    kthread_t *prev = cpu->current;
+    if (prev->canary != KTHREAD_CANARY)
+        kpanic("thread %s overflowed its stack", prev->name);
+
+    if (prev->state == KTHREAD_RUNNING && prev != idle_thread) {
+        prev->state = KTHREAD_RUNNABLE;
+        _kthread_run_push(prev);
+    }
+
+    kthread_t *next = _kthread_run_pop();
+    if (!next)
+        next = idle_thread;
+    cpu->need_resched = false;
+    next->state = KTHREAD_RUNNING;
+    if (next == prev)
+        return;
+
+    if (next == idle_thread)
+        ktimer_cancel(&slice_timer);
+    else
+        ktimer_arm_ms(&slice_timer, KTHREAD_SLICE_MS);
+
+    if (fpu_switch) {
+        __asm__ volatile("fxsave (%0)" : : "r"(prev->fpu) : "memory");
+        __asm__ volatile("fxrstor (%0)" : : "r"(next->fpu) : "memory");
+    }
+
+    next->switches++;
+    cpu->current = next;
+    _kthread_switch_stacks(&prev->esp, next->esp);
+}
+
+// first code a new thread runs, entered through the ret of _kthread_switch_stacks
+static void _kthread_entry(void) {
+    kenable_interrupts();
+    kthread_t *self = kthread_current();
+    self->entry(self->arg);
+    kthread_exit(0);
+}
+
+static void _kthread_idle(void *arg) {
+    (void)arg;
+    for (;;) {
+        ksoftirq_run();
+
+        kdisable_interrupts();
+        if (run_head) {
+            kenable_interrupts();
+            kthread_yield();
+        } else if (ksoftirq_pending()) {
+            kenable_interrupts();
+        } else {
+            kwait_for_interrupt();
+        }
+    }
+}
+
+static void _kthread_setup(kthread_t *thread, const char *name) {
+    strncpy(thread->name, name, KTHREAD_NAME_LEN);
+    thread->name[KTHREAD_NAME_LEN - 1] = '\0';
+    thread->id = next_id++;
+    thread->state = KTHREAD_RUNNABLE;
+    thread->next = NULL;
+    thread->switches = 0;
+    thread->exit_code = 0;
+    thread->canary = KTHREAD_CANARY;
+    kwait_queue_init(&thread->joiners);
+    karena_init(&thread->scratch, KMEM_TAG_SCRATCH);
+
+    // default control words, otherwise the first fxrstor would load garbage
+    kmemset(thread->fpu, 0, sizeof(thread->fpu));
+    *(uint16_t *)thread->fpu = FXSAVE_FCW_DEFAULT;
+    *(uint32_t *)(thread->fpu + FXSAVE_MXCSR_OFFSET) = FXSAVE_MXCSR_DEFAULT;
+
+    uint32_t flags = ksave_interrupts();
+    thread->all_next = all_threads;
+    all_threads = thread;
+    krestore_interrupts(flags);
+}
+
+static kthread_t *_kthread_alloc(const char *name, kthread_fn entry, void *arg) {
+    kthread_t *thread = kpage_alloc(KTHREAD_STACK_ORDER);
+    if (!thread)
+        return NULL;
+    kmem_stats_alloc(KMEM_TAG_THREAD, (size_t)KPAGE_SIZE << KTHREAD_STACK_ORDER);
+
+    _kthread_setup(thread, name);
+    thread->entry = entry;
+    thread->arg = arg;
+
+    // the frame _kthread_switch_stacks pops: edi, esi, ebx, ebp and the return address
+    uint32_t *sp = (uint32_t *)((uintptr_t)thread + ((size_t)KPAGE_SIZE << KTHREAD_STACK_ORDER));
+    *--sp = 0; // return address of _kthread_entry, never used
+    *--sp = (uint32_t)_kthread_entry;
+    *--sp = 0;
+    *--sp = 0;
+    *--sp = 0;
+    *--sp = 0;
+    thread->esp = (uint32_t)sp;
+    return thread;
+}
+
+void kthread_init(void) {
+    fpu_switch = kcpu_has(KCPU_FEATURE_SSE);
+    ktimer_setup(&slice_timer, _kthread_slice_expired, NULL);
+
+    // the boot stack keeps running as the main thread, its kthread_t is static
+    _kthread_setup(&main_thread, "main");
+    main_thread.state = KTHREAD_RUNNING;
+    kcpu_this()->current = &main_thread;
+
+    // the idle thread is picked when the run queue is empty, it is never queued
+    idle_thread = _kthread_alloc("idle", _kthread_idle, NULL);
+    if (!idle_thread)
+        kpanic("unable to create the idle thread");
+}
+
+kthread_t *kthread_current(void) {
+    return kcpu_this()->current;
+}
+
+kthread_t *kthread_first(void) {
+    return all_threads;
+}
+
+const char *kthread_state_name(kthread_state_t state) {
+    switch (state) {
+    case KTHREAD_RUNNING:  return "running";
+    case KTHREAD_RUNNABLE: return "runnable";
+    case KTHREAD_BLOCKED:  return "blocked";
+    case KTHREAD_ZOMBIE:   return "zombie";
+    }
+    return "?";
+}
+
+kthread_t *kthread_create(const char *name, kthread_fn entry, void *arg) {
+    kthread_t *thread = _kthread_alloc(name, entry, arg);
+    if (!thread)
+        return NULL;
+
+    uint32_t flags = ksave_interrupts();
+    _kthread_run_push(thread);
+    kcpu_local_t *cpu = kcpu_get(0);
+    if (cpu->current == idle_thread)
+        cpu->need_resched = true;
+    krestore_interrupts(flags);
+    return thread;
+}
+
+void kthread_exit(int code) {
+    kdisable_interrupts();
+    kthread_t *self = kthread_current();
+    self->exit_code = code;
+    self->state = KTHREAD_ZOMBIE;
+    kwait_wake_all(&self->joiners);
+    _kthread_schedule();
+    kpanic("zombie thread %s was scheduled", self->name);
+    for (;;)
+        ;
+}
+
+int kthread_join(kthread_t *thread) {
+    uint32_t flags = ksave_interrupts();
+    while (thread->state != KTHREAD_ZOMBIE)
+        kwait_sleep(&thread->joiners);
+
+    kthread_t **link = &all_threads;
+    while (*link != thread)
+        link = &(*link)->all_next;
+    *link = thread->all_next;
+    krestore_interrupts(flags);
+
+    int code = thread->exit_code;
+    karena_destroy(&thread->scratch);
+    kmem_stats_free(KMEM_TAG_THREAD, (size_t)KPAGE_SIZE << KTHREAD_STACK_ORDER);
+    kpage_free(thread, KTHREAD_STACK_ORDER);
+    return code;
+}
+
+void kthread_yield(void) {
+    uint32_t flags = ksave_interrupts();
+    _kthread_schedule();
+    krestore_interrupts(flags);
+}
+
+void kthread_block(void) {
+    kthread_current()->state = KTHREAD_BLOCKED;
+    _kthread_schedule();
+}
+
+void kthread_wake(kthread_t *thread) {
+    uint32_t flags = ksave_interrupts();
+    if (thread->state == KTHREAD_BLOCKED) {
+        thread->state = KTHREAD_RUNNABLE;
+        _kthread_run_push(thread);
+        // a busy thread keeps its slice, the idle thread gives way at once
+        kcpu_local_t *cpu = kcpu_get(0);
+        if (cpu->current == idle_thread)
+            cpu->need_resched = true;
+    }
+    krestore_interrupts(flags);
+}
+
+bool kthread_can_block(void) {
+    kcpu_local_t *cpu = kcpu_this();
+    return cpu->current && cpu->current != idle_thread && cpu->preempt_count == 0;
+}
+
+void kthread_preempt_disable(void) {
+    kcpu_this()->preempt_count++;
+    __asm__ volatile("" : : : "memory");
+}
+
+void kthread_preempt_enable(void) {
+    __asm__ volatile("" : : : "memory");
+    uint32_t flags = ksave_interrupts();
+    kcpu_local_t *cpu = kcpu_this();
+    // with interrupts already off this is a handler or an irqsave section, the switch waits for irq exit
+    if (--cpu->preempt_count == 0 && (flags & EFLAGS_IF)) {
+        // softirqs raised while the count was up were held back by ksoftirq_irq_exit
+        if (cpu->id == 0 && ksoftirq_pending())
+            ksoftirq_run();
+        if (cpu->need_resched && cpu->current)
+            _kthread_schedule();
+    }
+    krestore_interrupts(flags);
+}
+
+void kthread_irq_exit(void) {
+    kcpu_local_t *cpu = kcpu_this();
+    if (cpu->need_resched && cpu->preempt_count == 0 && cpu->current)
+        _kthread_schedule();
+}
+
+void kwait_queue_init(kwait_queue_t *queue) {
+    queue->head = NULL;
+    queue->tail = NULL;
+}
+
+void kwait_sleep(kwait_queue_t *queue) {
+    kthread_t *self = kthread_current();
+    self->next = NULL;
+    if (queue->tail)
+        queue->tail->next = self;
+    else
+        queue->head = self;
+    queue->tail = self;
+    kthread_block();
+}
+
+static kthread_t *_kwait_pop(kwait_queue_t *queue) {
+    kthread_t *thread = queue->head;
+    if (thread) {
+        queue->head = thread->next;
+        if (!queue->head)
+            queue->tail = NULL;
+    }
+    return thread;
+}
+
+void kwait_wake_one(kwait_queue_t *queue) {
+    uint32_t flags = ksave_interrupts();
+    kthread_t *thread = _kwait_pop(queue);
+    if (thread)
+        kthread_wake(thread);
+    krestore_interrupts(flags);
+}
+
+void kwait_wake_all(kwait_queue_t *queue) {
+    uint32_t flags = ksave_interrupts();
+    kthread_t *thread;
+    while ((thread = _kwait_pop(queue)))
+        kthread_wake(thread);
+    krestore_interrupts(flags);
+}
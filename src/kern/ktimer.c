@@ -1,57 +1,427 @@
 #include <agave/kutils.h>
 #include <agave/pit.h>
 #include <agave/ktimer.h>
+#include <agave/kclock.h>
+#include <agave/ksoftirq.h>
+#include <agave/kthread.h>
+#include <agave/klapic.h>
+#include <agave/kirq.h>
+#include <stddef.h>
 #include <stdint.h>
 
+// waits shorter than this spin on the clock source instead of halting until a PIT interrupt
+#define KTIMER_SPIN_LIMIT_NS 100000
+
+// each wheel level has 64 slots and is 8 times coarser than the one below
+#define KTIMER_WHEEL_SLOT_BITS   6
+#define KTIMER_WHEEL_SLOTS       (1u << KTIMER_WHEEL_SLOT_BITS)
+#define KTIMER_WHEEL_LEVEL_SHIFT 3
+#define KTIMER_WHEEL_LEVELS      10 // about 99 days at 1 kHz
+#define KTIMER_SLOT_EXPIRED      ((uint32_t)-1)
+
+// shortest LAPIC one-shot, keeps a deadline that has already passed from storming the interrupt
+#define KTIMER_LAPIC_MIN_NS 10000
+
 static uint32_t timer_frequency_hz = 100;
+
+static kclock_conv_t ticks_to_ms;
+static kclock_conv_t ticks_to_us;
+static kclock_conv_t ticks_to_ns;
+static kclock_conv_t ticks_to_clocks;
+
+// uptime is kept in PIT input clocks, ticks are a view of it at timer_frequency_hz
+static kclock_conv_t clocks_to_ticks;
+static kclock_conv_t ms_to_clocks;
+static kclock_conv_t us_to_clocks;
+static kclock_conv_t ns_to_clocks;
+static kclock_conv_t clocks_to_ns;
+static kclock_conv_t ms_to_ticks;
+
+// once the LAPIC timer raises the interrupts the PIT stops counting, its clocks are derived from kclock
+static bool lapic_events = false;
+static uint64_t lapic_base_clocks = 0;
+static uint64_t lapic_base_ns = 0;
+
+static ktimer_t *wheel[KTIMER_WHEEL_LEVELS * KTIMER_WHEEL_SLOTS];
+static uint64_t wheel_pending[KTIMER_WHEEL_LEVELS]; // bit per non-empty slot
+static uint64_t wheel_clk = 0;                       // first tick not processed yet
+static uint64_t wheel_next = KTIMER_NEVER;
+static volatile uint64_t wheel_next_clocks = PIT_NO_DEADLINE;
+static ktimer_t *expired = NULL;
+
+static uint64_t sleep_deadline = PIT_NO_DEADLINE;
+
 void ktimer_initialize(uint32_t frequency_hz) {
     timer_frequency_hz = frequency_hz;
+
+    kclock_conv_init(&ticks_to_ms, 1000, frequency_hz);
+    kclock_conv_init(&ticks_to_us, 1000000, frequency_hz);
+    kclock_conv_init(&ticks_to_ns, 1000000000, frequency_hz);
+    kclock_conv_init(&ticks_to_clocks, PIT_FREQUENCY, frequency_hz);
+
+    kclock_conv_init(&clocks_to_ticks, frequency_hz, PIT_FREQUENCY);
+    kclock_conv_init(&ms_to_clocks, PIT_FREQUENCY, 1000);
+    kclock_conv_init(&us_to_clocks, PIT_FREQUENCY, 1000000);
+    kclock_conv_init(&ns_to_clocks, PIT_FREQUENCY, 1000000000);
+    kclock_conv_init(&clocks_to_ns, 1000000000, PIT_FREQUENCY);
+    kclock_conv_init(&ms_to_ticks, frequency_hz, 1000);
+
+#ifdef KTIMER_TICKLESS
+    pit_init_oneshot();
+#else
     pit_init(frequency_hz);
+#endif
+    ksoftirq_open(KSOFTIRQ_TIMER, ktimer_run_expired);
+
+    kclock_init();
+}
+
+static uint64_t _ktimer_clocks(void) {
+    if (!lapic_events)
+        return pit_get_clocks();
+    return lapic_base_clocks + kclock_convert(&ns_to_clocks, kclock_ns() - lapic_base_ns);
+}
+
+uint32_t ktimer_get_frequency(void) {
+    return timer_frequency_hz;
 }
 
 uint64_t ktimer_get_ticks(void) {
-    return pit_get_ticks();
+    return kclock_convert(&clocks_to_ticks, _ktimer_clocks());
+}
+
+uint64_t ktimer_ticks_to_milliseconds(uint64_t ticks) {
+    return kclock_convert(&ticks_to_ms, ticks);
+}
+
+uint64_t ktimer_ticks_to_microseconds(uint64_t ticks) {
+    return kclock_convert(&ticks_to_us, ticks);
+}
+
+uint64_t ktimer_ticks_to_nanoseconds(uint64_t ticks) {
+    return kclock_convert(&ticks_to_ns, ticks);
 }
 
 uint64_t ktimer_get_milliseconds(void) {
-    return (ktimer_get_ticks() * 1000) / timer_frequency_hz;
+    return kdiv_u64_u32(kclock_ns(), 1000000, NULL);
 }
 
 uint64_t ktimer_get_microseconds(void) {
-    return (ktimer_get_ticks() * 1000000) / timer_frequency_hz;
+    return kdiv_u64_u32(kclock_ns(), 1000, NULL);
 }
 
 uint64_t ktimer_get_nanoseconds(void) {
-    return (ktimer_get_ticks() * 1000000000) / timer_frequency_hz;
+    return kclock_ns();
 }
 
-void ksleep(uint32_t milliseconds) {
-    uint64_t start_ticks = ktimer_get_ticks();
-    uint64_t wait_ticks = (milliseconds * timer_frequency_hz) / 1000;
-    while (ktimer_get_ticks() - start_ticks < wait_ticks) {
-        khalt_cpu(false);
+// a reached sleep deadline is consumed like the PIT does, the sleeper sets the next one
+static void _ktimer_lapic_set_deadline(uint64_t now) {
+#ifdef KTIMER_TICKLESS
+    uint64_t deadline = sleep_deadline > now ? sleep_deadline : PIT_NO_DEADLINE;
+    if (wheel_next_clocks < deadline)
+        deadline = wheel_next_clocks;
+    if (deadline == PIT_NO_DEADLINE) {
+        klapic_timer_stop();
+        return;
     }
+
+    uint64_t ns = deadline > now ? kclock_convert(&clocks_to_ns, deadline - now + 1) : 0;
+    klapic_timer_oneshot(ns < KTIMER_LAPIC_MIN_NS ? KTIMER_LAPIC_MIN_NS : ns);
+#else
+    (void)now; // periodic, like the PIT in that mode
+#endif
 }
 
-void ksleep_micro(uint32_t microseconds) {
-    uint64_t start_ticks = ktimer_get_ticks();
-    uint64_t wait_ticks = (microseconds * timer_frequency_hz) / 1000000;
-    while (ktimer_get_ticks() - start_ticks < wait_ticks) {
-        khalt_cpu(false);
+// the timer has a single deadline, it is shared by a sleeping caller and the timer wheel
+static void _ktimer_program_deadline(void) {
+    if (lapic_events) {
+        _ktimer_lapic_set_deadline(_ktimer_clocks());
+        return;
     }
+
+    uint64_t deadline = sleep_deadline;
+    if (wheel_next_clocks < deadline)
+        deadline = wheel_next_clocks;
+    pit_set_deadline(deadline);
 }
 
-void ksleep_nano(uint32_t nanoseconds) {
-    uint64_t start_ticks = ktimer_get_ticks();
-    uint64_t wait_ticks = (nanoseconds * timer_frequency_hz) / 1000000000;
-    while (ktimer_get_ticks() - start_ticks < wait_ticks) {
-        khalt_cpu(false);
+/*
+ * The LAPIC timer is per CPU and acknowledged with an MMIO write instead of
+ * port I/O. The PIT clock count advances with its own interrupts, so the
+ * switch is only made once kclock runs from the TSC and uptime can be
+ * derived from it.
+ */
+bool ktimer_use_lapic(void) {
+    if (kclock_source()->read == pit_get_clocks || !klapic_timer_init())
+        return false;
+
+    uint32_t flags = ksave_interrupts();
+    lapic_base_clocks = pit_get_clocks();
+    lapic_base_ns = kclock_ns();
+    lapic_events = true;
+    kirq_mask(0);
+#ifdef KTIMER_TICKLESS
+    _ktimer_program_deadline();
+#else
+    klapic_timer_periodic(timer_frequency_hz);
+#endif
+    krestore_interrupts(flags);
+    return true;
+}
+
+const char *ktimer_device_name(void) {
+    return lapic_events ? "lapic" : "pit";
+}
+
+static void _ktimer_wake_sleeper(void *data) {
+    kthread_wake((kthread_t *)data);
+}
+
+/*
+ * A thread sleeps on a wheel timer for the tick after its deadline and is
+ * blocked meanwhile. Upper wheel levels may fire early or late, so the timer
+ * is armed again until the deadline has passed, each time in a finer level.
+ */
+static void _ktimer_block_clocks(uint64_t deadline) {
+    ktimer_t timer;
+    ktimer_setup(&timer, _ktimer_wake_sleeper, kthread_current());
+
+    for (;;) {
+        uint32_t flags = ksave_interrupts();
+        if (_ktimer_clocks() >= deadline) {
+            krestore_interrupts(flags);
+            break;
+        }
+        ktimer_arm(&timer, kclock_convert(&clocks_to_ticks, deadline) + 1);
+        kthread_block();
+        krestore_interrupts(flags);
     }
+    ktimer_cancel(&timer);
+}
+
+/*
+ * Without a thread to block, the deadline is handed to the PIT so in tickless
+ * mode the sleeper is woken by a single one-shot interrupt. The check and the
+ * hlt run with interrupts off until kwait_for_interrupt, so an interrupt
+ * between them cannot be lost.
+ */
+static void _ktimer_wait_clocks(uint64_t clocks) {
+    uint64_t deadline = _ktimer_clocks() + clocks;
+    if (kthread_can_block()) {
+        _ktimer_block_clocks(deadline);
+        return;
+    }
+
+    for (;;) {
+        uint32_t flags = ksave_interrupts();
+        if (_ktimer_clocks() >= deadline) {
+            sleep_deadline = PIT_NO_DEADLINE;
+            _ktimer_program_deadline();
+            krestore_interrupts(flags);
+            break;
+        }
+        // reached deadlines are consumed by the PIT, so set it again after every wakeup
+        sleep_deadline = deadline;
+        _ktimer_program_deadline();
+        kwait_for_interrupt();
+    }
+}
+
+void ksleep(uint32_t milliseconds) {
+    _ktimer_wait_clocks(kclock_convert(&ms_to_clocks, milliseconds));
+}
+
+void ksleep_micro(uint32_t microseconds) {
+    if ((uint64_t)microseconds * 1000 < KTIMER_SPIN_LIMIT_NS)
+        kclock_delay_ns((uint64_t)microseconds * 1000);
+    else
+        _ktimer_wait_clocks(kclock_convert(&us_to_clocks, microseconds));
+}
+
+void ksleep_nano(uint32_t nanoseconds) {
+    if (nanoseconds < KTIMER_SPIN_LIMIT_NS)
+        kclock_delay_ns(nanoseconds);
+    else
+        _ktimer_wait_clocks(kclock_convert(&ns_to_clocks, nanoseconds));
 }
 
 void ktimer_wait_ticks(uint64_t ticks) {
-    uint64_t start_ticks = ktimer_get_ticks();
-    while (ktimer_get_ticks() - start_ticks < ticks) {
-        khalt_cpu(false);
+    _ktimer_wait_clocks(kclock_convert(&ticks_to_clocks, ticks));
+}
+
+static inline uint32_t _ktimer_ctz64(uint64_t value) {
+    uint32_t low = (uint32_t)value;
+    return low ? (uint32_t)__builtin_ctz(low) : 32 + (uint32_t)__builtin_ctz((uint32_t)(value >> 32));
+}
+
+static void _ktimer_link(ktimer_t **head, ktimer_t *timer) {
+    timer->next = *head;
+    if (*head)
+        (*head)->pprev = &timer->next;
+    *head = timer;
+    timer->pprev = head;
+}
+
+static void _ktimer_unlink(ktimer_t *timer) {
+    *timer->pprev = timer->next;
+    if (timer->next)
+        timer->next->pprev = timer->pprev;
+    timer->pprev = NULL;
+
+    if (timer->slot != KTIMER_SLOT_EXPIRED && !wheel[timer->slot])
+        wheel_pending[timer->slot / KTIMER_WHEEL_SLOTS] &= ~(1ull << (timer->slot % KTIMER_WHEEL_SLOTS));
+}
+
+/*
+ * A timer goes into the finest level whose 64 slots still reach its expiry,
+ * rounded up to that level's granularity. Timers are never moved between
+ * levels, so insert and cancel stay O(1) and a tick only looks at the levels
+ * whose granularity it is a multiple of. Returns the tick the slot is due.
+ */
+static uint64_t _ktimer_wheel_insert(ktimer_t *timer) {
+    uint64_t expires = timer->expires < wheel_clk ? wheel_clk : timer->expires;
+
+    uint32_t level = 0, shift = 0;
+    uint64_t index = expires;
+    for (; level < KTIMER_WHEEL_LEVELS; level++) {
+        shift = level * KTIMER_WHEEL_LEVEL_SHIFT;
+        index = (expires + ((1ull << shift) - 1)) >> shift;
+        if (index - (wheel_clk >> shift) < KTIMER_WHEEL_SLOTS)
+            break;
+    }
+    // beyond the last level the timer fires at the end of the wheel's range
+    if (level == KTIMER_WHEEL_LEVELS) {
+        level--;
+        index = (wheel_clk >> shift) + KTIMER_WHEEL_SLOTS - 1;
+    }
+
+    uint32_t slot_index = (uint32_t)(index & (KTIMER_WHEEL_SLOTS - 1));
+    timer->slot = level * KTIMER_WHEEL_SLOTS + slot_index;
+    _ktimer_link(&wheel[timer->slot], timer);
+    wheel_pending[level] |= 1ull << slot_index;
+    return index << shift;
+}
+
+// first tick with a non-empty slot, every pending slot lies within 64 slots of wheel_clk
+static uint64_t _ktimer_wheel_next(void) {
+    uint64_t next = KTIMER_NEVER;
+    for (uint32_t level = 0; level < KTIMER_WHEEL_LEVELS; level++) {
+        uint64_t pending = wheel_pending[level];
+        if (!pending)
+            continue;
+
+        uint32_t shift = level * KTIMER_WHEEL_LEVEL_SHIFT;
+        uint64_t base = (wheel_clk + ((1ull << shift) - 1)) >> shift;
+        uint32_t rotate = (uint32_t)(base & (KTIMER_WHEEL_SLOTS - 1));
+        if (rotate)
+            pending = (pending >> rotate) | (pending << (KTIMER_WHEEL_SLOTS - rotate));
+
+        uint64_t tick = (base + _ktimer_ctz64(pending)) << shift;
+        if (tick < next)
+            next = tick;
+    }
+    return next;
+}
+
+static void _ktimer_update_next(void) {
+    wheel_next = _ktimer_wheel_next();
+    // round up a clock so the interrupt does not arrive just before the tick starts
+    wheel_next_clocks = wheel_next == KTIMER_NEVER ? PIT_NO_DEADLINE
+                                                   : kclock_convert(&ticks_to_clocks, wheel_next) + 1;
+    _ktimer_program_deadline();
+}
+
+// moves every slot that is due at the tick onto the expired list
+static void _ktimer_collect(uint64_t tick) {
+    for (uint32_t level = 0; level < KTIMER_WHEEL_LEVELS; level++) {
+        uint32_t shift = level * KTIMER_WHEEL_LEVEL_SHIFT;
+        if (tick & ((1ull << shift) - 1))
+            break;
+
+        uint32_t slot_index = (uint32_t)((tick >> shift) & (KTIMER_WHEEL_SLOTS - 1));
+        ktimer_t *timer = wheel[level * KTIMER_WHEEL_SLOTS + slot_index];
+        wheel[level * KTIMER_WHEEL_SLOTS + slot_index] = NULL;
+        wheel_pending[level] &= ~(1ull << slot_index);
+
+        while (timer) {
+            ktimer_t *next = timer->next;
+            timer->slot = KTIMER_SLOT_EXPIRED;
+            _ktimer_link(&expired, timer);
+            timer = next;
+        }
+    }
+}
+
+void ktimer_setup(ktimer_t *timer, ktimer_fn fn, void *data) {
+    timer->next = NULL;
+    timer->pprev = NULL;
+    timer->expires = 0;
+    timer->fn = fn;
+    timer->data = data;
+    timer->slot = KTIMER_SLOT_EXPIRED;
+}
+
+void ktimer_arm(ktimer_t *timer, uint64_t expires) {
+    uint32_t flags = ksave_interrupts();
+    if (timer->pprev)
+        _ktimer_unlink(timer);
+
+    timer->expires = expires;
+    if (_ktimer_wheel_insert(timer) < wheel_next)
+        _ktimer_update_next();
+    krestore_interrupts(flags);
+}
+
+void ktimer_arm_ms(ktimer_t *timer, uint32_t milliseconds) {
+    ktimer_arm(timer, ktimer_get_ticks() + kclock_convert(&ms_to_ticks, milliseconds));
+}
+
+bool ktimer_cancel(ktimer_t *timer) {
+    uint32_t flags = ksave_interrupts();
+    bool pending = timer->pprev != NULL;
+    // an emptied slot only costs a spurious wakeup, so the deadline is left alone
+    if (pending)
+        _ktimer_unlink(timer);
+    krestore_interrupts(flags);
+    return pending;
+}
+
+bool ktimer_is_pending(const ktimer_t *timer) {
+    return timer->pprev != NULL;
+}
+
+void ktimer_interrupt(void) {
+    uint64_t now = _ktimer_clocks();
+    if (now >= wheel_next_clocks)
+        ksoftirq_raise(KSOFTIRQ_TIMER);
+    else if (lapic_events)
+        _ktimer_lapic_set_deadline(now); // nothing rearms a one-shot that fired for a sleeper
+}
+
+void ktimer_run_expired(void) {
+    uint32_t flags = ksave_interrupts();
+
+    // jump from one non-empty slot to the next instead of walking every tick
+    uint64_t now = ktimer_get_ticks();
+    while (wheel_clk <= now) {
+        uint64_t next = _ktimer_wheel_next();
+        if (next > now) {
+            wheel_clk = now + 1;
+            break;
+        }
+        _ktimer_collect(next);
+        wheel_clk = next + 1;
+    }
+
+    while (expired) {
+        ktimer_t *timer = expired;
+        _ktimer_unlink(timer);
+
+        krestore_interrupts(flags);
+        timer->fn(timer->data);
+        flags = ksave_interrupts();
     }
-}
\ No newline at end of file
+
+    _ktimer_update_next();
+    krestore_interrupts(flags);
+}
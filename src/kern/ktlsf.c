@@ -0,0 +1,353 @@
+#ifdef KMEM_TLSF
+
+#include <agave/kmem.h>
+#include <stdint.h>
+
+// two-level segregated fit: constant time allocate and free, see Masmano et al., ECRTS 2004
+
+#define ALIGN_SIZE_LOG2     3
+#define ALIGN_SIZE          (1u << ALIGN_SIZE_LOG2)
+
+#define SL_INDEX_COUNT_LOG2 4
+#define SL_INDEX_COUNT      (1u << SL_INDEX_COUNT_LOG2)
+#define FL_INDEX_MAX        30
+#define FL_INDEX_SHIFT      (SL_INDEX_COUNT_LOG2 + ALIGN_SIZE_LOG2)
+#define FL_INDEX_COUNT      (FL_INDEX_MAX - FL_INDEX_SHIFT + 1)
+#define SMALL_BLOCK_SIZE    (1u << FL_INDEX_SHIFT)
+
+#define BLOCK_FREE          0x1
+#define BLOCK_PREV_FREE     0x2
+#define BLOCK_FLAGS         (BLOCK_FREE | BLOCK_PREV_FREE)
+
+#define BLOCK_MIN_SIZE      ALIGN_SIZE
+#define BLOCK_MAX_SIZE      ((size_t)1 << FL_INDEX_MAX)
+
+/**
+ * tlsf_block_t
+ * prev_phys: physically previous block, NULL for the first block of a region.
+ * size: payload size in bytes, low bits hold BLOCK_FREE and BLOCK_PREV_FREE.
+ * next_free, prev_free: links in the segregated free list, only valid while the block is free.
+ *                       A used block keeps its allocation tag in next_free instead.
+ */
+typedef struct tlsf_block {
+    struct tlsf_block *prev_phys;
+    size_t size;
+    struct tlsf_block *next_free;
+    struct tlsf_block *prev_free;
+} tlsf_block_t;
+
+static uint32_t fl_bitmap = 0;
+static uint32_t sl_bitmap[FL_INDEX_COUNT];
+static tlsf_block_t *blocks[FL_INDEX_COUNT][SL_INDEX_COUNT];
+
+static inline int tlsf_fls(uint32_t word) {
+    return word ? 31 - __builtin_clz(word) : -1;
+}
+
+static inline int tlsf_ffs(uint32_t word) {
+    return word ? __builtin_ctz(word) : -1;
+}
+
+static inline size_t block_size(const tlsf_block_t *block) {
+    return block->size & ~(size_t)BLOCK_FLAGS;
+}
+
+static inline void block_set_size(tlsf_block_t *block, size_t size) {
+    block->size = size | (block->size & BLOCK_FLAGS);
+}
+
+static inline bool block_is_free(const tlsf_block_t *block) {
+    return (block->size & BLOCK_FREE) != 0;
+}
+
+static inline void *block_to_ptr(tlsf_block_t *block) {
+    return (char*)block + sizeof(tlsf_block_t);
+}
+
+static inline tlsf_block_t *block_from_ptr(const void *ptr) {
+    return (tlsf_block_t*)((char*)ptr - sizeof(tlsf_block_t));
+}
+
+static inline tlsf_block_t *block_next(tlsf_block_t *block) {
+    return (tlsf_block_t*)((char*)block_to_ptr(block) + block_size(block));
+}
+
+static inline tlsf_block_t *block_link_next(tlsf_block_t *block) {
+    tlsf_block_t *next = block_next(block);
+    next->prev_phys = block;
+    return next;
+}
+
+static void block_mark_free(tlsf_block_t *block) {
+    block_link_next(block)->size |= BLOCK_PREV_FREE;
+    block->size |= BLOCK_FREE;
+}
+
+static void block_mark_used(tlsf_block_t *block) {
+    block_next(block)->size &= ~(size_t)BLOCK_PREV_FREE;
+    block->size &= ~(size_t)BLOCK_FREE;
+}
+
+static void mapping_insert(size_t size, int *fli, int *sli) {
+    if (size < SMALL_BLOCK_SIZE) {
+        *fli = 0;
+        *sli = (int)(size / (SMALL_BLOCK_SIZE / SL_INDEX_COUNT));
+    } else {
+        int fl = tlsf_fls(size);
+        *sli = (int)(size >> (fl - SL_INDEX_COUNT_LOG2)) ^ SL_INDEX_COUNT;
+        *fli = fl - (FL_INDEX_SHIFT - 1);
+    }
+}
+
+// rounds up to the next list so any block found there is large enough
+static void mapping_search(size_t size, int *fli, int *sli) {
+    if (size >= SMALL_BLOCK_SIZE)
+        size += (1u << (tlsf_fls(size) - SL_INDEX_COUNT_LOG2)) - 1;
+    mapping_insert(size, fli, sli);
+}
+
+static tlsf_block_t *search_suitable_block(int *fli, int *sli) {
+    int fl = *fli;
+    uint32_t sl_map = sl_bitmap[fl] & (~0u << *sli);
+
+    if (!sl_map) {
+        uint32_t fl_map = (fl + 1 < 32) ? fl_bitmap & (~0u << (fl + 1)) : 0;
+        if (!fl_map)
+            return NULL;
+        fl = tlsf_ffs(fl_map);
+        *fli = fl;
+        sl_map = sl_bitmap[fl];
+    }
+
+    int sl = tlsf_ffs(sl_map);
+    *sli = sl;
+    return blocks[fl][sl];
+}
+
+static void remove_free_block(tlsf_block_t *block, int fl, int sl) {
+    if (block->prev_free) block->prev_free->next_free = block->next_free;
+    if (block->next_free) block->next_free->prev_free = block->prev_free;
+
+    if (blocks[fl][sl] == block) {
+        blocks[fl][sl] = block->next_free;
+        if (!blocks[fl][sl]) {
+            sl_bitmap[fl] &= ~(1u << sl);
+            if (!sl_bitmap[fl])
+                fl_bitmap &= ~(1u << fl);
+        }
+    }
+}
+
+static void insert_free_block(tlsf_block_t *block, int fl, int sl) {
+    tlsf_block_t *head = blocks[fl][sl];
+    block->prev_free = NULL;
+    block->next_free = head;
+    if (head) head->prev_free = block;
+    blocks[fl][sl] = block;
+    fl_bitmap |= 1u << fl;
+    sl_bitmap[fl] |= 1u << sl;
+}
+
+static void block_remove(tlsf_block_t *block) {
+    int fl, sl;
+    mapping_insert(block_size(block), &fl, &sl);
+    remove_free_block(block, fl, sl);
+}
+
+static void block_insert(tlsf_block_t *block) {
+    int fl, sl;
+    mapping_insert(block_size(block), &fl, &sl);
+    insert_free_block(block, fl, sl);
+}
+
+static inline bool block_can_split(tlsf_block_t *block, size_t size) {
+    return block_size(block) >= sizeof(tlsf_block_t) + BLOCK_MIN_SIZE + size;
+}
+
+// splits block so it holds size bytes, returns the remainder
+static tlsf_block_t *block_split(tlsf_block_t *block, size_t size) {
+    tlsf_block_t *rest = (tlsf_block_t*)((char*)block_to_ptr(block) + size);
+    rest->size = block_size(block) - size - sizeof(tlsf_block_t);
+    block_set_size(block, size);
+    rest->prev_phys = block;
+    block_mark_free(rest);
+    return rest;
+}
+
+// absorbs next into block, next must not be on a free list
+static tlsf_block_t *block_absorb(tlsf_block_t *block, tlsf_block_t *next) {
+    block->size += block_size(next) + sizeof(tlsf_block_t);
+    block_link_next(block);
+    return block;
+}
+
+static tlsf_block_t *merge_prev(tlsf_block_t *block) {
+    if (block->size & BLOCK_PREV_FREE) {
+        tlsf_block_t *prev = block->prev_phys;
+        block_remove(prev);
+        block = block_absorb(prev, block);
+    }
+    return block;
+}
+
+static tlsf_block_t *merge_next(tlsf_block_t *block) {
+    tlsf_block_t *next = block_next(block);
+    if (block_is_free(next)) {
+        block_remove(next);
+        block = block_absorb(block, next);
+    }
+    return block;
+}
+
+static void trim_free(tlsf_block_t *block, size_t size) {
+    if (block_can_split(block, size)) {
+        tlsf_block_t *rest = block_split(block, size);
+        block_insert(rest);
+    }
+}
+
+static void *prepare_used(tlsf_block_t *block, size_t size) {
+    trim_free(block, size);
+    block_mark_used(block);
+    return block_to_ptr(block);
+}
+
+static inline size_t adjust_request_size(size_t size) {
+    size = (size + ALIGN_SIZE - 1) & ~(size_t)(ALIGN_SIZE - 1);
+    return size < BLOCK_MIN_SIZE ? BLOCK_MIN_SIZE : size;
+}
+
+static tlsf_block_t *locate_free(size_t size) {
+    int fl, sl;
+    mapping_search(size, &fl, &sl);
+    if (fl >= (int)FL_INDEX_COUNT)
+        return NULL;
+
+    tlsf_block_t *block = search_suitable_block(&fl, &sl);
+    if (block)
+        remove_free_block(block, fl, sl);
+    return block;
+}
+
+void kheap_add_region(void *start, size_t size) {
+    uintptr_t begin = ((uintptr_t)start + ALIGN_SIZE - 1) & ~(uintptr_t)(ALIGN_SIZE - 1);
+    uintptr_t end = ((uintptr_t)start + size) & ~(uintptr_t)(ALIGN_SIZE - 1);
+    if (end <= begin || end - begin < 3 * sizeof(tlsf_block_t) + BLOCK_MIN_SIZE)
+        return;
+
+    size_t region_size = end - begin - 2 * sizeof(tlsf_block_t);
+    if (region_size >= BLOCK_MAX_SIZE)
+        region_size = BLOCK_MAX_SIZE - ALIGN_SIZE;
+
+    tlsf_block_t *block = (tlsf_block_t*)begin;
+    block->prev_phys = NULL;
+    block->size = region_size;
+
+    // zero-sized, permanently used sentinel so merging never runs past the region
+    tlsf_block_t *sentinel = block_link_next(block);
+    sentinel->size = 0;
+
+    block_mark_free(block);
+    block_insert(block);
+}
+
+void *kheap_alloc(size_t size) {
+    if (size >= BLOCK_MAX_SIZE)
+        return NULL;
+
+    size = adjust_request_size(size);
+    tlsf_block_t *block = locate_free(size);
+    if (!block && kheap_grow(size))
+        block = locate_free(size);
+    return block ? prepare_used(block, size) : NULL;
+}
+
+void *kheap_alloc_aligned(size_t size, size_t align) {
+    if (size >= BLOCK_MAX_SIZE)
+        return NULL;
+
+    size = adjust_request_size(size);
+    if (align <= ALIGN_SIZE)
+        return kheap_alloc(size);
+
+    // over-allocate so the aligned block and a free block in front of it both fit
+    const size_t gap_min = sizeof(tlsf_block_t) + BLOCK_MIN_SIZE;
+    tlsf_block_t *block = locate_free(size + align + gap_min);
+    if (!block && kheap_grow(size + align + gap_min))
+        block = locate_free(size + align + gap_min);
+    if (!block)
+        return NULL;
+
+    uintptr_t payload = (uintptr_t)block_to_ptr(block);
+    uintptr_t aligned = (payload + align - 1) & ~(uintptr_t)(align - 1);
+    while (aligned != payload && aligned - payload < gap_min)
+        aligned += align;
+
+    if (aligned != payload) {
+        tlsf_block_t *rest = block_split(block, aligned - payload - sizeof(tlsf_block_t));
+        block_mark_free(block);
+        block_insert(block);
+        block = rest;
+    }
+    return prepare_used(block, size);
+}
+
+void kheap_free(void *ptr) {
+    if (!ptr)
+        return;
+
+    tlsf_block_t *block = block_from_ptr(ptr);
+    block_mark_free(block);
+    block = merge_prev(block);
+    block = merge_next(block);
+    block_insert(block);
+}
+
+bool kheap_resize(void *ptr, size_t size) {
+    if (size >= BLOCK_MAX_SIZE)
+        return false;
+
+    tlsf_block_t *block = block_from_ptr(ptr);
+    size = adjust_request_size(size);
+
+    if (size > block_size(block)) {
+        tlsf_block_t *next = block_next(block);
+        if (!block_is_free(next) || block_size(block) + sizeof(tlsf_block_t) + block_size(next) < size)
+            return false;
+
+        block_remove(next);
+        block_absorb(block, next);
+        block_mark_used(block);
+    }
+
+    // give the tail back, merged with a free successor
+    if (block_can_split(block, size)) {
+        tlsf_block_t *rest = block_split(block, size);
+        rest = merge_next(rest);
+        block_insert(rest);
+    }
+    return true;
+}
+
+size_t kheap_block_size(void *ptr) {
+    return block_size(block_from_ptr(ptr));
+}
+
+void kheap_set_tag(void *ptr, kmem_tag_t tag) {
+    block_from_ptr(ptr)->next_free = (tlsf_block_t*)(uintptr_t)tag;
+}
+
+kmem_tag_t kheap_get_tag(void *ptr) {
+    return (kmem_tag_t)(uintptr_t)block_from_ptr(ptr)->next_free;
+}
+
+void kheap_walk_free(void (*fn)(size_t size, void *ctx), void *ctx) {
+    for (uint32_t fl = 0; fl < FL_INDEX_COUNT; fl++) {
+        for (uint32_t sl = 0; sl < SL_INDEX_COUNT; sl++) {
+            for (tlsf_block_t *block = blocks[fl][sl]; block; block = block->next_free)
+                fn(block_size(block), ctx);
+        }
+    }
+}
+
+#endif // KMEM_TLSF
@@ -64,3 +64,42 @@ char* kitoa_unsigned(unsigned int value, char* buffer, int base) {
 
     return buffer;
 }
+
+char* kitoa_unsigned64(uint64_t value, char* buffer, int base) {
+    char* ptr = buffer;
+    char* ptr1;
+    char tmp_char;
+    uint32_t tmp_value;
+
+    if (base < 2 || base > 16) {
+        *buffer = '\0';
+        return buffer;
+    }
+
+    ptr1 = ptr;
+
+    do {
+        value = kdiv_u64_u32(value, (uint32_t)base, &tmp_value);
+        *ptr++ = "0123456789abcdef"[tmp_value];
+    } while (value);
+
+    *ptr-- = '\0';
+
+    while (ptr1 < ptr) {
+        tmp_char = *ptr;
+        *ptr-- = *ptr1;
+        *ptr1++ = tmp_char;
+    }
+
+    return buffer;
+}
+
+char* kitoa64(int64_t value, char* buffer, int base) {
+    if (value < 0 && base == 10) {
+        *buffer = '-';
+        kitoa_unsigned64(-(uint64_t)value, buffer + 1, base);
+        return buffer;
+    }
+
+    return kitoa_unsigned64((uint64_t)value, buffer, base);
+}
@@ -1,4 +1,7 @@
+#include <agave/drivers/serial.h>
 #include <agave/io.h>
+#include <agave/kmem.h>
+#include <agave/klock.h>
 #include <agave/kutils.h>
 #include <agave/kvid.h>
 #include <agave/ports.h>
@@ -8,12 +11,177 @@
 #include <stdint.h>
 #include <string.h>
 
-uint16_t *vidptr = (uint16_t *)KVID_POINTER;
+static uint16_t *vidptr = (uint16_t *)KVID_POINTER;
 size_t krow = 0, kcol = 0;
 uint8_t kcurrent_color = WHITE | (BLACK << 4);
 size_t kline_end[SCREEN_HEIGHT] = {0};
 
-void kupdate_cursor(void) {
+/*
+ * Text is written to a copy of the screen in RAM and only the dirty parts
+ * of each row are copied to VGA memory once the print call is done, so
+ * scrolling moves the first row instead of copying the screen through MMIO.
+ * Row n of the screen is row (shadow_top + n) % SCREEN_HEIGHT of the copy.
+ */
+static uint16_t shadow[SCREEN_HEIGHT * SCREEN_WIDTH];
+static size_t shadow_top = 0;
+static uint32_t dirty_rows = 0; // bit per screen row
+static uint8_t dirty_from[SCREEN_HEIGHT];
+static uint8_t dirty_to[SCREEN_HEIGHT];
+
+/*
+ * Rows that scroll off the top are appended to a byte ring as
+ *   length, run count, (attribute, count) per run, characters, record size
+ * with trailing blanks dropped, so a line of one color costs its characters
+ * plus four bytes. The trailing size lets the view walk back from the
+ * newest line, the oldest lines are dropped when the ring is full.
+ */
+// offsets are masked with the size, and the oldest records are dropped until the longest one fits
+_Static_assert((KVID_SCROLLBACK_SIZE & (KVID_SCROLLBACK_SIZE - 1)) == 0 && KVID_SCROLLBACK_SIZE >= 256,
+               "KVID_SCROLLBACK_SIZE must be a power of two of at least 256 bytes");
+static uint8_t history[KVID_SCROLLBACK_SIZE];
+static uint32_t history_head = 0; // free-running byte offsets, masked on access
+static uint32_t history_tail = 0;
+static uint32_t history_lines = 0;
+static uint32_t view_offset = 0; // lines the view is scrolled back, 0 shows the live screen
+
+// kvprintf collects output in a buffer of this size on the stack before writing it
+#define KVID_CHUNK_SIZE 128
+
+// cursor, line ends and the text buffer, interrupt handlers and other CPUs may print
+static kspinlock_t console_lock = KSPINLOCK_INIT("console");
+
+static inline uint16_t *_kvid_line(size_t row) {
+  row += shadow_top;
+  if (row >= SCREEN_HEIGHT)
+    row -= SCREEN_HEIGHT;
+  return &shadow[row * SCREEN_WIDTH];
+}
+
+static inline void _kvid_mark(size_t row, size_t from, size_t to) {
+  if (!(dirty_rows & (1u << row))) {
+    dirty_rows |= 1u << row;
+    dirty_from[row] = from;
+    dirty_to[row] = to;
+    return;
+  }
+  if (from < dirty_from[row])
+    dirty_from[row] = from;
+  if (to > dirty_to[row])
+    dirty_to[row] = to;
+}
+
+// while the view is scrolled back the screen belongs to it, dirty rows wait for kscrollback_reset
+static void _kvid_flush(void) {
+  if (view_offset)
+    return;
+  for (uint32_t rows = dirty_rows; rows; rows &= rows - 1) {
+    uint32_t row = __builtin_ctz(rows);
+    kmemcpy(vidptr + row * SCREEN_WIDTH + dirty_from[row], _kvid_line(row) + dirty_from[row],
+            (dirty_to[row] - dirty_from[row]) * sizeof(uint16_t));
+  }
+  dirty_rows = 0;
+}
+
+static inline uint8_t _kvid_history_get(uint32_t offset) {
+  return history[offset & (KVID_SCROLLBACK_SIZE - 1)];
+}
+
+static inline void _kvid_history_put(uint8_t value) {
+  history[history_head++ & (KVID_SCROLLBACK_SIZE - 1)] = value;
+}
+
+static void _kvid_history_drop(void) {
+  uint32_t len = _kvid_history_get(history_tail);
+  uint32_t runs = _kvid_history_get(history_tail + 1);
+  history_tail += 3 + 2 * runs + len;
+  history_lines--;
+  if (view_offset > history_lines)
+    view_offset = history_lines;
+}
+
+static void _kvid_history_push(const uint16_t *line) {
+  size_t len = SCREEN_WIDTH;
+  while (len && (line[len - 1] & 0xFF) == ' ')
+    len--;
+
+  uint32_t runs = 0;
+  for (size_t i = 0; i < len; i++) {
+    if (i == 0 || (line[i] >> 8) != (line[i - 1] >> 8))
+      runs++;
+  }
+
+  uint32_t size = 3 + 2 * runs + len;
+  while (KVID_SCROLLBACK_SIZE - (history_head - history_tail) < size)
+    _kvid_history_drop();
+
+  _kvid_history_put((uint8_t)len);
+  _kvid_history_put((uint8_t)runs);
+  for (size_t i = 0; i < len;) {
+    size_t start = i;
+    uint8_t attr = line[i] >> 8;
+    while (i < len && (line[i] >> 8) == attr)
+      i++;
+    _kvid_history_put(attr);
+    _kvid_history_put((uint8_t)(i - start));
+  }
+  for (size_t i = 0; i < len; i++)
+    _kvid_history_put((uint8_t)line[i]);
+  _kvid_history_put((uint8_t)size);
+  history_lines++;
+
+  // the view stays on the same lines while output continues below it
+  if (view_offset && view_offset < history_lines)
+    view_offset++;
+}
+
+// decodes the record at offset into a screen row and returns the offset of the next one
+static uint32_t _kvid_history_render(uint32_t offset, uint16_t *row) {
+  uint32_t len = _kvid_history_get(offset);
+  uint32_t runs = _kvid_history_get(offset + 1);
+  uint32_t chars = offset + 2 + 2 * runs;
+
+  size_t col = 0;
+  for (uint32_t run = 0; run < runs; run++) {
+    uint16_t attr = (uint16_t)_kvid_history_get(offset + 2 + 2 * run) << 8;
+    uint32_t count = _kvid_history_get(offset + 3 + 2 * run);
+    for (uint32_t i = 0; i < count; i++, col++)
+      row[col] = attr | _kvid_history_get(chars + col);
+  }
+  for (; col < SCREEN_WIDTH; col++)
+    row[col] = (0x07 << 8) | ' ';
+  return chars + len + 1;
+}
+
+// draws the history lines from view_offset back and as much of the live screen as fits below
+static void _kvid_render_view(void) {
+  uint32_t offset = history_head;
+  for (uint32_t i = 0; i < view_offset; i++)
+    offset -= _kvid_history_get(offset - 1);
+
+  for (size_t row = 0; row < SCREEN_HEIGHT; row++) {
+    if (row < view_offset)
+      offset = _kvid_history_render(offset, vidptr + row * SCREEN_WIDTH);
+    else
+      kmemcpy(vidptr + row * SCREEN_WIDTH, _kvid_line(row - view_offset), SCREEN_WIDTH * sizeof(uint16_t));
+  }
+}
+
+static void _kvid_scroll(void) {
+  _kvid_history_push(_kvid_line(0));
+  shadow_top = shadow_top + 1 == SCREEN_HEIGHT ? 0 : shadow_top + 1;
+  uint16_t *line = _kvid_line(SCREEN_HEIGHT - 1);
+  for (size_t i = 0; i < SCREEN_WIDTH; i++)
+    line[i] = (kcurrent_color << 8) | ' ';
+  for (size_t i = 0; i < SCREEN_HEIGHT - 1; i++)
+    kline_end[i] = kline_end[i + 1];
+  kline_end[SCREEN_HEIGHT - 1] = 0;
+
+  // every row moved on screen
+  for (size_t i = 0; i < SCREEN_HEIGHT; i++)
+    _kvid_mark(i, 0, SCREEN_WIDTH);
+}
+
+static void _kupdate_cursor(void) {
   uint16_t pos = krow * SCREEN_WIDTH + kcol;
   outb(VGA_CTRL_PORT, VGA_CURSOR_LOW);
   outb(VGA_DATA_PORT, (uint8_t)(pos & 0xFF));
@@ -21,55 +189,92 @@ void kupdate_cursor(void) {
   outb(VGA_DATA_PORT, (uint8_t)((pos >> 8) & 0xFF));
 }
 
+/*
+ * The serial console gets the same text. Moves within the current row, as
+ * the shell does while editing a line, are sent as VT100 sequences, moves
+ * to other rows have no counterpart on a scrolling terminal.
+ */
+static void _kvid_serial_column(size_t col) {
+  char seq[16] = "\r";
+  size_t len = 1;
+  if (col)
+    len += ksnprintf(seq + 1, sizeof(seq) - 1, "\x1b[%uC", (unsigned)col);
+  serial_write(seq, len);
+}
+
+void kupdate_cursor(void) {
+  uint32_t flags = kspin_lock_irqsave(&console_lock);
+  _kupdate_cursor();
+  kspin_unlock_irqrestore(&console_lock, flags);
+}
+
+void kvid_break_lock(void) {
+  __atomic_store_n(&console_lock.owner, console_lock.next, __ATOMIC_RELEASE);
+}
+
 void ksetpos(size_t row, size_t col) {
+  uint32_t flags = kspin_lock_irqsave(&console_lock);
+  if (row == krow)
+    _kvid_serial_column(col);
   krow = row;
   kcol = col;
-  kupdate_cursor();
+  _kupdate_cursor();
+  kspin_unlock_irqrestore(&console_lock, flags);
 }
 
 kpos_t kgetpos(void) {
+  uint32_t flags = kspin_lock_irqsave(&console_lock);
   kpos_t pos;
   pos.krow = krow;
   pos.kcol = kcol;
+  kspin_unlock_irqrestore(&console_lock, flags);
   return pos;
 }
 
 void kmove_cursor_left(void) {
+  uint32_t flags = kspin_lock_irqsave(&console_lock);
   if (kcol > 0)
     kcol--;
   else if (krow > 0) {
     krow--;
     kcol = kline_end[krow];
   }
-  kupdate_cursor();
+  _kupdate_cursor();
+  kspin_unlock_irqrestore(&console_lock, flags);
 }
 
 void kmove_cursor_right(void) {
+  uint32_t flags = kspin_lock_irqsave(&console_lock);
   if (kcol < kline_end[krow])
     kcol++;
   else if (krow + 1 < SCREEN_HEIGHT) {
     krow++;
     kcol = 0;
   }
-  kupdate_cursor();
+  _kupdate_cursor();
+  kspin_unlock_irqrestore(&console_lock, flags);
 }
 
 void kmove_cursor_up(void) {
+  uint32_t flags = kspin_lock_irqsave(&console_lock);
   if (krow > 0) {
     krow--;
     if (kcol > kline_end[krow])
       kcol = kline_end[krow];
   }
-  kupdate_cursor();
+  _kupdate_cursor();
+  kspin_unlock_irqrestore(&console_lock, flags);
 }
 
 void kmove_cursor_down(void) {
+  uint32_t flags = kspin_lock_irqsave(&console_lock);
   if (krow + 1 < SCREEN_HEIGHT) {
     krow++;
     if (kcol > kline_end[krow])
       kcol = kline_end[krow];
   }
-  kupdate_cursor();
+  _kupdate_cursor();
+  kspin_unlock_irqrestore(&console_lock, flags);
 }
 
 
@@ -80,26 +285,21 @@ void kgetcolor(uint8_t *fg, uint8_t *bg) {
   *bg = (kcurrent_color >> 4) & 0x0F;
 }
 
-void kputchar(char c) {
+static void _kputchar(char c) {
   if (c == '\n') {
+    serial_write("\r\n", 2);
     kline_end[krow] = kcol;
     kcol = 0;
     if (krow + 1 < SCREEN_HEIGHT)
       krow++;
-    else {
-      for (size_t i = 0; i < (SCREEN_HEIGHT - 1) * SCREEN_WIDTH; i++)
-        vidptr[i] = vidptr[i + SCREEN_WIDTH];
-      for (size_t i = (SCREEN_HEIGHT - 1) * SCREEN_WIDTH;
-           i < SCREEN_HEIGHT * SCREEN_WIDTH; i++)
-        vidptr[i] = (kcurrent_color << 8) | ' ';
-      for (size_t i = 0; i < SCREEN_HEIGHT - 1; i++)
-        kline_end[i] = kline_end[i + 1];
-      kline_end[SCREEN_HEIGHT - 1] = 0;
-    }
+    else
+      _kvid_scroll();
   } else if (c == '\b') {
     if (kcol > 0) {
+      serial_write("\b \b", 3);
       kcol--;
-      vidptr[krow * SCREEN_WIDTH + kcol] = (kcurrent_color << 8) | ' ';
+      _kvid_line(krow)[kcol] = (kcurrent_color << 8) | ' ';
+      _kvid_mark(krow, kcol, kcol + 1);
       if (kline_end[krow] > kcol)
         kline_end[krow] = kcol;
     } else if (krow > 0) {
@@ -107,9 +307,12 @@ void kputchar(char c) {
       kcol = kline_end[krow];
     }
   } else if (c == '\r') {
+    serial_write("\r", 1);
     kcol = 0;
   } else {
-    vidptr[krow * SCREEN_WIDTH + kcol] = (kcurrent_color << 8) | c;
+    serial_write(&c, 1);
+    _kvid_line(krow)[kcol] = (kcurrent_color << 8) | c;
+    _kvid_mark(krow, kcol, kcol + 1);
     if (kcol >= kline_end[krow])
       kline_end[krow] = kcol + 1;
 
@@ -118,37 +321,142 @@ void kputchar(char c) {
       kcol = 0;
       if (krow + 1 < SCREEN_HEIGHT)
         krow++;
-      else {
-        for (size_t i = 0; i < (SCREEN_HEIGHT - 1) * SCREEN_WIDTH; i++)
-          vidptr[i] = vidptr[i + SCREEN_WIDTH];
-        for (size_t i = (SCREEN_HEIGHT - 1) * SCREEN_WIDTH;
-             i < SCREEN_HEIGHT * SCREEN_WIDTH; i++)
-          vidptr[i] = (kcurrent_color << 8) | ' ';
-        for (size_t i = 0; i < SCREEN_HEIGHT - 1; i++)
-          kline_end[i] = kline_end[i + 1];
-        kline_end[SCREEN_HEIGHT - 1] = 0;
-      }
+      else
+        _kvid_scroll();
+    }
+  }
+}
+
+// printable characters are copied a row segment at a time, everything else goes through _kputchar
+static void _kwrite(const char *buf, size_t len) {
+  size_t i = 0;
+  while (i < len) {
+    if ((uint8_t)buf[i] < ' ') {
+      _kputchar(buf[i++]);
+      continue;
+    }
+
+    uint16_t *line = _kvid_line(krow);
+    uint16_t attr = (uint16_t)kcurrent_color << 8;
+    size_t start = kcol;
+    const char *run = buf + i;
+    while (i < len && kcol < SCREEN_WIDTH && (uint8_t)buf[i] >= ' ')
+      line[kcol++] = attr | (uint8_t)buf[i++];
+    serial_write(run, kcol - start);
+    _kvid_mark(krow, start, kcol);
+    if (kcol > kline_end[krow])
+      kline_end[krow] = kcol;
+
+    if (kcol >= SCREEN_WIDTH) {
+      kcol = 0;
+      if (krow + 1 < SCREEN_HEIGHT)
+        krow++;
+      else
+        _kvid_scroll();
     }
   }
+}
 
-  kupdate_cursor();
+void kputchar(char c) {
+  uint32_t flags = kspin_lock_irqsave(&console_lock);
+  _kputchar(c);
+  _kvid_flush();
+  _kupdate_cursor();
+  kspin_unlock_irqrestore(&console_lock, flags);
+}
+
+void kwrite(const char *buf, size_t len) {
+  uint32_t flags = kspin_lock_irqsave(&console_lock);
+  _kwrite(buf, len);
+  _kvid_flush();
+  _kupdate_cursor();
+  kspin_unlock_irqrestore(&console_lock, flags);
 }
 
 void kclear(void) {
+  uint32_t flags = kspin_lock_irqsave(&console_lock);
   for (size_t i = 0; i < SCREEN_WIDTH * SCREEN_HEIGHT; i++)
-    vidptr[i] = (0x07 << 8) | ' ';
-  for (size_t i = 0; i < SCREEN_HEIGHT; i++)
+    shadow[i] = (0x07 << 8) | ' ';
+  for (size_t i = 0; i < SCREEN_HEIGHT; i++) {
     kline_end[i] = 0;
+    _kvid_mark(i, 0, SCREEN_WIDTH);
+  }
   krow = 0;
   kcol = 0;
+  view_offset = 0;
+  _kvid_flush();
+  serial_write("\x1b[2J\x1b[H", 7);
+  kspin_unlock_irqrestore(&console_lock, flags);
+}
+
+void kscrollback(int lines) {
+  uint32_t flags = kspin_lock_irqsave(&console_lock);
+  int64_t offset = (int64_t)view_offset + lines;
+  if (offset < 0)
+    offset = 0;
+  if (offset > history_lines)
+    offset = history_lines;
+
+  if (offset != view_offset) {
+    view_offset = (uint32_t)offset;
+    if (view_offset) {
+      _kvid_render_view();
+    } else {
+      for (size_t i = 0; i < SCREEN_HEIGHT; i++)
+        _kvid_mark(i, 0, SCREEN_WIDTH);
+      _kvid_flush();
+    }
+  }
+  kspin_unlock_irqrestore(&console_lock, flags);
+}
+
+void kscrollback_reset(void) {
+  if (__atomic_load_n(&view_offset, __ATOMIC_RELAXED))
+    kscrollback(-(int)KVID_SCROLLBACK_SIZE);
 }
 
+void kclear_line_from(size_t row, size_t col) {
+  uint32_t flags = kspin_lock_irqsave(&console_lock);
+  if (row == krow) {
+    if (col != kcol)
+      _kvid_serial_column(col);
+    serial_write("\x1b[K", 3);
+    if (col != kcol)
+      _kvid_serial_column(kcol);
+  }
+  if (col < kline_end[row]) {
+    uint16_t *line = _kvid_line(row);
+    for (size_t i = col; i < kline_end[row]; i++)
+      line[i] = (kcurrent_color << 8) | ' ';
+    _kvid_mark(row, col, kline_end[row]);
+    _kvid_flush();
+  }
+  kline_end[row] = col;
+  kspin_unlock_irqrestore(&console_lock, flags);
+}
+
+// the whole string goes out under one lock hold so lines from different CPUs do not interleave
 void kprint(const char *str) {
-  for (size_t i = 0; str[i] != '\0'; i++)
-    kputchar(str[i]);
+  uint32_t flags = kspin_lock_irqsave(&console_lock);
+  _kwrite(str, strlen(str));
+  _kvid_flush();
+  _kupdate_cursor();
+  kspin_unlock_irqrestore(&console_lock, flags);
 }
 
-static void _kvprintf_putc(char c, void *ctx) { ((void (*)(char))ctx)(c); }
+typedef struct {
+  char buf[KVID_CHUNK_SIZE];
+  size_t len;
+} kvid_chunk_t;
+
+static void _kvprintf_chunk_putc(char c, void *ctx) {
+  kvid_chunk_t *chunk = ctx;
+  chunk->buf[chunk->len++] = c;
+  if (chunk->len == KVID_CHUNK_SIZE) {
+    _kwrite(chunk->buf, chunk->len);
+    chunk->len = 0;
+  }
+}
 
 static void _kvprintf_buf_putc(char c, void *ctx) {
   struct buf_ctx {
@@ -172,9 +480,15 @@ static void _kvprintf(const char *fmt, va_list args,
 
     i++;
     bool zero_pad = false;
+    bool left_align = false;
     int width = 0;
     int precision = -1;
 
+    if (fmt[i] == '-') {
+      left_align = true;
+      i++;
+    }
+
     if (fmt[i] == '0') {
       zero_pad = true;
       i++;
@@ -226,10 +540,12 @@ static void _kvprintf(const char *fmt, va_list args,
       len = 0;
       while (s[len] && (precision < 0 || (int)len < precision))
         len++;
-      for (size_t j = len; j < (size_t)width; j++)
+      for (size_t j = len; !left_align && j < (size_t)width; j++)
         putc(zero_pad ? '0' : ' ', ctx);
       for (size_t j = 0; j < len; j++)
         putc(s[j], ctx);
+      for (size_t j = len; left_align && j < (size_t)width; j++)
+        putc(' ', ctx);
       break;
     }
     case 'd':
@@ -237,42 +553,57 @@ static void _kvprintf(const char *fmt, va_list args,
       long long val = long_long_flag ? va_arg(args, long long)
                       : long_flag    ? va_arg(args, long)
                                      : va_arg(args, int);
-      kitoa(val, buffer, 10);
+      if (long_long_flag)
+        kitoa64(val, buffer, 10);
+      else
+        kitoa(val, buffer, 10);
       len = 0;
       while (buffer[len])
         len++;
-      for (size_t j = len; j < (size_t)width; j++)
+      for (size_t j = len; !left_align && j < (size_t)width; j++)
         putc(zero_pad ? '0' : ' ', ctx);
       for (size_t j = 0; j < len; j++)
         putc(buffer[j], ctx);
+      for (size_t j = len; left_align && j < (size_t)width; j++)
+        putc(' ', ctx);
       break;
     }
     case 'u': {
       unsigned long long val = long_long_flag ? va_arg(args, unsigned long long)
                                : long_flag    ? va_arg(args, unsigned long)
                                               : va_arg(args, unsigned int);
-      kitoa_unsigned(val, buffer, 10);
+      if (long_long_flag)
+        kitoa_unsigned64(val, buffer, 10);
+      else
+        kitoa_unsigned(val, buffer, 10);
       len = 0;
       while (buffer[len])
         len++;
-      for (size_t j = len; j < (size_t)width; j++)
+      for (size_t j = len; !left_align && j < (size_t)width; j++)
         putc(zero_pad ? '0' : ' ', ctx);
       for (size_t j = 0; j < len; j++)
         putc(buffer[j], ctx);
+      for (size_t j = len; left_align && j < (size_t)width; j++)
+        putc(' ', ctx);
       break;
     }
     case 'x': {
       unsigned long long val = long_long_flag ? va_arg(args, unsigned long long)
                                : long_flag    ? va_arg(args, unsigned long)
                                               : va_arg(args, unsigned int);
-      kitoa_unsigned(val, buffer, 16);
+      if (long_long_flag)
+        kitoa_unsigned64(val, buffer, 16);
+      else
+        kitoa_unsigned(val, buffer, 16);
       len = 0;
       while (buffer[len])
         len++;
-      for (size_t j = len; j < (size_t)width; j++)
+      for (size_t j = len; !left_align && j < (size_t)width; j++)
         putc(zero_pad ? '0' : ' ', ctx);
       for (size_t j = 0; j < len; j++)
         putc(buffer[j], ctx);
+      for (size_t j = len; left_align && j < (size_t)width; j++)
+        putc(' ', ctx);
       break;
     }
     case 'p': {
@@ -300,7 +631,14 @@ static void _kvprintf(const char *fmt, va_list args,
 }
 
 void kvprintf(const char *fmt, va_list args) {
-  _kvprintf(fmt, args, _kvprintf_putc, (void *)kputchar);
+  kvid_chunk_t chunk;
+  chunk.len = 0;
+  uint32_t flags = kspin_lock_irqsave(&console_lock);
+  _kvprintf(fmt, args, _kvprintf_chunk_putc, &chunk);
+  _kwrite(chunk.buf, chunk.len);
+  _kvid_flush();
+  _kupdate_cursor();
+  kspin_unlock_irqrestore(&console_lock, flags);
 }
 
 int ksnprintf(char *buf, size_t size, const char *fmt, ...) {
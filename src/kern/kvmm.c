@@ -0,0 +1,329 @@
+#include <agave/kvmm.h>
+#include <agave/kpage.h>
+#include <agave/kmem.h>
+#include <agave/kcpu.h>
+#include <agave/kcore.h>
+#include <agave/kirq.h>
+#include <agave/klapic.h>
+#include <agave/klock.h>
+#include <agave/utils.h>
+
+#define PTE_PRESENT 0x001
+#define PTE_WRITE   0x002
+#define PTE_LARGE   0x080
+#define PTE_GLOBAL  0x100
+#define PTE_FLAGS   0xFFF
+
+#define LARGE_PAGE_SHIFT 22
+#define LARGE_PAGE_SIZE  (1u << LARGE_PAGE_SHIFT)
+
+#define CR0_PG  0x80000000
+#define CR4_PSE 0x00000010
+#define CR4_PGE 0x00000080
+
+// shootdowns of more pages than this reload cr3 instead of invalidating page by page
+#define KVMM_SHOOTDOWN_FULL_PAGES 32
+
+/**
+ * kvm_area_t
+ * start: first virtual address of a vmalloc area.
+ * pages: number of mapped pages, the guard page after them is not counted.
+ * tag: allocation tag the pages are charged to.
+ * next: next area, the list is sorted by start.
+ */
+typedef struct kvm_area {
+    uintptr_t start;
+    size_t pages;
+    kmem_tag_t tag;
+    struct kvm_area *next;
+} kvm_area_t;
+
+static uint32_t *page_directory = NULL;
+static uint32_t global_flag = 0;
+static kvm_area_t *areas = NULL;
+// page tables and the area list, never taken from interrupt handlers
+static kspinlock_t kvmm_lock = KSPINLOCK_INIT("kvmm");
+
+/*
+ * Other CPUs may still hold TLB entries for pages this CPU unmaps, so the
+ * range is sent to them by IPI and the frames are only freed once every one
+ * of them has invalidated it. Shootdowns run under kvmm_lock, one at a time.
+ */
+static volatile uintptr_t shootdown_start;
+static volatile size_t shootdown_pages;
+static volatile uint32_t shootdown_pending = 0;
+
+static inline uint32_t _kvmm_read_cr0(void) {
+    uint32_t value;
+    __asm__ volatile("mov %%cr0, %0" : "=r"(value));
+    return value;
+}
+
+static inline uint32_t _kvmm_read_cr4(void) {
+    uint32_t value;
+    __asm__ volatile("mov %%cr4, %0" : "=r"(value));
+    return value;
+}
+
+static inline void _kvmm_invlpg(uintptr_t virt) {
+    __asm__ volatile("invlpg (%0)" : : "r"(virt) : "memory");
+}
+
+static inline void _kvmm_flush(uintptr_t start, size_t pages) {
+    if (pages > KVMM_SHOOTDOWN_FULL_PAGES) {
+        // global pages are only used for the identity map, which is never unmapped
+        uint32_t cr3;
+        __asm__ volatile("mov %%cr3, %0\n\t"
+                         "mov %0, %%cr3" : "=r"(cr3) : : "memory");
+        return;
+    }
+    for (size_t i = 0; i < pages; i++)
+        _kvmm_invlpg(start + i * KPAGE_SIZE);
+}
+
+static void _kvmm_shootdown_interrupt(UNUSED kirq_frame_t *frame, UNUSED void *data) {
+    _kvmm_flush(shootdown_start, shootdown_pages);
+    __atomic_sub_fetch(&shootdown_pending, 1, __ATOMIC_RELEASE);
+}
+
+// kvmm_lock held, the range is already invalidated on this CPU
+static void _kvmm_shootdown(uintptr_t start, size_t pages) {
+    uint32_t count = kcpu_get_cpu_count();
+    if (count < 2 || pages == 0)
+        return;
+
+    uint32_t self = kcpu_this()->id;
+    shootdown_start = start;
+    shootdown_pages = pages;
+    __atomic_store_n(&shootdown_pending, count - 1, __ATOMIC_RELEASE);
+    for (uint32_t i = 0; i < count; i++) {
+        if (i != self)
+            klapic_send_ipi(kcpu_get(i)->apic_id, KVMM_SHOOTDOWN_VECTOR);
+    }
+    while (__atomic_load_n(&shootdown_pending, __ATOMIC_ACQUIRE))
+        kcpu_pause();
+}
+
+static uint32_t *_kvmm_page_table(uintptr_t virt, bool create) {
+    uint32_t *pde = &page_directory[virt >> LARGE_PAGE_SHIFT];
+    if (*pde & PTE_LARGE)
+        return NULL;
+
+    if (!(*pde & PTE_PRESENT)) {
+        if (!create)
+            return NULL;
+
+        uint32_t *table = kpage_alloc(0);
+        if (!table)
+            return NULL;
+        kmemset(table, 0, KPAGE_SIZE);
+        *pde = (uintptr_t)table | PTE_PRESENT | PTE_WRITE;
+    }
+
+    // page tables come from identity mapped memory
+    return (uint32_t *)(*pde & ~(uint32_t)PTE_FLAGS);
+}
+
+static bool _kvmm_map(uintptr_t virt, uintptr_t phys, uint32_t entry_flags) {
+    uint32_t *table = _kvmm_page_table(virt, true);
+    if (!table)
+        return false;
+
+    table[(virt >> KPAGE_SHIFT) & 0x3FF] = (phys & ~(uint32_t)PTE_FLAGS) | entry_flags | PTE_PRESENT;
+    _kvmm_invlpg(virt);
+    return true;
+}
+
+static void _kvmm_identity_map(uintptr_t end, bool large_pages) {
+    for (uintptr_t addr = 0; addr < end; addr += LARGE_PAGE_SIZE) {
+        if (large_pages) {
+            page_directory[addr >> LARGE_PAGE_SHIFT] =
+                addr | PTE_PRESENT | PTE_WRITE | PTE_LARGE | global_flag;
+            continue;
+        }
+
+        for (uintptr_t page = addr; page < addr + LARGE_PAGE_SIZE; page += KPAGE_SIZE) {
+            if (!_kvmm_map(page, page, PTE_WRITE | global_flag))
+                kpanic("out of memory while identity mapping 0x%x", page);
+        }
+    }
+}
+
+void kvmm_init(void) {
+    bool large_pages = kcpu_has(KCPU_FEATURE_PSE);
+    bool global_pages = kcpu_has(KCPU_FEATURE_PGE);
+
+    page_directory = kpage_alloc(0);
+    if (!page_directory)
+        kpanic("unable to allocate the page directory");
+    kmemset(page_directory, 0, KPAGE_SIZE);
+
+    if (global_pages)
+        global_flag = PTE_GLOBAL;
+
+    // round up so the whole image, heap and frame descriptors are covered by large pages
+    uintptr_t end = (kpage_memory_end() + LARGE_PAGE_SIZE - 1) & ~(uintptr_t)(LARGE_PAGE_SIZE - 1);
+    _kvmm_identity_map(end, large_pages);
+
+    uint32_t cr4 = _kvmm_read_cr4();
+    if (large_pages)
+        cr4 |= CR4_PSE;
+    if (global_pages)
+        cr4 |= CR4_PGE;
+    __asm__ volatile("mov %0, %%cr4" : : "r"(cr4));
+
+    __asm__ volatile("mov %0, %%cr3" : : "r"(page_directory) : "memory");
+    __asm__ volatile("mov %0, %%cr0" : : "r"(_kvmm_read_cr0() | CR0_PG) : "memory");
+
+    kirq_register_vector(KVMM_SHOOTDOWN_VECTOR, "tlb shootdown", _kvmm_shootdown_interrupt, NULL);
+}
+
+bool kvmm_map_page(uintptr_t virt, uintptr_t phys, uint32_t flags) {
+    kspin_lock(&kvmm_lock);
+    bool ok = _kvmm_map(virt, phys, flags & (KVMM_FLAG_WRITE | KVMM_FLAG_NOCACHE));
+    kspin_unlock(&kvmm_lock);
+    return ok;
+}
+
+void kvmm_unmap_page(uintptr_t virt) {
+    kspin_lock(&kvmm_lock);
+    uint32_t *table = _kvmm_page_table(virt, false);
+    if (table) {
+        table[(virt >> KPAGE_SHIFT) & 0x3FF] = 0;
+        _kvmm_invlpg(virt);
+        _kvmm_shootdown(virt, 1);
+    }
+    kspin_unlock(&kvmm_lock);
+}
+
+bool kvmm_identity_map(uintptr_t start, size_t size, uint32_t flags) {
+    uintptr_t first = start & ~(uintptr_t)(KPAGE_SIZE - 1);
+    size_t pages = (start - first + size + KPAGE_SIZE - 1) >> KPAGE_SHIFT;
+    bool ok = true;
+
+    kspin_lock(&kvmm_lock);
+    for (size_t i = 0; i < pages; i++) {
+        uintptr_t page = first + i * KPAGE_SIZE;
+        if (page_directory[page >> LARGE_PAGE_SHIFT] & PTE_LARGE)
+            continue;
+        uint32_t *table = _kvmm_page_table(page, false);
+        if (table && (table[(page >> KPAGE_SHIFT) & 0x3FF] & PTE_PRESENT))
+            continue;
+        if (!_kvmm_map(page, page, flags & (KVMM_FLAG_WRITE | KVMM_FLAG_NOCACHE))) {
+            ok = false;
+            break;
+        }
+    }
+    kspin_unlock(&kvmm_lock);
+    return ok;
+}
+
+// kvmm_lock held, the entries keep their frame address until every CPU has dropped the pages
+static void _kvmm_release_pages(uintptr_t start, size_t pages) {
+    for (size_t i = 0; i < pages; i++) {
+        uintptr_t virt = start + i * KPAGE_SIZE;
+        _kvmm_page_table(virt, false)[(virt >> KPAGE_SHIFT) & 0x3FF] &= ~(uint32_t)PTE_PRESENT;
+    }
+    _kvmm_flush(start, pages);
+    _kvmm_shootdown(start, pages);
+
+    for (size_t i = 0; i < pages; i++) {
+        uintptr_t virt = start + i * KPAGE_SIZE;
+        uint32_t *entry = &_kvmm_page_table(virt, false)[(virt >> KPAGE_SHIFT) & 0x3FF];
+        kpage_free((void *)(*entry & ~(uint32_t)PTE_FLAGS), 0);
+        *entry = 0;
+    }
+}
+
+static void *_kvmm_vmalloc_area(size_t size, kmem_tag_t tag) {
+    if (size == 0 || size > KVMM_VMALLOC_END - KVMM_VMALLOC_START - KPAGE_SIZE)
+        return NULL;
+
+    size_t pages = (size + KPAGE_SIZE - 1) >> KPAGE_SHIFT;
+    size_t span = (pages + 1) * KPAGE_SIZE;
+
+    // first fit over the gaps between areas
+    uintptr_t start = KVMM_VMALLOC_START;
+    kvm_area_t **link = &areas;
+    while (*link && (*link)->start - start < span) {
+        start = (*link)->start + ((*link)->pages + 1) * KPAGE_SIZE;
+        link = &(*link)->next;
+    }
+    if (KVMM_VMALLOC_END - start < span)
+        return NULL;
+
+    kvm_area_t *area = kmalloc_tagged(sizeof(kvm_area_t), KMEM_TAG_VMM);
+    if (!area)
+        return NULL;
+
+    for (size_t i = 0; i < pages; i++) {
+        void *frame = kpage_alloc(0);
+        if (!frame || !_kvmm_map(start + i * KPAGE_SIZE, (uintptr_t)frame, PTE_WRITE)) {
+            if (frame)
+                kpage_free(frame, 0);
+            _kvmm_release_pages(start, i);
+            kfree(area);
+            return NULL;
+        }
+    }
+
+    area->start = start;
+    area->pages = pages;
+    area->tag = tag;
+    area->next = *link;
+    *link = area;
+
+    kmem_stats_alloc(tag, pages * KPAGE_SIZE);
+    return (void *)start;
+}
+
+static void *_kvmm_vmalloc(size_t size, kmem_tag_t tag) {
+    kspin_lock(&kvmm_lock);
+    void *ptr = _kvmm_vmalloc_area(size, tag);
+    kspin_unlock(&kvmm_lock);
+    return ptr;
+}
+
+void *vmalloc(size_t size) {
+    return _kvmm_vmalloc(size, KMEM_TAG_VMM);
+}
+
+void vfree(void *ptr) {
+    kspin_lock(&kvmm_lock);
+    for (kvm_area_t **link = &areas; *link; link = &(*link)->next) {
+        kvm_area_t *area = *link;
+        if (area->start != (uintptr_t)ptr)
+            continue;
+
+        kmem_stats_free(area->tag, area->pages * KPAGE_SIZE);
+        _kvmm_release_pages(area->start, area->pages);
+        *link = area->next;
+        kfree(area);
+        break;
+    }
+    kspin_unlock(&kvmm_lock);
+}
+
+bool kvmm_is_vmalloc(const void *ptr) {
+    return (uintptr_t)ptr >= KVMM_VMALLOC_START && (uintptr_t)ptr < KVMM_VMALLOC_END;
+}
+
+void *kvmalloc_tagged(size_t size, kmem_tag_t tag) {
+    if (size >= KVMM_VMALLOC_THRESHOLD) {
+        void *ptr = _kvmm_vmalloc(size, tag);
+        if (ptr)
+            return ptr;
+    }
+    return kmalloc_tagged(size, tag);
+}
+
+void *kvmalloc(size_t size) {
+    return kvmalloc_tagged(size, KMEM_TAG_MISC);
+}
+
+void kvfree(void *ptr) {
+    if (kvmm_is_vmalloc(ptr))
+        vfree(ptr);
+    else
+        kfree(ptr);
+}
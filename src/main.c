@@ -10,17 +10,36 @@
 #include <agave/kvid.h>
 #include <agave/kutils.h>
 #include <agave/kmem.h>
+#include <agave/kmemops.h>
+#include <agave/kcpu.h>
+#include <agave/kirq.h>
+#include <agave/kirqlat.h>
+#include <agave/kpage.h>
+#include <agave/kvmm.h>
+#include <agave/multiboot.h>
+#include <agave/input.h>
+#include <agave/kthread.h>
+
+void kmain(uint32_t magic, multiboot_info_t *mbi) {
+    kcpu_init();
+    kirqlat_init();
+    kmemops_init();
 
-void kmain() {
     pic_remap();
     idt_init();
 
     ktimer_initialize(TICK_FREQUENCY);
-    kdriver_init_all();
-
-    flush_keyboard_buffer();
 
+    kpage_init(magic, mbi);
+    kvmm_init();
     kheap_init();
+    kthread_init();
+    kcpu_smp_init();
+    kirq_init();
+    ktimer_use_lapic();
+    // drivers unmask their IRQs only once they are routed through the IOAPIC, see kirq_init
+    kdriver_init_all();
+    flush_keyboard_buffer();
     kcore_initialize();
     terminal_initialize(true);
 
@@ -28,5 +47,10 @@ void kmain() {
     fs_mount_all();
 
     kenable_interrupts();
-    kidle();
+
+    // the main thread runs the shell, it sleeps until a key event arrives and the idle thread halts meanwhile
+    for (;;) {
+        input_dispatch();
+        input_wait();
+    }
 }
\ No newline at end of file
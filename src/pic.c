@@ -39,4 +39,17 @@ void pic_mask_irq(uint8_t irq) {
         pic2_mask |= (1 << irq);
         outb(PIC2_DATA, pic2_mask);
     }
-}
\ No newline at end of file
+}
+
+void pic_disable(void) {
+    pic1_mask = 0xFF;
+    pic2_mask = 0xFF;
+    outb(PIC1_DATA, pic1_mask);
+    outb(PIC2_DATA, pic2_mask);
+}
+
+void pic_send_eoi(uint8_t irq) {
+    if (irq >= 8)
+        outb(PIC2_COMMAND, PIC_EOI);
+    outb(PIC1_COMMAND, PIC_EOI);
+}
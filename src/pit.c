@@ -1,39 +1,130 @@
 #include <agave/pit.h>
-#include <agave/pic.h>
+#include <agave/kirq.h>
 #include <agave/ports.h>
-#include <agave/idt.h>
 #include <agave/io.h>
+#include <agave/kutils.h>
+#include <agave/ktimer.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #define PIT_CHANNEL0 0x40
+#define PIT_CHANNEL2 0x42
 #define PIT_COMMAND  0x43
-#define PIT_FREQUENCY 1193182
+#define PIT_GATE     0x61 // bit 0 gates channel 2, bit 1 feeds it to the speaker, bit 5 is its output
+
+#define PIT_MODE_PERIODIC 0x36 // channel 0, lobyte/hibyte, rate generator
+#define PIT_MODE_ONESHOT  0x30 // channel 0, lobyte/hibyte, interrupt on terminal count
+#define PIT_READBACK_CH0  0xC2 // latch count and status of channel 0
+#define PIT_CH2_ONESHOT   0xB0 // channel 2, lobyte/hibyte, interrupt on terminal count
+
+#define PIT_GATE_ENABLE  0x01
+#define PIT_GATE_SPEAKER 0x02
+#define PIT_GATE_OUTPUT  0x20
+
+#define PIT_STATUS_OUTPUT     0x80
+#define PIT_STATUS_NULL_COUNT 0x40
+
+// shortest one-shot, keeps a deadline that has already passed from storming the IRQ
+#define PIT_MIN_DELTA 16
+#define PIT_MAX_DELTA 0xFFFF
 
 static volatile uint64_t pit_ticks = 0;
+static uint32_t pit_divisor = 0;
+
+static bool pit_oneshot = false;
+static volatile uint64_t pit_clocks = 0; // clocks up to the start of the current one-shot
+static uint32_t pit_programmed = 0;
+static uint64_t pit_deadline = PIT_NO_DEADLINE;
 
-void pit_callback(void) {
-    pit_ticks++;
-    pic_send_eoi(0);
+// clocks counted down since the current one-shot was programmed, interrupts must be off
+static uint32_t _pit_oneshot_elapsed(void) {
+    outb(PIT_COMMAND, PIT_READBACK_CH0);
+    uint8_t status = inb(PIT_CHANNEL0);
+    uint16_t count = inb(PIT_CHANNEL0);
+    count |= (uint16_t)inb(PIT_CHANNEL0) << 8;
+
+    if (status & PIT_STATUS_NULL_COUNT)
+        return 0;
+    // after the terminal count the output stays high and the counter wraps to 0xFFFF
+    if (status & PIT_STATUS_OUTPUT)
+        return pit_programmed + (uint16_t)(0x10000 - count);
+    return pit_programmed - count;
 }
 
-CREATE_ISR(0, pit_callback)
+static void _pit_oneshot_program(void) {
+    uint64_t delta = PIT_MAX_DELTA;
+    if (pit_deadline != PIT_NO_DEADLINE) {
+        delta = pit_deadline > pit_clocks ? pit_deadline - pit_clocks : 0;
+        if (delta < PIT_MIN_DELTA)
+            delta = PIT_MIN_DELTA;
+        if (delta > PIT_MAX_DELTA)
+            delta = PIT_MAX_DELTA;
+    }
+
+    pit_programmed = (uint32_t)delta;
+    outb(PIT_COMMAND, PIT_MODE_ONESHOT);
+    outb(PIT_CHANNEL0, delta & 0xFF);
+    outb(PIT_CHANNEL0, (delta >> 8) & 0xFF);
+}
+
+static void _pit_interrupt(UNUSED kirq_frame_t *frame, UNUSED void *data) {
+    if (pit_oneshot) {
+        pit_clocks += _pit_oneshot_elapsed();
+        // a reached deadline is consumed, whoever set it rechecks and sets the next one
+        if (pit_deadline != PIT_NO_DEADLINE && pit_clocks >= pit_deadline)
+            pit_deadline = PIT_NO_DEADLINE;
+        _pit_oneshot_program();
+    } else {
+        pit_ticks++;
+    }
+    ktimer_interrupt();
+}
 
 void pit_init(uint32_t frequency_hz) {
     uint16_t divisor = PIT_FREQUENCY / frequency_hz;
+    pit_divisor = divisor;
 
-    outb(PIT_COMMAND, 0x36);
+    outb(PIT_COMMAND, PIT_MODE_PERIODIC);
     outb(PIT_CHANNEL0, divisor & 0xFF);
     outb(PIT_CHANNEL0, (divisor >> 8));
-    idt_set_descriptor(IRQ0, irq0_handler, IDT_FLAG_PRESENT | IDT_FLAG_INTERRUPT);
-    pic_unmask_irq(0);
+    kirq_register(0, "pit", _pit_interrupt, NULL);
+}
+
+void pit_init_oneshot(void) {
+    pit_oneshot = true;
+    pit_clocks = 0;
+    pit_deadline = PIT_NO_DEADLINE;
+    _pit_oneshot_program();
+    kirq_register(0, "pit", _pit_interrupt, NULL);
+}
+
+uint64_t pit_get_clocks(void) {
+    uint32_t flags = ksave_interrupts();
+    uint64_t clocks = pit_oneshot ? pit_clocks + _pit_oneshot_elapsed()
+                                  : pit_ticks * pit_divisor;
+    krestore_interrupts(flags);
+    return clocks;
 }
 
-uint64_t pit_get_ticks(void) {
-    return pit_ticks;
+void pit_set_deadline(uint64_t clocks) {
+    if (!pit_oneshot)
+        return;
+
+    uint32_t flags = ksave_interrupts();
+    pit_deadline = clocks;
+    // restart the countdown from now so an earlier deadline is not missed
+    pit_clocks += _pit_oneshot_elapsed();
+    _pit_oneshot_program();
+    krestore_interrupts(flags);
 }
 
-void pic_send_eoi(uint8_t irq) {
-    if (irq >= 8)
-        outb(PIC2_COMMAND, PIC_EOI);
-    outb(PIC1_COMMAND, PIC_EOI);
-}
\ No newline at end of file
+void pit_busy_wait(uint16_t clocks) {
+    // channel 2 is not wired to an interrupt, its output is polled through the gate port
+    outb(PIT_GATE, (inb(PIT_GATE) & ~PIT_GATE_SPEAKER) | PIT_GATE_ENABLE);
+    outb(PIT_COMMAND, PIT_CH2_ONESHOT);
+    outb(PIT_CHANNEL2, clocks & 0xFF);
+    outb(PIT_CHANNEL2, (clocks >> 8) & 0xFF);
+
+    while (!(inb(PIT_GATE) & PIT_GATE_OUTPUT))
+        ;
+}
@@ -1,28 +1,72 @@
 #include <stdint.h>
 
-uint64_t __udivdi3(uint64_t n, uint64_t d) {
-    uint64_t q = 0;
-    uint64_t r = 0;
-    for (int i = 63; i >= 0; i--) {
-        r = (r << 1) | ((n >> i) & 1);
-        if (r >= d) {
-            r -= d;
-            q |= ((uint64_t)1 << i);
-        }
-    }
+/*
+ * 64-bit division runtime normally provided by libgcc. 32-bit divisors use
+ * two chained divl instructions, wider divisors are normalized so a single
+ * divl gives an estimate that is off by at most one (Hacker's Delight 9-5).
+ */
+
+// n_hi must be below d or divl faults
+static inline uint32_t _div_divl(uint32_t n_hi, uint32_t n_lo, uint32_t d, uint32_t *rem) {
+    uint32_t q, r;
+    __asm__("divl %4" : "=a"(q), "=d"(r) : "a"(n_lo), "d"(n_hi), "rm"(d));
+    *rem = r;
     return q;
 }
 
 uint64_t __udivmoddi4(uint64_t n, uint64_t d, uint64_t *rem) {
-    uint64_t q = 0;
-    uint64_t r = 0;
-    for (int i = 63; i >= 0; i--) {
-        r = (r << 1) | ((n >> i) & 1);
-        if (r >= d) {
-            r -= d;
-            q |= (1ULL << i);
+    uint32_t n_hi = (uint32_t)(n >> 32), n_lo = (uint32_t)n;
+    uint32_t d_hi = (uint32_t)(d >> 32), d_lo = (uint32_t)d;
+    uint32_t r;
+
+    if (d_hi == 0) {
+        uint32_t q_hi = 0;
+        if (n_hi >= d_lo) {
+            q_hi = n_hi / d_lo;
+            n_hi %= d_lo;
         }
+        uint32_t q_lo = _div_divl(n_hi, n_lo, d_lo, &r);
+        if (rem) *rem = r;
+        return ((uint64_t)q_hi << 32) | q_lo;
     }
-    if (rem) *rem = r;
+
+    if (n < d) {
+        if (rem) *rem = n;
+        return 0;
+    }
+
+    // shift the divisor so its top bit is set, halve the dividend so divl cannot overflow
+    int shift = __builtin_clz(d_hi);
+    uint32_t d_norm = (uint32_t)((d << shift) >> 32);
+    uint64_t n_half = n >> 1;
+    uint64_t q = _div_divl((uint32_t)(n_half >> 32), (uint32_t)n_half, d_norm, &r);
+
+    q = (q << shift) >> 31;
+    if (q != 0) q--;
+    if (n - q * d >= d) q++;
+
+    if (rem) *rem = n - q * d;
     return q;
-}
\ No newline at end of file
+}
+
+uint64_t __udivdi3(uint64_t n, uint64_t d) {
+    return __udivmoddi4(n, d, 0);
+}
+
+uint64_t __umoddi3(uint64_t n, uint64_t d) {
+    uint64_t r;
+    __udivmoddi4(n, d, &r);
+    return r;
+}
+
+int64_t __divdi3(int64_t n, int64_t d) {
+    uint64_t q = __udivmoddi4(n < 0 ? -(uint64_t)n : (uint64_t)n,
+                              d < 0 ? -(uint64_t)d : (uint64_t)d, 0);
+    return (n < 0) != (d < 0) ? -(int64_t)q : (int64_t)q;
+}
+
+int64_t __moddi3(int64_t n, int64_t d) {
+    uint64_t r;
+    __udivmoddi4(n < 0 ? -(uint64_t)n : (uint64_t)n, d < 0 ? -(uint64_t)d : (uint64_t)d, &r);
+    return n < 0 ? -(int64_t)r : (int64_t)r;
+}
@@ -1,30 +1,65 @@
 #include <agave/kmem.h>
 #include <string.h>
+#include <stdint.h>
+
+// word-at-a-time scanning, aligned reads never cross into the next page
+typedef uint32_t __attribute__((__may_alias__)) str_word_t;
+
+#define STR_ONES  0x01010101u
+#define STR_HIGHS 0x80808080u
+#define STR_HAS_ZERO(w) (((w) - STR_ONES) & ~(w) & STR_HIGHS)
 
 size_t strlen(const char* str) {
-    size_t len = 0;
-    while (str[len] != '\0') {
-        len++;
+    const char* s = str;
+    while ((uintptr_t)s & 3) {
+        if (*s == '\0') {
+            return (size_t)(s - str);
+        }
+        s++;
+    }
+
+    const str_word_t* w = (const str_word_t*)s;
+    while (!STR_HAS_ZERO(*w)) {
+        w++;
     }
-    return len;
+
+    s = (const char*)w;
+    while (*s != '\0') {
+        s++;
+    }
+    return (size_t)(s - str);
 }
 
 char* strcpy(char* dest, const char* src) {
-    char* original_dest = dest;
-    while ((*dest++ = *src++) != '\0');
-    return original_dest;
+    kmemcpy(dest, src, strlen(src) + 1);
+    return dest;
 }
 
 char* strcat(char* dest, const char* src) {
-    char* original_dest = dest;
-    while (*dest != '\0') {
-        dest++;
-    }
-    while ((*dest++ = *src++) != '\0');
-    return original_dest;
+    strcpy(dest + strlen(dest), src);
+    return dest;
 }
 
 int strcmp(const char* str1, const char* str2) {
+    if (((uintptr_t)str1 & 3) == ((uintptr_t)str2 & 3)) {
+        while ((uintptr_t)str1 & 3) {
+            if (!*str1 || *str1 != *str2) {
+                return *(unsigned char*)str1 - *(unsigned char*)str2;
+            }
+            str1++;
+            str2++;
+        }
+
+        const str_word_t* w1 = (const str_word_t*)str1;
+        const str_word_t* w2 = (const str_word_t*)str2;
+        while (*w1 == *w2 && !STR_HAS_ZERO(*w1)) {
+            w1++;
+            w2++;
+        }
+        str1 = (const char*)w1;
+        str2 = (const char*)w2;
+    }
+
     while (*str1 && (*str1 == *str2)) {
         str1++;
         str2++;
@@ -44,12 +79,28 @@ int strncmp(const char* str1, const char* str2, size_t n) {
 }
 
 char* strchr(const char* str, int c) {
-    while (*str != '\0') {
-        if (*str == (char)c) {
+    char ch = (char)c;
+    while ((uintptr_t)str & 3) {
+        if (*str == '\0') {
+            return NULL;
+        }
+        if (*str == ch) {
             return (char*)str;
         }
         str++;
     }
+
+    uint32_t pattern = (uint8_t)ch * STR_ONES;
+    const str_word_t* w = (const str_word_t*)str;
+    while (!STR_HAS_ZERO(*w) && !STR_HAS_ZERO(*w ^ pattern)) {
+        w++;
+    }
+
+    for (str = (const char*)w; *str != '\0'; str++) {
+        if (*str == ch) {
+            return (char*)str;
+        }
+    }
     return NULL;
 }
 
@@ -57,7 +108,7 @@ char* strdup(const char* str) {
     size_t len = strlen(str);
     char* dup = (char*)kmalloc(len + 1);
     if (dup) {
-        strcpy(dup, str);
+        kmemcpy(dup, str, len + 1);
     }
     return dup;
 }
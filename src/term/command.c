@@ -1,7 +1,23 @@
 #include <agave/kmem.h>
+#include <agave/karena.h>
+#include <agave/kmemops.h>
 #include <agave/fs.h>
 #include <agave/kcore.h>
+#include <agave/kcpu.h>
+#include <agave/kpage.h>
+#include <agave/drivers/serial.h>
+#include <agave/kvmm.h>
+#include <agave/kslab.h>
 #include <agave/klog.h>
+#include <agave/ktimer.h>
+#include <agave/kclock.h>
+#include <agave/ksoftirq.h>
+#include <agave/kthread.h>
+#include <agave/klock.h>
+#include <agave/kirq.h>
+#include <agave/kirqlat.h>
+#include <agave/idt.h>
+#include <agave/kutils.h>
 #include <agave/terminal.h>
 #include <string.h>
 #include <stdbool.h>
@@ -79,7 +95,14 @@ COMMAND(bootinfo, "displays boot information") {
     kcore_information_t *info = kcore_get_information();
     out("kernel version: %s\n", info->kernel_version);
     out("cpu count: %u\n", info->cpus_count);
-    out("uptime (ticks): %u\n", info->uptime_ticks);
+    out("memory: %u KB total, %u KB free\n",
+        kpage_total_count() * (KPAGE_SIZE / 1024), kpage_free_count() * (KPAGE_SIZE / 1024));
+    out("uptime (ticks): %llu\n", info->uptime_ticks);
+    const kclocksource_t *clock = kclock_source();
+    out("clock source: %s at %u kHz\n", clock->name, clock->frequency_khz);
+    out("interrupt controller: %s\n", kirq_controller_name());
+    out("timer interrupt: %s\n", ktimer_device_name());
+    out("serial bytes dropped: %u\n", serial_dropped_count());
 }
 
 COMMAND(ls, "lists files in the specified directory") {
@@ -100,6 +123,22 @@ COMMAND(ls, "lists files in the specified directory") {
     kfree(list);
 }
 
+COMMAND(du, "shows the total size of the files below a directory") {
+    fs_t *fs = kcore_get_information()->fs;
+    if (!fs || !fs_is_mounted(fs)) { out("no filesystem mounted.\n"); return; }
+    const char *dir = args[0] ? arg_rest(args) : "/";
+
+    size_t size = 0;
+    uint64_t start = kclock_ns();
+    fs_status_t status = fs_directory_size(fs, dir, &size);
+    uint64_t elapsed = kclock_ns() - start;
+    if (status != FS_STATUS_OK) {
+        out("error sizing directory '%s': %s\n", dir, fs_status_to_string(status));
+        return;
+    }
+    out("%u bytes in %s (%llu us on %u cpus)\n", size, dir, elapsed / 1000, kcpu_get_cpu_count());
+}
+
 COMMAND(touch, "creates an empty file") {
     fs_t *fs = kcore_get_information()->fs;
     if (!fs || !fs_is_mounted(fs)) { out("no filesystem mounted.\n"); return; }
@@ -108,13 +147,13 @@ COMMAND(touch, "creates an empty file") {
     const char *file = arg_next(&args, &len);
     if (!file || !len) { out("usage: touch [filename]\n"); return; }
 
-    char *filename = (char *)kmalloc(len + 1);
-    kmemcpy(filename, file, len);
-    filename[len] = '\0';
+    karena_t *scratch = kscratch();
+    karena_mark_t mark = karena_mark(scratch);
+    char *filename = karena_strndup(scratch, file, len);
 
     fs_status_t status = fs_add_file(fs, filename, NULL, 0,
                                      RAMFS_FILE_TYPE_REGULAR | FS_PERM_READ | FS_PERM_WRITE);
-    kfree(filename);
+    karena_pop(scratch, mark);
 
     if (status != FS_STATUS_OK) { out("error creating file: %s\n", fs_status_to_string(status)); return; }
     out("file created successfully.\n");
@@ -128,17 +167,25 @@ COMMAND(cat, "displays the contents of a file") {
     const char *file = arg_next(&args, &len);
     if (!file || !len) { out("usage: cat [filename]\n"); return; }
 
-    char *filename = (char *)kmalloc(len + 1);
-    kmemcpy(filename, file, len);
-    filename[len] = '\0';
-
-    const void *data = NULL;
-    size_t size = 0;
-    fs_status_t status = fs_read_file(fs, filename, &data, &size);
-    kfree(filename);
-
-    if (status != FS_STATUS_OK) { out("error reading file: %s\n", fs_status_to_string(status)); return; }
-    out("%.*s\n", (int)size, (const char *)data);
+    karena_t *scratch = kscratch();
+    karena_mark_t mark = karena_mark(scratch);
+    char *filename = karena_strndup(scratch, file, len);
+
+    // the file may change between the two calls, only what was copied is printed
+    char *data = NULL;
+    size_t capacity = 0, size = 0;
+    fs_status_t status = fs_file_size(fs, filename, &capacity);
+    if (status == FS_STATUS_OK && capacity && !(data = kvmalloc_tagged(capacity, KMEM_TAG_COMMAND)))
+        status = FS_STATUS_ERROR_NO_SPACE;
+    if (status == FS_STATUS_OK)
+        status = fs_read_file(fs, filename, data, capacity, &size);
+    karena_pop(scratch, mark);
+
+    if (status == FS_STATUS_OK)
+        out("%.*s\n", (int)(size < capacity ? size : capacity), data ? data : "");
+    else
+        out("error reading file: %s\n", fs_status_to_string(status));
+    kvfree(data);
 }
 
 COMMAND(writeto, "writes text to a file") {
@@ -149,15 +196,15 @@ COMMAND(writeto, "writes text to a file") {
     const char *file = arg_next(&args, &len);
     if (!file || !len) { out("usage: writeto [filename] [text]\n"); return; }
 
-    char *filename = (char *)kmalloc(len + 1);
-    kmemcpy(filename, file, len);
-    filename[len] = '\0';
+    karena_t *scratch = kscratch();
+    karena_mark_t mark = karena_mark(scratch);
+    char *filename = karena_strndup(scratch, file, len);
 
     const char *text = arg_rest(args);
     size_t text_len = strlen(text);
 
     fs_status_t status = fs_write_file(fs, filename, text, text_len);
-    kfree(filename);
+    karena_pop(scratch, mark);
 
     if (status != FS_STATUS_OK) { out("error writing to file: %s\n", fs_status_to_string(status)); return; }
     out("wrote to file successfully.\n", text_len);
@@ -171,12 +218,12 @@ COMMAND(mkdir, "creates a new directory") {
     const char *dir = arg_next(&args, &len);
     if (!dir || !len) { out("usage: mkdir [directory]\n"); return; }
 
-    char *dirname = (char *)kmalloc(len + 1);
-    kmemcpy(dirname, dir, len);
-    dirname[len] = '\0';
+    karena_t *scratch = kscratch();
+    karena_mark_t mark = karena_mark(scratch);
+    char *dirname = karena_strndup(scratch, dir, len);
 
     fs_status_t status = fs_make_directory(fs, dirname);
-    kfree(dirname);
+    karena_pop(scratch, mark);
 
     if (status != FS_STATUS_OK) { out("error creating directory: %s\n", fs_status_to_string(status)); return; }
     out("directory created successfully.\n");
@@ -190,17 +237,350 @@ COMMAND(rmdir, "removes a directory") {
     const char *dir = arg_next(&args, &len);
     if (!dir || !len) { out("usage: rmdir [directory]\n"); return; }
 
-    char *dirname = (char *)kmalloc(len + 1);
-    kmemcpy(dirname, dir, len);
-    dirname[len] = '\0';
+    karena_t *scratch = kscratch();
+    karena_mark_t mark = karena_mark(scratch);
+    char *dirname = karena_strndup(scratch, dir, len);
 
     fs_status_t status = fs_remove_directory(fs, dirname);
-    kfree(dirname);
+    karena_pop(scratch, mark);
 
     if (status != FS_STATUS_OK) { out("error removing directory: %s\n", fs_status_to_string(status)); return; }
     out("directory removed successfully.\n");
 }
 
+// benchmarks time with the clock source, not the TSC, which not every CPU has
+static uint64_t _bench_ns(const kclocksource_t *clock, uint64_t counts) {
+    return kclock_convert(&clock->to_ns, counts);
+}
+
+// the benchmark goes to the heap backend directly, past the slab caches, so it takes the heap lock itself
+static void *_heapbench_alloc(size_t size) {
+    uint32_t flags = kheap_lock();
+    void *ptr = kheap_alloc(size);
+    kheap_unlock(flags);
+    return ptr;
+}
+
+static void _heapbench_free(void *ptr) {
+    uint32_t flags = kheap_lock();
+    kheap_free(ptr);
+    kheap_unlock(flags);
+}
+
+COMMAND(heapbench, "measures heap free latency at 10k/100k/1M live allocations") {
+    (void)args;
+    static const size_t counts[] = {10000, 100000, 1000000};
+    const size_t samples = 1000;
+    const kclocksource_t *clock = kclock_source();
+
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+        size_t n = counts[c];
+        void **blocks = (void **)_heapbench_alloc(n * sizeof(void *));
+        if (!blocks) { out("%u live allocations: out of memory\n", n); return; }
+
+        size_t live = 0;
+        while (live < n && (blocks[live] = _heapbench_alloc(16)) != NULL) live++;
+        if (live < n) {
+            for (size_t i = 0; i < live; i++) _heapbench_free(blocks[i]);
+            _heapbench_free(blocks);
+            out("%u live allocations: out of memory\n", n);
+            return;
+        }
+
+        // free blocks spread evenly over the heap so every position is sampled
+        size_t step = n / samples;
+        uint64_t total = 0;
+        for (size_t s = 0; s < samples; s++) {
+            size_t i = s * step + step / 2;
+            uint32_t flags = kheap_lock();
+            uint64_t start = clock->read();
+            kheap_free(blocks[i]);
+            total += clock->read() - start;
+            kheap_unlock(flags);
+            blocks[i] = NULL;
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            if (blocks[i]) _heapbench_free(blocks[i]);
+        }
+        _heapbench_free(blocks);
+
+        out("%u live allocations: %u ns/free\n", n, (uint32_t)(_bench_ns(clock, total) / samples));
+    }
+}
+
+COMMAND(membench, "compares kmemcpy/kmemset variants from 8 B to 1 MB") {
+    (void)args;
+    static const size_t sizes[] = {8, 64, 512, 4096, 32768, 262144, 1048576};
+    const size_t max_size = 1048576;
+
+    size_t count;
+    const kmemops_variant_t *variants = kmemops_variants(&count);
+    const kmemops_variant_t *selected = kmemops_selected();
+    const kclocksource_t *clock = kclock_source();
+
+    char *src = (char *)kmalloc_tagged(max_size, KMEM_TAG_COMMAND);
+    char *dst = (char *)kmalloc_tagged(max_size, KMEM_TAG_COMMAND);
+    if (!src || !dst) {
+        kfree(src);
+        kfree(dst);
+        out("out of memory\n");
+        return;
+    }
+    kmemset(src, 0x5a, max_size);
+
+    out("selected: %s, ns per call\n", selected->name);
+    for (int op = 0; op < 2; op++) {
+        out("%s    size", op == 0 ? "copy" : "set ");
+        for (size_t v = 0; v < count; v++) out("%10s", variants[v].name);
+        out("   speedup\n");
+
+        for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+            size_t size = sizes[i];
+            size_t reps = (4 * max_size) / size;
+            if (reps > 10000) reps = 10000;
+
+            uint64_t baseline = 0, best = 0;
+            out("%12u", size);
+            for (size_t v = 0; v < count; v++) {
+                if (!kcpu_has(variants[v].features)) { out("%10s", "-"); continue; }
+
+                uint64_t start = clock->read();
+                for (size_t r = 0; r < reps; r++) {
+                    if (op == 0) variants[v].copy(dst, src, size);
+                    else variants[v].set(dst, r, size);
+                }
+                uint64_t ns = _bench_ns(clock, clock->read() - start) / reps;
+                if (ns == 0) ns = 1;
+
+                if (v == 0) baseline = ns;
+                if (&variants[v] == selected) best = ns;
+                out("%10u", (uint32_t)ns);
+            }
+            uint32_t ratio = (uint32_t)(baseline * 100 / best);
+            out("%7u.%02ux\n", ratio / 100, ratio % 100);
+        }
+    }
+
+    kfree(src);
+    kfree(dst);
+}
+
+COMMAND(timebench, "measures the cost of converting timer ticks to nanoseconds") {
+    (void)args;
+    const uint32_t reps = 100000;
+    volatile uint32_t frequency = ktimer_get_frequency();
+    volatile uint64_t wide_divisor = (uint64_t)frequency << 32 | 1;
+    volatile uint64_t sink = 0;
+    uint64_t base = ktimer_get_ticks() + 0x123456789ull;
+    const kclocksource_t *clock = kclock_source();
+
+    uint64_t start = clock->read();
+    for (uint32_t i = 0; i < reps; i++) sink = (base + i) * 1000000000ull / frequency;
+    uint64_t div32 = _bench_ns(clock, clock->read() - start);
+
+    start = clock->read();
+    for (uint32_t i = 0; i < reps; i++) sink = ((base + i) << 32) / wide_divisor;
+    uint64_t div64 = _bench_ns(clock, clock->read() - start);
+
+    start = clock->read();
+    for (uint32_t i = 0; i < reps; i++) sink = ktimer_ticks_to_nanoseconds(base + i);
+    uint64_t mult = _bench_ns(clock, clock->read() - start);
+    (void)sink;
+
+    // whole microseconds for all the calls are hundredths of a nanosecond per call
+    out("ns per conversion over %u calls\n", reps);
+    out("  64/32 divide:     %u.%02u\n", (uint32_t)(div32 / 100000), (uint32_t)(div32 / 1000 % 100));
+    out("  64/64 divide:     %u.%02u\n", (uint32_t)(div64 / 100000), (uint32_t)(div64 / 1000 % 100));
+    out("  multiply & shift: %u.%02u\n", (uint32_t)(mult / 100000), (uint32_t)(mult / 1000 % 100));
+}
+
+static void _timerbench_noop(void *data) {
+    (void)data;
+}
+
+COMMAND(timerbench, "measures timer arm/cancel cost with 1k to 50k pending timers") {
+    (void)args;
+    static const size_t counts[] = {1000, 10000, 50000};
+    const size_t max_count = 50000;
+    const size_t samples = 1000;
+    const kclocksource_t *clock = kclock_source();
+
+    ktimer_t *timers = (ktimer_t *)kmalloc_tagged(max_count * sizeof(ktimer_t), KMEM_TAG_COMMAND);
+    if (!timers) { out("out of memory\n"); return; }
+
+    // expiries are spread over a minute so every wheel level holds timers
+    uint64_t now = ktimer_get_ticks();
+    uint32_t seed = 12345;
+    for (size_t i = 0; i < max_count; i++) ktimer_setup(&timers[i], _timerbench_noop, NULL);
+
+    size_t armed = 0;
+    out("%10s%12s%12s\n", "pending", "arm ns", "cancel ns");
+    for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++) {
+        for (; armed < counts[c]; armed++) {
+            seed = seed * 1103515245 + 12345;
+            ktimer_arm(&timers[armed], now + 1000 + (seed >> 8) % 60000);
+        }
+
+        uint64_t arm = 0, cancel = 0;
+        for (size_t s = 0; s < samples; s++) {
+            ktimer_t *timer = &timers[s * (armed / samples)];
+            uint64_t expires = timer->expires;
+
+            uint64_t start = clock->read();
+            ktimer_cancel(timer);
+            cancel += clock->read() - start;
+
+            start = clock->read();
+            ktimer_arm(timer, expires);
+            arm += clock->read() - start;
+        }
+
+        out("%10u%12u%12u\n", armed, (uint32_t)kdiv_u64_u32(_bench_ns(clock, arm), samples, NULL),
+            (uint32_t)kdiv_u64_u32(_bench_ns(clock, cancel), samples, NULL));
+    }
+
+    for (size_t i = 0; i < armed; i++) ktimer_cancel(&timers[i]);
+    kfree(timers);
+}
+
+COMMAND(softirqs, "shows run counts and time spent per softirq type") {
+    (void)args;
+    out("%8s%12s%14s%12s\n", "type", "runs", "total us", "max us");
+    for (int type = 0; type < KSOFTIRQ_COUNT; type++) {
+        const ksoftirq_stats_t *stats = ksoftirq_get_stats((ksoftirq_type_t)type);
+        out("%8s%12llu%14llu%12llu\n", stats->name, stats->runs,
+            stats->total_ns / 1000, stats->max_ns / 1000);
+    }
+}
+
+COMMAND(irqstat, "shows interrupt counts and cycles spent per vector") {
+    (void)args;
+    out("%6s%12s%14s%10s  %s\n", "vector", "count", "cycles", "avg", "handlers");
+    for (uint32_t vector = 0; vector < IDT_MAX_DESCRIPTORS; vector++) {
+        const kirq_stats_t *stats = kirq_get_stats((uint8_t)vector);
+        const kirq_handler_t *handler = kirq_get_handlers((uint8_t)vector);
+        if (!stats->count && !handler)
+            continue;
+
+        uint64_t avg = stats->count ? kdiv_u64_u32(stats->cycles, (uint32_t)stats->count, NULL) : 0;
+        out("  0x%02x%12llu%14llu%10llu  ", vector, stats->count, stats->cycles, avg);
+        for (; handler; handler = handler->next)
+            out(handler->next ? "%s, " : "%s", handler->name);
+        out("\n");
+    }
+}
+
+static void _irqlat_buckets(const kirqlat_hist_t *hist, command_output_fn out) {
+    for (uint32_t i = 0; i < KIRQLAT_BUCKETS; i++) {
+        if (hist->buckets[i])
+            out("%14llu%10u\n", 1ull << i, hist->buckets[i]);
+    }
+}
+
+COMMAND(irqlat, "shows interrupts-off and handler durations, irqlat reset clears them") {
+    if (strcmp(arg_rest(args), "reset") == 0) {
+        kirqlat_reset();
+        return;
+    }
+    if (!kirqlat_enabled()) {
+        out("interrupt latency tracing is disabled, it needs a KIRQ_TRACE build and a CPU with a TSC\n");
+        return;
+    }
+
+    const kirqlat_hist_t *off = kirqlat_irqs_off_hist();
+    out("interrupts off: %llu sections, max %llu cycles\n", off->count, off->max_cycles);
+    out("%14s%10s\n", "cycles >=", "count");
+    _irqlat_buckets(off, out);
+
+    for (uint32_t vector = 0; vector < IDT_MAX_DESCRIPTORS; vector++) {
+        const kirqlat_hist_t *hist = kirqlat_handler_hist((uint8_t)vector);
+        if (!hist->count)
+            continue;
+
+        const kirq_handler_t *handler = kirq_get_handlers((uint8_t)vector);
+        uint64_t avg = kdiv_u64_u32(hist->total_cycles, (uint32_t)hist->count, NULL);
+        out("\nvector 0x%02x %s: %llu runs, avg %llu, max %llu cycles\n", vector,
+            handler ? handler->name : "-", hist->count, avg, hist->max_cycles);
+        _irqlat_buckets(hist, out);
+    }
+
+    out("\nlongest interrupts-off sections:\n%12s%6s%12s\n", "site", "cpu", "cycles");
+    const kirqlat_offender_t *worst = kirqlat_worst();
+    for (uint32_t i = 0; i < KIRQLAT_WORST && worst[i].cycles; i++) {
+        if (worst[i].site < KIRQLAT_SITE_VECTORS)
+            out("    irq 0x%02x%6u%12llu\n", worst[i].site, worst[i].cpu, worst[i].cycles);
+        else
+            out("  0x%08x%6u%12llu\n", worst[i].site, worst[i].cpu, worst[i].cycles);
+    }
+}
+
+COMMAND(threads, "lists kernel threads with their state and switch counts") {
+    (void)args;
+    out("%4s  %-16s%10s%12s\n", "id", "name", "state", "switches");
+    uint32_t flags = ksave_interrupts();
+    for (kthread_t *thread = kthread_first(); thread; thread = thread->all_next)
+        out("%4u  %-16s%10s%12llu\n", thread->id, thread->name,
+            kthread_state_name(thread->state), thread->switches);
+    krestore_interrupts(flags);
+}
+
+COMMAND(cpus, "lists online processors and the jobs each one ran") {
+    (void)args;
+    out("%4s%6s%12s%12s\n", "cpu", "apic", "jobs", "stolen");
+    for (uint32_t i = 0; i < kcpu_get_cpu_count(); i++) {
+        kcpu_local_t *cpu = kcpu_get(i);
+        out("%4u%6u%12llu%12llu\n", cpu->id, cpu->apic_id, cpu->jobs_run, cpu->jobs_stolen);
+    }
+}
+
+COMMAND(lockstat, "shows acquisitions, contention and hold times per lock") {
+    (void)args;
+#ifdef KLOCK_STATS
+    out("%-14s%10s%10s%12s%12s\n", "lock", "acquired", "contended", "spins", "max hold us");
+    for (const klock_stats_t *stats = klock_stats_first(); stats; stats = stats->next)
+        out("%-14s%10llu%10llu%12llu%12llu\n", stats->name, stats->acquisitions,
+            stats->contended, stats->spins, stats->max_hold_ns / 1000);
+#else
+    out("lock statistics are disabled, build with KLOCK_STATS\n");
+#endif
+}
+
+COMMAND(meminfo, "shows heap usage per tag, slab caches and free block sizes") {
+    (void)args;
+    kmem_heap_info_t info;
+    kmem_get_heap_info(&info);
+
+    out("pages: %u KB total, %u KB free\n",
+        kpage_total_count() * (KPAGE_SIZE / 1024), kpage_free_count() * (KPAGE_SIZE / 1024));
+    out("heap: %u KB in %u regions, %u KB free in %u blocks, largest %u KB\n",
+        info.total_bytes / 1024, info.region_count, info.free_bytes / 1024,
+        info.free_blocks, info.largest_free / 1024);
+
+    out("\n%-10s%12s%10s%12s%12s\n", "tag", "live bytes", "allocs", "peak bytes", "total");
+    for (int tag = 0; tag < KMEM_TAG_COUNT; tag++) {
+        const kmem_tag_stats_t *stats = kmem_get_tag_stats((kmem_tag_t)tag);
+        out("%-10s%12u%10u%12u%12u\n", stats->name, stats->live_bytes, stats->live_allocs,
+            stats->peak_bytes, stats->total_allocs);
+    }
+
+    out("\n%-14s%8s%8s%8s\n", "cache", "size", "active", "slabs");
+    for (kmem_cache_t *cache = kslab_first_cache(); cache; cache = cache->next) {
+        if (cache->slab_count == 0) continue;
+        out("%-14s%8u%8u%8u\n", cache->name, cache->object_size, cache->active_objects,
+            cache->slab_count);
+    }
+
+    out("\nfree blocks by size:\n");
+    for (size_t i = 0; i < KMEM_HISTOGRAM_BUCKETS; i++) {
+        if (!info.histogram[i]) continue;
+        if (i + 1 < KMEM_HISTOGRAM_BUCKETS)
+            out("  %8u - %8u: %u\n", (size_t)16 << i, ((size_t)32 << i) - 1, info.histogram[i]);
+        else
+            out("  %8u+          : %u\n", (size_t)16 << i, info.histogram[i]);
+    }
+}
+
 COMMAND(help, "lists all available commands") {
     (void)args;
     out("Available commands:\n");
@@ -30,14 +30,19 @@ static void redraw_line(void) {
   ksetpos(krow, 0);
   kprintf("> %s", command_buffer);
 
-  for (int i = command_length + 2; i < kline_end[krow]; i++)
-    vidptr[krow * SCREEN_WIDTH + i] = (kcurrent_color << 8) | ' ';
-  kline_end[krow] = command_length + 2;
+  kclear_line_from(krow, command_length + 2);
 
   ksetpos(krow, cursor_pos + 2);
 }
 
 bool terminal_key_press(uint8_t c) {
+  if (c == KEY_SCROLL_UP || c == KEY_SCROLL_DOWN) {
+    kscrollback(c == KEY_SCROLL_UP ? SCREEN_HEIGHT - 1 : -(SCREEN_HEIGHT - 1));
+    return true;
+  }
+  // any other key goes back to the live screen first
+  kscrollback_reset();
+
   size_t krow = kgetpos().krow;
 
   switch (c) {